@@ -3,6 +3,8 @@ let devices = [];
 let activeDeviceId = null;
 let esp32Connected = false;
 let refreshInterval = null;
+const SELF_TEST_POLL_MS = 500;
+const SELF_TEST_POLL_ATTEMPTS = 20;
 
 // Initialize app
 document.addEventListener('DOMContentLoaded', async () => {
@@ -1058,9 +1060,29 @@ async function runSelfTest(deviceId = null) {
     }
     
     try {
-        const response = await fetch('/api/esp32/selftest');
-        const data = await response.json();
-        alert('Self Test Results:\n\n' + JSON.stringify(data, null, 2));
+        const startResponse = await fetch('/api/esp32/selftest', { method: 'POST' });
+        const job = await startResponse.json();
+        if (!job.success) {
+            showNotification(job.error || 'Self test could not start', 'error');
+            return;
+        }
+        showNotification('Self test started', 'info');
+        
+        // The device runs the tests in the background; poll until done
+        for (let attempt = 0; attempt < SELF_TEST_POLL_ATTEMPTS; attempt++) {
+            await new Promise(resolve => setTimeout(resolve, SELF_TEST_POLL_MS));
+            const response = await fetch(`/api/esp32/selftest?id=${job.id}`);
+            const data = await response.json();
+            if (data.state === 'done') {
+                const lines = Object.entries(data.results).map(([name, result]) =>
+                    result.skipped ? `${name}: SKIPPED (gate in use)` :
+                    `${name}: ${result.ok ? 'OK' : 'FAIL'} (${(result.us / 1000).toFixed(1)} ms)`);
+                alert(`Self Test Results (${data.durationMs} ms):\n\n` + lines.join('\n'));
+                return;
+            }
+            if (!response.ok || data.state === 'failed') break;
+        }
+        showNotification('Self test did not finish', 'error');
     } catch (error) {
         showNotification('Self test failed', 'error');
     }
@@ -2,11 +2,13 @@ const express = require('express');
 const cors = require('cors');
 const bodyParser = require('body-parser');
 const axios = require('axios');
+const { encode, decode } = require('@msgpack/msgpack');
 const path = require('path');
 const fs = require('fs');
 
 const app = express();
 const PORT = 3000;
+const KEEP_ALIVE_TIMEOUT_MS = 65000;  // Above the gates' RPC_KEEPALIVE_IDLE_MS
 
 // Database file paths
 const DB_DIR = path.join(__dirname, 'database');
@@ -60,9 +62,250 @@ function saveDatabase(filePath, data) {
   }
 }
 
+// ==================== User Revisions ====================
+// Every change to a user takes the next database revision and deletes leave
+// a tombstone, so devices can fetch only what changed since the revision
+// they hold. Tombstones beyond TOMBSTONE_LIMIT are pruned; devices older
+// than the pruned ones get a full copy again.
+const TOMBSTONE_LIMIT = 1000;
+
+// Users database with revision fields, filled in for older files
+function loadUsersDatabase() {
+  const data = loadDatabase(USERS_DB_FILE);
+  if (!data) return null;
+  
+  if (!Array.isArray(data.users)) data.users = [];
+  if (typeof data.revision !== 'number') data.revision = 0;
+  if (!Array.isArray(data.tombstones)) data.tombstones = [];
+  if (typeof data.tombstoneFloor !== 'number') data.tombstoneFloor = 0;
+  if (!data.deviceSeqs || typeof data.deviceSeqs !== 'object') data.deviceSeqs = {};
+  data.users.forEach(user => {
+    if (typeof user.rev !== 'number') user.rev = ++data.revision;
+  });
+  return data;
+}
+
+// Marks a user as changed
+function touchUser(data, user) {
+  user.rev = ++data.revision;
+  data.tombstones = data.tombstones.filter(t => t.uid !== user.uid);
+}
+
+function addTombstone(data, uid) {
+  data.tombstones = data.tombstones.filter(t => t.uid !== uid);
+  data.tombstones.push({ uid, rev: ++data.revision, deletedAt: new Date().toISOString() });
+  
+  if (data.tombstones.length > TOMBSTONE_LIMIT) {
+    const pruned = data.tombstones.splice(0, data.tombstones.length - TOMBSTONE_LIMIT);
+    data.tombstoneFloor = pruned[pruned.length - 1].rev;
+  }
+}
+
+// Sync body for a device holding revision `since` (0 = nothing): the users
+// and tombstones newer than that, or all users if it cannot be brought up
+// to date from the tombstones still kept. "since" goes first so the device
+// knows the kind of sync before the first user arrives.
+function buildSyncPayload(data, settings, since) {
+  const delta = since > 0 && since >= data.tombstoneFloor && since <= data.revision;
+  const payload = { since: delta ? since : 0, revision: data.revision };
+  if (settings) payload.settings = settings;
+  
+  if (delta) {
+    payload.users = data.users
+      .filter(u => u.rev > since)
+      .concat(data.tombstones.filter(t => t.rev > since).map(t => ({ uid: t.uid, rev: t.rev, deleted: true })));
+  } else {
+    payload.users = data.users;
+  }
+  return payload;
+}
+
+// Sends a sync body; devices that list MessagePack in /api/info get the
+// smaller encoding
+function postSyncPayload(device, payload) {
+  const msgPack = !!(device.info && Array.isArray(device.info.formats) && device.info.formats.includes('msgpack'));
+  return axios.post(`${device.ip}/api/database/sync`,
+    msgPack ? Buffer.from(encode(payload)) : payload,
+    { timeout: 5000, headers: msgPack ? { 'Content-Type': MSGPACK_TYPE } : {} });
+}
+
+// Pushes the central database to a device, as a delta when the revision it
+// holds is known. Returns the number of user records sent.
+async function pushDatabaseToDevice(device) {
+  const usersData = loadUsersDatabase();
+  const settingsData = loadDatabase(SETTINGS_DB_FILE);
+  let since = typeof device.syncRevision === 'number' ? device.syncRevision
+    : (device.info && device.info.syncRevision) || 0;
+  
+  const send = payload => postSyncPayload(device, payload);
+  
+  let payload = buildSyncPayload(usersData, settingsData, since);
+  let response;
+  try {
+    response = await send(payload);
+  } catch (error) {
+    // The device holds another revision than expected (reflashed, restored
+    // or synced elsewhere): resend from the revision it reports
+    if (!error.response || error.response.status !== 409) throw error;
+    since = error.response.data.revision || 0;
+    payload = buildSyncPayload(usersData, settingsData, since);
+    response = await send(payload);
+  }
+  
+  device.syncRevision = response.data.revision || 0;
+  return payload.users.length;
+}
+
+// ==================== Anti-Entropy ====================
+// Same hash tree as the device keeps (main/userdigest.cpp): users hashed
+// into DIGEST_BUCKETS buckets by UID, a bucket being the XOR of its users'
+// record hashes, DIGEST_FANOUT buckets per group and a root over the
+// groups. A check reads the root and group hashes (a few hundred bytes),
+// then only the buckets that differ, and repairs just their users.
+const DIGEST_BUCKETS = 256;
+const DIGEST_FANOUT = 16;
+const DIGEST_NAME_MAX = 31;
+
+function fnvByte(hash, byte) {
+  return Math.imul(hash ^ byte, 16777619) >>> 0;
+}
+
+function fnvWord(hash, word) {
+  for (let i = 0; i < 4; i++) hash = fnvByte(hash, (word >>> (8 * i)) & 0xff);
+  return hash;
+}
+
+function normalizeUid(uid) {
+  return String(uid).toUpperCase().replace(/[-_]/g, ':');
+}
+
+function uidBytes(uid) {
+  return normalizeUid(uid).split(':').map(part => parseInt(part, 16) & 0xff);
+}
+
+// CardUID::hash() modulo the bucket count
+function digestBucketOf(bytes) {
+  let hash = (2166136261 ^ bytes.length) >>> 0;
+  for (const byte of bytes) hash = fnvByte(hash, byte);
+  return hash % DIGEST_BUCKETS;
+}
+
+// UserDigest::recordHash(): the name is cut like a device user record
+function digestRecordHash(bytes, user) {
+  let hash = fnvByte(2166136261, bytes.length);
+  for (const byte of bytes) hash = fnvByte(hash, byte);
+  
+  const name = Buffer.from(String(user.name || ''), 'utf8');
+  let length = name.length;
+  if (length > DIGEST_NAME_MAX) {
+    length = DIGEST_NAME_MAX;
+    while (length > 0 && (name[length] & 0xc0) === 0x80) length--;
+  }
+  for (let i = 0; i < length; i++) hash = fnvByte(hash, name[i]);
+  hash = fnvByte(hash, 0);
+  
+  hash = fnvWord(hash, Math.trunc(Number(user.credit) || 0) >>> 0);
+  return fnvByte(hash, user.in ? 1 : 0);
+}
+
+function digestNodeHash(hashes) {
+  return hashes.reduce((hash, value) => fnvWord(hash, value), 2166136261);
+}
+
+function buildUserDigest(users) {
+  const buckets = new Array(DIGEST_BUCKETS).fill(0);
+  const members = new Map(); // bucket -> [{ uid, hash, user }]
+  users.forEach(user => {
+    const bytes = uidBytes(user.uid);
+    const bucket = digestBucketOf(bytes);
+    const hash = digestRecordHash(bytes, user);
+    buckets[bucket] = (buckets[bucket] ^ hash) >>> 0;
+    if (!members.has(bucket)) members.set(bucket, []);
+    members.get(bucket).push({ uid: normalizeUid(user.uid), hash, user });
+  });
+  
+  const groups = [];
+  for (let g = 0; g < DIGEST_BUCKETS / DIGEST_FANOUT; g++) {
+    groups.push(digestNodeHash(buckets.slice(g * DIGEST_FANOUT, (g + 1) * DIGEST_FANOUT)));
+  }
+  return { buckets, groups, members, root: digestNodeHash(groups) };
+}
+
+// Compares a device with users.json and repairs the buckets that differ
+// with a delta sync of just their users (and tombstones for users the
+// server does not have). Returns what was found and the bytes read.
+async function reconcileDevice(device) {
+  const data = loadUsersDatabase();
+  const digest = buildUserDigest(data ? data.users : []);
+  let bytesRead = 0;
+  const read = async query => {
+    const response = await axios.get(`${device.ip}/api/users/digest${query}`, { timeout: 5000 });
+    bytesRead += JSON.stringify(response.data).length;
+    return response.data;
+  };
+  
+  const top = await read('');
+  const result = { consistent: top.root === digest.root, buckets: [], repaired: 0, removed: 0, bytesRead: 0 };
+  if (!result.consistent) {
+    for (let g = 0; g < digest.groups.length; g++) {
+      if (top.groups[g] === digest.groups[g]) continue;
+      const group = await read(`?group=${g}`);
+      group.buckets.forEach((hash, i) => {
+        if (hash !== digest.buckets[g * DIGEST_FANOUT + i]) result.buckets.push(g * DIGEST_FANOUT + i);
+      });
+    }
+    
+    const repairs = [];
+    for (const bucket of result.buckets) {
+      const remote = await read(`?bucket=${bucket}`);
+      const remoteHashes = new Map(remote.users.map(u => [normalizeUid(u.uid), u.hash]));
+      (digest.members.get(bucket) || []).forEach(member => {
+        if (remoteHashes.get(member.uid) !== member.hash) repairs.push(member.user);
+        remoteHashes.delete(member.uid);
+      });
+      remoteHashes.forEach((hash, uid) => repairs.push({ uid, rev: data.revision, deleted: true }));
+    }
+    result.repaired = repairs.filter(u => !u.deleted).length;
+    result.removed = repairs.length - result.repaired;
+    
+    if (repairs.length > 0) {
+      if (top.revision > 0) {
+        // Applied as a delta on top of the revision the device holds
+        const response = await postSyncPayload(device, { since: top.revision, revision: data.revision, users: repairs });
+        device.syncRevision = response.data.revision || 0;
+      } else {
+        await pushDatabaseToDevice(device);
+      }
+    }
+  }
+  result.bytesRead = bytesRead;
+  return result;
+}
+
+// ================== Wire Format ==================
+// Devices may send MessagePack bodies and ask for MessagePack replies
+// (Accept: application/msgpack); browsers keep getting JSON.
+const MSGPACK_TYPE = 'application/msgpack';
+
+function msgPackBodies(req, res, next) {
+  if (req.is(MSGPACK_TYPE)) {
+    try {
+      req.body = decode(req.body);
+    } catch (error) {
+      return res.status(400).json({ error: 'Invalid MessagePack body' });
+    }
+  }
+  if (req.accepts(['application/json', MSGPACK_TYPE]) === MSGPACK_TYPE) {
+    res.json = body => res.type(MSGPACK_TYPE).send(Buffer.from(encode(body, { ignoreUndefined: true })));
+  }
+  next();
+}
+
 // Middleware
 app.use(cors());
 app.use(bodyParser.json());
+app.use(express.raw({ type: MSGPACK_TYPE, limit: '1mb' }));
+app.use(msgPackBodies);
 app.use(express.static('public'));
 
 // Multiple ESP32 devices storage
@@ -141,15 +384,9 @@ async function autoSyncToAllDevices(action, message) {
   
   console.log(`Auto-syncing to ${connectedDevices.length} connected devices - ${action}: ${message}`);
   
-  const usersData = loadDatabase(USERS_DB_FILE);
-  const settingsData = loadDatabase(SETTINGS_DB_FILE);
-  
   for (const device of connectedDevices) {
     try {
-      await axios.post(`${device.ip}/api/database/sync`, {
-        users: usersData.users,
-        settings: settingsData
-      }, { timeout: 5000 });
+      await pushDatabaseToDevice(device);
       
       addConnectionLog(device.id, 'AUTO_SYNC', 'SUCCESS', `${action}: ${message}`);
       console.log(`Auto-synced to device ${device.name} (${device.ip})`);
@@ -203,6 +440,7 @@ app.post('/api/devices/add', async (req, res) => {
     device.status = 'connected';
     device.lastConnected = new Date().toISOString();
     device.info = response.data;
+    device.syncRevision = response.data.syncRevision || 0;
     
     // Sync time with device
     await syncDeviceTime(baseUrl);
@@ -226,12 +464,7 @@ app.post('/api/devices/add', async (req, res) => {
   // Auto-sync central database to new device if connected
   if (device.connected) {
     try {
-      const usersData = loadDatabase(USERS_DB_FILE);
-      const settingsData = loadDatabase(SETTINGS_DB_FILE);
-      await axios.post(`${device.ip}/api/database/sync`, {
-        users: usersData.users,
-        settings: settingsData
-      }, { timeout: 5000 });
+      await pushDatabaseToDevice(device);
       addConnectionLog(deviceId, 'DATABASE_SYNC', 'SUCCESS', `Database synced to new device "${name}"`);
     } catch (error) {
       console.log(`Auto-sync failed for new device: ${error.message}`);
@@ -309,6 +542,7 @@ app.post('/api/devices/:deviceId/retry', async (req, res) => {
     device.status = 'connected';
     device.lastConnected = new Date().toISOString();
     device.info = response.data;
+    device.syncRevision = response.data.syncRevision || 0;
     device.error = null;
     devices.set(deviceId, device);
     
@@ -317,12 +551,7 @@ app.post('/api/devices/:deviceId/retry', async (req, res) => {
     
     // Auto-sync central database to reconnected device
     try {
-      const usersData = loadDatabase(USERS_DB_FILE);
-      const settingsData = loadDatabase(SETTINGS_DB_FILE);
-      await axios.post(`${device.ip}/api/database/sync`, {
-        users: usersData.users,
-        settings: settingsData
-      }, { timeout: 5000 });
+      await pushDatabaseToDevice(device);
       addConnectionLog(deviceId, 'DATABASE_SYNC', 'SUCCESS', `Database auto-synced on reconnection to "${device.name}"`);
     } catch (syncError) {
       console.log(`Auto-sync failed for reconnected device: ${syncError.message}`);
@@ -350,6 +579,29 @@ app.post('/api/devices/:deviceId/retry', async (req, res) => {
   }
 });
 
+// Anti-entropy check of one device against users.json, repairing drift
+app.post('/api/devices/:deviceId/reconcile', async (req, res) => {
+  const device = devices.get(req.params.deviceId);
+  if (!device) {
+    return res.status(404).json({ error: 'Device not found' });
+  }
+  if (!device.connected) {
+    return res.status(400).json({ error: 'Device is not connected' });
+  }
+  
+  try {
+    const result = await reconcileDevice(device);
+    saveDevices();
+    addConnectionLog(device.id, 'RECONCILE', 'SUCCESS', result.consistent
+      ? `"${device.name}" matches the database (${result.bytesRead} bytes read)`
+      : `"${device.name}": ${result.buckets.length} buckets differed, ${result.repaired} users repaired, ${result.removed} removed`);
+    res.json({ success: true, ...result });
+  } catch (error) {
+    addConnectionLog(device.id, 'RECONCILE', 'FAILED', `Check of "${device.name}" failed: ${error.message}`);
+    res.status(500).json({ success: false, error: error.message });
+  }
+});
+
 // Sync time with a specific device
 app.post('/api/devices/:deviceId/sync-time', async (req, res) => {
   const { deviceId } = req.params;
@@ -393,6 +645,7 @@ app.get('/api/connection/status', async (req, res) => {
     device.status = 'connected';
     device.lastConnected = new Date().toISOString();
     device.info = response.data;
+    device.syncRevision = response.data.syncRevision || 0;
     device.error = null;
     devices.set(activeDeviceId, device);
     
@@ -478,12 +731,20 @@ app.get('/api/esp32/info', async (req, res) => {
   }
 });
 
+// Device user lists are streamed (chunked) and can be large, so they are
+// passed through as they arrive instead of being parsed here
+async function pipeDeviceResponse(url, res) {
+  const response = await axios.get(url, { responseType: 'stream' });
+  res.type(response.headers['content-type'] || 'application/json');
+  response.data.on('error', () => res.destroy());
+  response.data.pipe(res);
+}
+
 // Get ESP32 state
 app.get('/api/esp32/state', async (req, res) => {
   try {
     const url = getActiveDeviceUrl();
-    const response = await axios.get(`${url}/api/state`);
-    res.json(response.data);
+    await pipeDeviceResponse(`${url}/api/state`, res);
   } catch (error) {
     res.status(500).json({ error: error.message });
   }
@@ -634,12 +895,22 @@ app.delete('/api/input/pending-uids/:id', (req, res) => {
   }
 });
 
+// Page of device users: limit, after=<uid>, inside=1, creditBelow, prefix
+app.get('/api/esp32/users', async (req, res) => {
+  try {
+    const url = getActiveDeviceUrl();
+    const response = await axios.get(`${url}/api/users`, { params: req.query });
+    res.json(response.data);
+  } catch (error) {
+    res.status(500).json({ error: error.message });
+  }
+});
+
 // Export users
 app.get('/api/esp32/users/export', async (req, res) => {
   try {
     const url = getActiveDeviceUrl();
-    const response = await axios.get(`${url}/api/users/export`);
-    res.json(response.data);
+    await pipeDeviceResponse(`${url}/api/users/export`, res);
   } catch (error) {
     res.status(500).json({ error: error.message });
   }
@@ -744,25 +1015,42 @@ app.post('/api/esp32/state/set', async (req, res) => {
   }
 });
 
-// Self test
+// Self test: POST starts a job on the device and returns its id, GET ?id=
+// polls its results
+app.post('/api/esp32/selftest', async (req, res) => {
+  try {
+    const url = getActiveDeviceUrl();
+    const response = await axios.post(`${url}/api/selftest`);
+    res.status(response.status).json(response.data);
+  } catch (error) {
+    res.status(500).json({ error: error.message });
+  }
+});
+
 app.get('/api/esp32/selftest', async (req, res) => {
   try {
     const url = getActiveDeviceUrl();
-    const response = await axios.get(`${url}/api/selftest`);
+    const response = await axios.get(`${url}/api/selftest`, { params: req.query });
     res.json(response.data);
   } catch (error) {
-    res.status(500).json({ error: error.message });
+    const status = error.response ? error.response.status : 500;
+    res.status(status).json({ error: error.message });
   }
 });
 
 // ==================== Central Database API ====================
 
 // Get all users from central database
+// ?since=<revision> returns only the users changed since then, plus
+// tombstones ({ uid, rev, deleted: true }) for deleted ones
 app.get('/api/database/users', (req, res) => {
   try {
-    const data = loadDatabase(USERS_DB_FILE);
-    if (data) {
-      res.json({ success: true, users: data.users || [] });
+    const data = loadUsersDatabase();
+    if (data && req.query.since !== undefined) {
+      const since = parseInt(req.query.since, 10) || 0;
+      res.json({ success: true, ...buildSyncPayload(data, null, since) });
+    } else if (data) {
+      res.json({ success: true, revision: data.revision, users: data.users });
     } else {
       res.json({ success: true, users: [] });
     }
@@ -780,7 +1068,7 @@ app.post('/api/database/users/add', (req, res) => {
     return res.status(400).json({ error: 'UID and name are required' });
   }
   
-  const data = loadDatabase(USERS_DB_FILE);
+  const data = loadUsersDatabase();
   
   // Check if user already exists
   const exists = data.users.find(u => u.uid === uid);
@@ -798,6 +1086,7 @@ app.post('/api/database/users/add', (req, res) => {
   };
   
   data.users.push(newUser);
+  touchUser(data, newUser);
   
   if (saveDatabase(USERS_DB_FILE, data)) {
     // Auto-sync to all connected devices
@@ -810,21 +1099,16 @@ app.post('/api/database/users/add', (req, res) => {
 });
 
 // Update user in central database
-app.post('/api/database/users/update', (req, res) => {
-  const { uid, name, credit, in: userIn, timestamp } = req.body;
-  
-  if (!uid) {
-    return res.status(400).json({ error: 'UID is required' });
-  }
-  
-  const data = loadDatabase(USERS_DB_FILE);
-  const userIndex = data.users.findIndex(u => u.uid === uid);
-  
-  if (userIndex === -1) {
-    return res.status(404).json({ error: 'User not found' });
+// Applies one update sent by a device: { uid, name, credit, in, timestamp }.
+// Entries and exits go to `history` (see appendHistory). Returns the user,
+// or null if the UID is unknown.
+function applyUserUpdate(data, update, history) {
+  const { uid, name, credit, in: userIn, timestamp } = update;
+  const user = data.users.find(u => u.uid === uid);
+  if (!user) {
+    return null;
   }
   
-  const user = data.users[userIndex];
   const wasInside = user.in;
   
   if (name !== undefined) user.name = name;
@@ -839,18 +1123,64 @@ app.post('/api/database/users/update', (req, res) => {
       user.lastInTime = now;
       
       // Log to history database - use user.credit (current credit after any changes)
-      logHistory(uid, user.name, 'IN', now, user.credit);
+      appendHistory(history, uid, user.name, 'IN', now, user.credit);
     } else if (userIn === false && wasInside === true) {
       // User just exited
       user.lastOutTime = now;
       
       // Log to history database - use user.credit (current credit after any changes)
-      logHistory(uid, user.name, 'OUT', now, user.credit);
+      appendHistory(history, uid, user.name, 'OUT', now, user.credit);
     }
   }
   user.updatedAt = timestamp || new Date().toISOString();
+  touchUser(data, user);
+  return user;
+}
+
+// Devices number their updates per device ("device", "epoch", "seq") and
+// may send one again after a lost reply or a reboot during outbox replay.
+// The highest number applied is kept per device and epoch in the users
+// database, saved in the same write as the update, so a repeat is
+// recognised and skipped. A device that lost its count starts again from 1
+// in a new epoch, so those numbers are not mistaken for repeats. Updates
+// without a number are always applied.
+function isRepeatedUpdate(data, device, epoch, seq) {
+  if (!device || !Number.isInteger(seq) || seq <= 0) {
+    return false;
+  }
+  const key = Number.isInteger(epoch) && epoch > 0 ? `${device}/${epoch}` : device;
+  if (seq <= (data.deviceSeqs[key] || 0)) {
+    return true;
+  }
+  data.deviceSeqs[key] = seq;
+  return false;
+}
+
+app.post('/api/database/users/update', (req, res) => {
+  const { uid, device, epoch, seq } = req.body;
+  
+  if (!uid) {
+    return res.status(400).json({ error: 'UID is required' });
+  }
+  
+  const data = loadUsersDatabase();
+  if (isRepeatedUpdate(data, device, epoch, seq)) {
+    return res.json({ success: true, duplicate: true });
+  }
+  
+  const history = loadHistoryDatabase();
+  const historyLength = history.entries.length;
+  const user = applyUserUpdate(data, req.body, history);
+  
+  if (!user) {
+    return res.status(404).json({ error: 'User not found' });
+  }
   
   if (saveDatabase(USERS_DB_FILE, data)) {
+    if (history.entries.length !== historyLength) {
+      saveHistoryDatabase(history);
+    }
+    
     // Auto-sync to all connected devices
     autoSyncToAllDevices('USER_UPDATED', `User "${user.name}" updated`);
     
@@ -860,48 +1190,108 @@ app.post('/api/database/users/update', (req, res) => {
   }
 });
 
-// Function to log history
-function logHistory(uid, name, action, timestamp, credit) {
-  try {
-    const historyData = loadDatabase(HISTORY_DB_FILE);
-    if (!historyData.entries) {
-      historyData.entries = [];
+// Several updates from one device in one request, applied in order:
+//   { device, epoch, updates: [{ seq, uid, name, credit, in, timestamp }, ...] }
+// Devices coalesce scan bursts into these, so a peak costs one request,
+// one write of each database and one auto-sync instead of one per scan.
+// Unknown or malformed entries are skipped and listed in "rejected";
+// updates already applied (see isRepeatedUpdate) are counted in
+// "duplicates".
+const USER_BATCH_MAX = 100;
+
+app.post('/api/database/users/batch', (req, res) => {
+  const { device, epoch, updates } = req.body;
+  
+  if (!Array.isArray(updates) || updates.length === 0) {
+    return res.status(400).json({ error: 'updates must be a non-empty array' });
+  }
+  if (updates.length > USER_BATCH_MAX) {
+    return res.status(413).json({ error: `At most ${USER_BATCH_MAX} updates per batch` });
+  }
+  
+  const data = loadUsersDatabase();
+  const history = loadHistoryDatabase();
+  const historyLength = history.entries.length;
+  const rejected = [];
+  let applied = 0;
+  let duplicates = 0;
+  
+  for (const update of updates) {
+    if (update && isRepeatedUpdate(data, device, epoch, update.seq)) {
+      duplicates++;
+    } else if (update && typeof update.uid === 'string' && applyUserUpdate(data, update, history)) {
+      applied++;
+    } else {
+      rejected.push(update && update.uid !== undefined ? update.uid : null);
     }
+  }
+  
+  if (applied === 0 && rejected.length === 0) {
+    return res.json({ success: true, applied, duplicates, rejected });
+  }
+  
+  if (saveDatabase(USERS_DB_FILE, data)) {
+    if (history.entries.length !== historyLength) {
+      saveHistoryDatabase(history);
+    }
+    console.log(`✓ Batch of ${updates.length} user updates applied (${rejected.length} rejected, ${duplicates} repeated)`);
     
-    const historyEntry = {
-      id: Date.now() + Math.random().toString(36).substr(2, 9),
-      uid: uid,
-      name: name,
-      action: action, // 'IN' or 'OUT'
-      timestamp: timestamp,
-      credit: credit
-    };
-    
-    historyData.entries.push(historyEntry);
-    
-    // Keep only last 1000 entries to prevent file from growing too large
-    if (historyData.entries.length > 1000) {
-      historyData.entries = historyData.entries.slice(-1000);
+    if (applied > 0) {
+      autoSyncToAllDevices('USERS_UPDATED', `${applied} user updates`);
     }
     
-    saveDatabase(HISTORY_DB_FILE, historyData);
-    console.log(`✓ History logged: ${name} - ${action} at ${timestamp}`);
-  } catch (error) {
-    console.error('Error logging history:', error);
+    res.json({ success: true, applied, duplicates, rejected });
+  } else {
+    res.status(500).json({ error: 'Failed to save database' });
   }
+});
+
+// History of entries and exits, loaded and saved once per request. Keep
+// only the last HISTORY_LIMIT entries to prevent the file from growing too
+// large.
+const HISTORY_LIMIT = 1000;
+
+function loadHistoryDatabase() {
+  const historyData = loadDatabase(HISTORY_DB_FILE) || {};
+  if (!historyData.entries) {
+    historyData.entries = [];
+  }
+  return historyData;
+}
+
+function saveHistoryDatabase(historyData) {
+  if (historyData.entries.length > HISTORY_LIMIT) {
+    historyData.entries = historyData.entries.slice(-HISTORY_LIMIT);
+  }
+  return saveDatabase(HISTORY_DB_FILE, historyData);
+}
+
+function appendHistory(historyData, uid, name, action, timestamp, credit) {
+  const historyEntry = {
+    id: Date.now() + Math.random().toString(36).substr(2, 9),
+    uid: uid,
+    name: name,
+    action: action, // 'IN' or 'OUT'
+    timestamp: timestamp,
+    credit: credit
+  };
+  
+  historyData.entries.push(historyEntry);
+  console.log(`✓ History logged: ${name} - ${action} at ${timestamp}`);
 }
 
 // Delete user from central database
 app.delete('/api/database/users/:uid', (req, res) => {
   const { uid } = req.params;
   
-  const data = loadDatabase(USERS_DB_FILE);
+  const data = loadUsersDatabase();
   const initialLength = data.users.length;
   data.users = data.users.filter(u => u.uid !== uid);
   
   if (data.users.length === initialLength) {
     return res.status(404).json({ error: 'User not found' });
   }
+  addTombstone(data, uid);
   
   if (saveDatabase(USERS_DB_FILE, data)) {
     // Auto-sync to all connected devices
@@ -922,7 +1312,7 @@ app.post('/api/database/users/:uid/credit', (req, res) => {
     return res.status(400).json({ error: 'Valid amount is required' });
   }
   
-  const data = loadDatabase(USERS_DB_FILE);
+  const data = loadUsersDatabase();
   const user = data.users.find(u => u.uid === uid);
   
   if (!user) {
@@ -931,6 +1321,7 @@ app.post('/api/database/users/:uid/credit', (req, res) => {
   
   user.credit = (user.credit || 0) + parseInt(amount);
   user.updatedAt = new Date().toISOString();
+  touchUser(data, user);
   
   if (saveDatabase(USERS_DB_FILE, data)) {
     // Auto-sync to all connected devices
@@ -980,17 +1371,11 @@ app.post('/api/database/sync/:deviceId', async (req, res) => {
   }
   
   try {
-    const usersData = loadDatabase(USERS_DB_FILE);
-    const settingsData = loadDatabase(SETTINGS_DB_FILE);
-    
-    // Send database to ESP32
-    const response = await axios.post(`${device.ip}/api/database/sync`, {
-      users: usersData.users,
-      settings: settingsData
-    }, { timeout: 5000 });
+    // Send database changes to ESP32
+    const syncedUsers = await pushDatabaseToDevice(device);
     
     addConnectionLog(deviceId, 'DATABASE_SYNC', 'SUCCESS', `Database synced to "${device.name}"`);
-    res.json({ success: true, message: 'Database synced to device', syncedUsers: usersData.users.length });
+    res.json({ success: true, message: 'Database synced to device', syncedUsers });
   } catch (error) {
     addConnectionLog(deviceId, 'DATABASE_SYNC', 'FAILED', `Failed to sync database to "${device.name}": ${error.message}`);
     res.status(500).json({ error: error.message });
@@ -999,9 +1384,6 @@ app.post('/api/database/sync/:deviceId', async (req, res) => {
 
 // Sync database to all connected devices
 app.post('/api/database/sync-all', async (req, res) => {
-  const usersData = loadDatabase(USERS_DB_FILE);
-  const settingsData = loadDatabase(SETTINGS_DB_FILE);
-  
   const results = [];
   
   for (const [deviceId, device] of devices) {
@@ -1011,10 +1393,7 @@ app.post('/api/database/sync-all', async (req, res) => {
     }
     
     try {
-      await axios.post(`${device.ip}/api/database/sync`, {
-        users: usersData.users,
-        settings: settingsData
-      }, { timeout: 5000 });
+      await pushDatabaseToDevice(device);
       
       results.push({ deviceId, name: device.name, success: true });
       addConnectionLog(deviceId, 'DATABASE_SYNC', 'SUCCESS', `Database synced to "${device.name}"`);
@@ -1056,10 +1435,14 @@ app.get('/', (req, res) => {
   res.sendFile(path.join(__dirname, 'public', 'index.html'));
 });
 
-// Start server
-app.listen(PORT, () => {
+// Start server. Gates keep one connection open for all their RPCs and
+// heartbeats (every 30 s); Node's default 5 s keep-alive would close it
+// between them. Gates drop it themselves after 55 s idle.
+const httpServer = app.listen(PORT, () => {
   console.log(` Admin Panel Server running on http://localhost:${PORT}`);
   console.log(` Multi-Device Support Enabled`);
   console.log(`\n  Add ESP32 devices through the Devices page in the dashboard.`);
   console.log(`   Supports multiple devices with automatic device switching.`);
 });
+httpServer.keepAliveTimeout = KEEP_ALIVE_TIMEOUT_MS;
+httpServer.headersTimeout = KEEP_ALIVE_TIMEOUT_MS + 1000;
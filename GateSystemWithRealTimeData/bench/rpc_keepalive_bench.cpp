@@ -0,0 +1,207 @@
+// ================== RPC Round-Trip Benchmark (host) ==================
+// Round trip of one gate RPC (POST /api/events/notify with a heartbeat
+// body, answered with a small JSON object) against a stand-in for the
+// admin server on 127.0.0.1, for
+//   close:      a new TCP connection per request, as sendRPCRequest() did
+//               with httpClient.begin(url) ... httpClient.end()
+//   keep-alive: one connection reused for every request, as the pooled
+//               rpcClient in main/network.cpp does now
+// The stand-in can emulate the WiFi link: with an RTT it waits one RTT
+// before answering each request, and one more before serving a new
+// connection, for the SYN / SYN-ACK exchange that loopback completes at
+// once. RTT 0 is plain loopback, where only the socket and handshake work
+// itself differs.
+//
+// Build and run on a PC:
+//   g++ -O2 -std=c++17 -pthread rpc_keepalive_bench.cpp -o rpc_keepalive_bench
+//   ./rpc_keepalive_bench [rtt ms ...]
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const int REQUESTS = 200;
+static const char BODY[] =
+    "{\"event\":\"HEARTBEAT\",\"details\":\"Device alive\",\"deviceIP\":\"192.168.137.50\"}";
+
+// ================== Stand-in Server ==================
+static int rttMs = 0;
+
+static void sleepMs(int ms) {
+    if (ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Reads one request (headers and Content-Length body); false once the
+// client has closed the connection
+static bool readRequest(int fd, std::string& buffer, bool& keepAlive) {
+    size_t headerEnd;
+    char chunk[1024];
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+    std::string headers = buffer.substr(0, headerEnd);
+    size_t length = 0;
+    size_t pos = headers.find("Content-Length: ");
+    if (pos != std::string::npos) length = strtoul(headers.c_str() + pos + 16, nullptr, 10);
+    keepAlive = headers.find("Connection: close") == std::string::npos;
+
+    size_t total = headerEnd + 4 + length;
+    while (buffer.size() < total) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+    buffer.erase(0, total);
+    return true;
+}
+
+static void serveConnection(int fd) {
+    sleepMs(rttMs);  // Handshake
+    std::string buffer;
+    bool keepAlive = true;
+    while (keepAlive && readRequest(fd, buffer, keepAlive)) {
+        static const char answer[] = "{\"success\":true,\"message\":\"Event received\"}";
+        char response[256];
+        int length = snprintf(response, sizeof(response),
+                              "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                              "Content-Length: %zu\r\nConnection: %s\r\n\r\n%s",
+                              sizeof(answer) - 1, keepAlive ? "keep-alive" : "close", answer);
+        sleepMs(rttMs);  // Request out, response back
+        send(fd, response, length, 0);
+    }
+    close(fd);
+}
+
+static int startServer(int& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror("stand-in server");
+        exit(1);
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+
+    std::thread([fd]() {
+        for (;;) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0) break;
+            std::thread(serveConnection, client).detach();
+        }
+    }).detach();
+    return fd;
+}
+
+// ================== Gate Client ==================
+static int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // As WiFiClient
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+// Sends one RPC and reads the whole answer, like HTTPClient::sendRequest()
+// followed by getString()
+static void roundTrip(int fd, bool keepAlive) {
+    char request[512];
+    int length = snprintf(request, sizeof(request),
+                          "POST /api/events/notify HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                          "Content-Type: application/json\r\nContent-Length: %zu\r\n"
+                          "Connection: %s\r\n\r\n%s",
+                          sizeof(BODY) - 1, keepAlive ? "keep-alive" : "close", BODY);
+    send(fd, request, length, 0);
+
+    std::string buffer;
+    char chunk[1024];
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return;
+        buffer.append(chunk, n);
+    }
+    size_t pos = buffer.find("Content-Length: ");
+    size_t total = headerEnd + 4 + strtoul(buffer.c_str() + pos + 16, nullptr, 10);
+    while (buffer.size() < total) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return;
+        buffer.append(chunk, n);
+    }
+}
+
+static std::vector<double> runClose(int port) {
+    std::vector<double> ms;
+    for (int i = 0; i < REQUESTS; i++) {
+        Clock::time_point start = Clock::now();
+        int fd = connectTo(port);
+        roundTrip(fd, false);
+        close(fd);
+        ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    return ms;
+}
+
+static std::vector<double> runKeepAlive(int port) {
+    std::vector<double> ms;
+    int fd = -1;
+    for (int i = 0; i < REQUESTS; i++) {
+        Clock::time_point start = Clock::now();
+        if (fd < 0) fd = connectTo(port);  // First request only
+        roundTrip(fd, true);
+        ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    close(fd);
+    return ms;
+}
+
+static void report(const char* mode, std::vector<double> ms) {
+    double sum = 0;
+    for (double value : ms) sum += value;
+    std::sort(ms.begin(), ms.end());
+    printf("%-10s %8d %10.3f %10.3f %10.3f %10.3f\n", mode, rttMs, ms.front(), sum / ms.size(),
+           ms[ms.size() * 95 / 100], ms.back());
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> rtts;
+    for (int i = 1; i < argc; i++) rtts.push_back(atoi(argv[i]));
+    if (rtts.empty()) rtts = {0, 2, 10};
+
+    int port;
+    startServer(port);
+    printf("%d requests per run; round trip in ms\n", REQUESTS);
+    printf("%-10s %8s %10s %10s %10s %10s\n", "mode", "rtt ms", "min", "avg", "p95", "max");
+    for (int rtt : rtts) {
+        rttMs = rtt;
+        report("close", runClose(port));
+        report("keep-alive", runKeepAlive(port));
+    }
+    return 0;
+}
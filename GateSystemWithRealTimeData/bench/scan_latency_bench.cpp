@@ -0,0 +1,144 @@
+// ================== Card-to-Gate Latency Simulation (host) ==================
+// A model, not a measurement of the firmware: threads, sleeps and a busy
+// wait stand in for the tasks, the server and the RC522/OLED work. The
+// real card-to-gate time is measured on the device and reported as
+// "scanLatencyUs" by GET /api/info.
+//
+// Time from a card arriving at the reader to the gate opening, while the
+// admin server answers slowly or not at all, for
+//   loop:  the former single Arduino loop(), where processCardScan() sends
+//          POST /api/database/users/update before opening the gate and the
+//          loop sleeps 100 ms per pass
+//   tasks: the gate task (20 ms poll) handing the update to the network
+//          task through main/spscqueue.h
+// Threads stand in for the two FreeRTOS tasks; a sleep stands in for the
+// HTTP round trip, 2 s for an unreachable server (scaled down from the
+// 5 s HTTPClient timeout to keep the run short).
+//
+// Build and run on a PC:
+//   g++ -O2 -std=c++17 -pthread -I../main scan_latency_bench.cpp -o scan_latency_bench
+//   ./scan_latency_bench
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "spscqueue.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int CARDS = 12;
+static const int CARD_INTERVAL_MS = 200;   // A queue of people at the gate
+static const int DECIDE_US = 2000;         // Lookup, journal append, OLED
+
+struct Update {
+    int card;
+};
+
+struct Run {
+    Clock::time_point start;
+    Clock::time_point opened[CARDS];
+    int nextCard;
+
+    void begin() {
+        start = Clock::now();
+        nextCard = 0;
+    }
+
+    Clock::time_point arrival(int card) const {
+        return start + std::chrono::milliseconds(card * CARD_INTERVAL_MS);
+    }
+
+    // Next card already held at the reader, or -1
+    int poll() {
+        if (nextCard < CARDS && Clock::now() >= arrival(nextCard)) return nextCard++;
+        return -1;
+    }
+
+    void decide() const {
+        Clock::time_point until = Clock::now() + std::chrono::microseconds(DECIDE_US);
+        while (Clock::now() < until) {}
+    }
+};
+
+static void serverCall(int delayMs) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+}
+
+// ================== Single Loop ==================
+static void runLoop(Run& run, int serverMs) {
+    run.begin();
+    int done = 0;
+    while (done < CARDS) {
+        int card = run.poll();
+        if (card >= 0) {
+            run.decide();
+            serverCall(serverMs);              // updateUserState()
+            run.opened[card] = Clock::now();   // gateOpen()
+            done++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+// ================== Split Tasks ==================
+static void runTasks(Run& run, int serverMs) {
+    static SpscQueue<Update, 32> jobs;
+    std::atomic<bool> stop(false);
+    std::atomic<int> sent(0);
+
+    std::thread network([&]() {
+        Update update;
+        while (!stop.load() || jobs.size() > 0) {
+            if (jobs.pop(update)) {
+                serverCall(serverMs);
+                sent++;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    });
+
+    run.begin();
+    int done = 0;
+    while (done < CARDS) {
+        int card = run.poll();
+        if (card >= 0) {
+            run.decide();
+            jobs.push(Update{card});
+            run.opened[card] = Clock::now();
+            done++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    stop = true;
+    network.join();
+    if (sent.load() + (int)jobs.dropCount() != CARDS) printf("(lost updates)\n");
+}
+
+static void report(const char* mode, int serverMs, const Run& run) {
+    std::vector<double> ms;
+    for (int i = 0; i < CARDS; i++) {
+        ms.push_back(std::chrono::duration<double, std::milli>(run.opened[i] - run.arrival(i)).count());
+    }
+    double sum = 0;
+    for (double value : ms) sum += value;
+    std::sort(ms.begin(), ms.end());
+    printf("%-6s %10d %10.1f %10.1f %10.1f\n", mode, serverMs, ms.front(), sum / CARDS, ms.back());
+}
+
+int main() {
+    const int serverDelays[] = {0, 50, 500, 2000};
+    printf("%d cards, one every %d ms; card-to-gate latency in ms\n", CARDS, CARD_INTERVAL_MS);
+    printf("%-6s %10s %10s %10s %10s\n", "mode", "server ms", "min", "avg", "max");
+    for (int serverMs : serverDelays) {
+        Run run;
+        runLoop(run, serverMs);
+        report("loop", serverMs, run);
+        runTasks(run, serverMs);
+        report("tasks", serverMs, run);
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// ================== UID Lookup Benchmark (host) ==================
+// Compares the hash index in main/uidindex.cpp with the old linear
+// findUserByUID scan (normalize the UID string, then String == per user).
+//
+// Build and run on a PC:
+//   g++ -O2 -std=c++17 -I../main uid_index_bench.cpp ../main/uidindex.cpp ../main/carduid.cpp -o uid_index_bench
+//   ./uid_index_bench
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "uidindex.h"
+
+struct BenchUser {
+    std::string hex;   // "XX:XX:XX:XX" like the old String User::uid
+    CardUID uid;
+};
+
+static std::vector<BenchUser> users;
+
+static std::string toHex(const CardUID& uid) {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    std::string result;
+    for (uint8_t i = 0; i < uid.size; i++) {
+        result += HEX_DIGITS[uid.bytes[i] >> 4];
+        result += HEX_DIGITS[uid.bytes[i] & 0x0F];
+        if (i + 1 != uid.size) result += ':';
+    }
+    return result;
+}
+
+// Same work as the firmware's normalizeUID on an already well-formed UID:
+// a copy, an upper-case pass and separator replacement
+static std::string normalize(const std::string& uid) {
+    std::string normalized = uid;
+    for (char& c : normalized) {
+        if (c >= 'a' && c <= 'f') c -= 32;
+        if (c == '-' || c == '_') c = ':';
+    }
+    return normalized;
+}
+
+static int linearFind(const std::string& uid) {
+    std::string normalized = normalize(uid);
+    for (size_t i = 0; i < users.size(); i++) {
+        if (users[i].hex == normalized) return (int)i;
+    }
+    return -1;
+}
+
+// Same check as userUIDMatches in users.cpp
+static bool benchMatch(int32_t userIndex, const CardUID& uid, const void*) {
+    return users[userIndex].uid == uid;
+}
+
+// Distinct pseudo-random 4-byte UID for every serial (odd multiplier is a bijection)
+static void makeUser(BenchUser& user, uint32_t serial) {
+    uint32_t value = serial * 2654435761u;
+    user.uid = CardUID((const uint8_t*)&value, 4);
+    user.hex = toHex(user.uid);
+}
+
+static double nsPerOp(std::chrono::steady_clock::duration elapsed, size_t ops) {
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+int main() {
+    const size_t sizes[] = {100, 1000, 10000};
+    const size_t lookups = 20000;
+    std::mt19937 rng(42);
+
+    printf("%8s %16s %16s %10s\n", "users", "linear ns/op", "index ns/op", "speedup");
+    for (size_t n : sizes) {
+        users.clear();
+        UidIndex index;
+        for (size_t i = 0; i < n; i++) {
+            BenchUser user;
+            makeUser(user, (uint32_t)i);
+            users.push_back(user);
+            index.insert(user.uid, (int32_t)i);
+        }
+
+        // Mix of hits and unknown cards, as seen at a public gate
+        std::vector<size_t> probes(lookups);
+        for (size_t& p : probes) p = rng() % (n + n / 4);
+        std::vector<BenchUser> unknown(lookups);
+        for (size_t i = 0; i < lookups; i++) {
+            makeUser(unknown[i], (uint32_t)(n + i));
+        }
+
+        long sink = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookups; i++) {
+            const BenchUser& probe = probes[i] < n ? users[probes[i]] : unknown[i];
+            sink += linearFind(probe.hex);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookups; i++) {
+            const BenchUser& probe = probes[i] < n ? users[probes[i]] : unknown[i];
+            sink -= index.find(probe.uid, benchMatch);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        double linearNs = nsPerOp(t1 - t0, lookups);
+        double indexNs = nsPerOp(t2 - t1, lookups);
+        printf("%8zu %16.1f %16.1f %9.1fx%s\n", n, linearNs, indexNs, linearNs / indexNs,
+               sink == 0 ? "" : "  (MISMATCH)");
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+// ================== Sync Wire Format Benchmark (host) ==================
+// Bytes on the wire, encode time and device-side decode time of a roster
+// sync body (POST /api/database/sync) sent as JSON and as MessagePack.
+// Users carry the fields of admin-panel/database/users.json; decoding
+// runs the firmware's streaming UserSyncParser from main/syncparser.cpp.
+//
+// Build and run on a PC:
+//   g++ -O2 -std=c++17 -I../main wire_format_bench.cpp ../main/syncparser.cpp -o wire_format_bench
+//   ./wire_format_bench
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "syncparser.h"
+
+struct BenchUser {
+    std::string uid;
+    std::string name;
+    long credit;
+    bool in;
+    std::string createdAt;
+    std::string updatedAt;
+    uint32_t rev;
+};
+
+static std::vector<BenchUser> users;
+
+static void makeUsers(size_t n) {
+    static const char* NAMES[] = {"Trần Anh Tú", "Nguyễn Văn An", "Lê Thị Hoa", "Tus Anh", "Phạm Minh Đức"};
+    users.clear();
+    for (size_t i = 0; i < n; i++) {
+        uint32_t value = (uint32_t)i * 2654435761u;
+        char uid[16];
+        snprintf(uid, sizeof(uid), "%02X:%02X:%02X:%02X",
+                 value >> 24, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF);
+        BenchUser user;
+        user.uid = uid;
+        user.name = std::string(NAMES[i % 5]) + " " + std::to_string(i);
+        user.credit = 1000 * (long)(i % 200);
+        user.in = i % 3 == 0;
+        user.createdAt = "2025-10-11T01:27:59.214Z";
+        user.updatedAt = "2025-11-08T15:59:30.000Z";
+        user.rev = (uint32_t)i + 1;
+        users.push_back(user);
+    }
+}
+
+// ================== JSON Writer ==================
+// Compact, like JSON.stringify in the admin panel
+static void jsonString(std::string& out, const std::string& s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    out += '"';
+}
+
+static void encodeJson(std::string& out) {
+    out.clear();
+    out += "{\"since\":0,\"revision\":" + std::to_string(users.size());
+    out += ",\"settings\":{\"costPerExit\":3000,\"defaultCredit\":100000,\"adminMode\":false},\"users\":[";
+    for (size_t i = 0; i < users.size(); i++) {
+        const BenchUser& user = users[i];
+        if (i) out += ',';
+        out += "{\"uid\":";
+        jsonString(out, user.uid);
+        out += ",\"name\":";
+        jsonString(out, user.name);
+        out += ",\"credit\":" + std::to_string(user.credit);
+        out += ",\"type\":\"dynamic\",\"in\":";
+        out += user.in ? "true" : "false";
+        out += ",\"createdAt\":";
+        jsonString(out, user.createdAt);
+        out += ",\"updatedAt\":";
+        jsonString(out, user.updatedAt);
+        out += ",\"rev\":" + std::to_string(user.rev) + "}";
+    }
+    out += "]}";
+}
+
+// ================== MessagePack Writer ==================
+// Smallest encoding of every value, like @msgpack/msgpack's encode()
+static void packBigEndian(std::string& out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) out += (char)(value >> (8 * i));
+}
+
+static void packString(std::string& out, const std::string& s) {
+    if (s.size() < 32) {
+        out += (char)(0xA0 | s.size());
+    } else if (s.size() < 256) {
+        out += (char)0xD9;
+        packBigEndian(out, s.size(), 1);
+    } else {
+        out += (char)0xDA;
+        packBigEndian(out, s.size(), 2);
+    }
+    out += s;
+}
+
+static void packInt(std::string& out, long value) {
+    if (value >= 0 && value < 128) {
+        out += (char)value;
+    } else if (value < 0 && value >= -32) {
+        out += (char)(int8_t)value;
+    } else if (value >= 0) {
+        if (value < 256) { out += (char)0xCC; packBigEndian(out, value, 1); }
+        else if (value < 65536) { out += (char)0xCD; packBigEndian(out, value, 2); }
+        else { out += (char)0xCE; packBigEndian(out, value, 4); }
+    } else {
+        out += (char)0xD2;
+        packBigEndian(out, (uint32_t)value, 4);
+    }
+}
+
+static void packContainer(std::string& out, bool isArray, size_t count) {
+    if (count < 16) {
+        out += (char)((isArray ? 0x90 : 0x80) | count);
+    } else {
+        out += (char)(isArray ? 0xDC : 0xDE);
+        packBigEndian(out, count, 2);
+    }
+}
+
+static void encodeMsgPack(std::string& out) {
+    out.clear();
+    packContainer(out, false, 4);
+    packString(out, "since");
+    packInt(out, 0);
+    packString(out, "revision");
+    packInt(out, users.size());
+    packString(out, "settings");
+    packContainer(out, false, 3);
+    packString(out, "costPerExit");
+    packInt(out, 3000);
+    packString(out, "defaultCredit");
+    packInt(out, 100000);
+    packString(out, "adminMode");
+    out += (char)0xC2;
+    packString(out, "users");
+    packContainer(out, true, users.size());
+    for (const BenchUser& user : users) {
+        packContainer(out, false, 8);
+        packString(out, "uid");
+        packString(out, user.uid);
+        packString(out, "name");
+        packString(out, user.name);
+        packString(out, "credit");
+        packInt(out, user.credit);
+        packString(out, "type");
+        packString(out, "dynamic");
+        packString(out, "in");
+        out += (char)(user.in ? 0xC3 : 0xC2);
+        packString(out, "createdAt");
+        packString(out, user.createdAt);
+        packString(out, "updatedAt");
+        packString(out, user.updatedAt);
+        packString(out, "rev");
+        packInt(out, user.rev);
+    }
+}
+
+// ================== Decoding ==================
+static long creditSum;
+
+static bool countUser(const SyncUserRecord& user, void*) {
+    creditSum += user.credit;
+    return true;
+}
+
+// Fed in TCP-segment sized chunks, as the web server hands them over
+static bool decode(UserSyncParser& parser, const std::string& body, SyncFormat format) {
+    const size_t chunk = 1436;
+    parser.reset(format);
+    for (size_t i = 0; i < body.size(); i += chunk) {
+        parser.feed((const uint8_t*)body.data() + i, std::min(chunk, body.size() - i));
+    }
+    return parser.finish();
+}
+
+static double usPerRun(std::chrono::steady_clock::duration elapsed, int runs) {
+    return std::chrono::duration<double, std::micro>(elapsed).count() / runs;
+}
+
+int main() {
+    const size_t userCount = 1000;
+    const int runs = 200;
+    makeUsers(userCount);
+
+    std::string json, msgPack;
+    encodeJson(json);
+    encodeMsgPack(msgPack);
+
+    UserSyncParser parser(countUser);
+    long expected = 0;
+    for (const BenchUser& user : users) expected += user.credit;
+
+    printf("%zu users, %d runs\n", userCount, runs);
+    printf("%-12s %10s %8s %12s %12s\n", "format", "bytes", "ratio", "encode us", "decode us");
+    struct Case {
+        const char* name;
+        std::string* body;
+        void (*encode)(std::string&);
+        SyncFormat format;
+    } cases[] = {
+        {"json", &json, encodeJson, SYNC_FORMAT_JSON},
+        {"msgpack", &msgPack, encodeMsgPack, SYNC_FORMAT_MSGPACK},
+    };
+    for (Case& c : cases) {
+        std::string scratch;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++) c.encode(scratch);
+        auto t1 = std::chrono::steady_clock::now();
+
+        bool ok = true;
+        for (int i = 0; i < runs; i++) {
+            creditSum = 0;
+            ok &= decode(parser, *c.body, c.format) && parser.userCount() == userCount && creditSum == expected;
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        printf("%-12s %10zu %7.0f%% %12.1f %12.1f%s\n", c.name, c.body->size(),
+               100.0 * c.body->size() / json.size(), usPerRun(t1 - t0, runs), usPerRun(t2 - t1, runs),
+               ok ? "" : "  (DECODE FAILED)");
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#include "carduid.h"
+
+// ================== Card UID Type ==================
+CardUID::CardUID(const uint8_t* data, uint8_t len) : size(0) {
+    memset(bytes, 0, sizeof(bytes));
+    if (len > UID_MAX_BYTES) return; // Not a valid MFRC522 UID, leave empty
+    memcpy(bytes, data, len);
+    size = len;
+}
+
+uint32_t CardUID::hash() const {
+    // FNV-1a, mixed with the length so 4/7/10 byte UIDs never collide trivially
+    uint32_t hash = 2166136261u ^ size;
+    for (uint8_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
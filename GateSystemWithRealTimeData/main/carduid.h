@@ -0,0 +1,36 @@
+#ifndef CARDUID_H
+#define CARDUID_H
+
+#include <stdint.h>
+#include <string.h>
+
+// ================== Card UID Configuration ==================
+#define UID_MAX_BYTES 10   // Longest MFRC522 UID (triple size)
+#define UID_MIN_BYTES  4   // Shortest UID accepted as a user card
+
+// ================== Card UID Type ==================
+// Fixed-size binary card UID. Unused bytes are always zero so two UIDs can be
+// compared with a single memcmp over the whole struct. Formatting to the
+// "XX:XX:XX:XX" text form (uidToHex) only happens at the JSON/display edges.
+struct CardUID {
+    uint8_t bytes[UID_MAX_BYTES];
+    uint8_t size;
+    
+    CardUID() : size(0) { memset(bytes, 0, sizeof(bytes)); }
+    CardUID(const uint8_t* data, uint8_t len);
+    
+    bool isEmpty() const { return size == 0; }
+    bool isValid() const { return size >= UID_MIN_BYTES && size <= UID_MAX_BYTES; }
+    uint32_t hash() const;
+    
+    bool operator==(const CardUID& other) const { return memcmp(this, &other, sizeof(CardUID)) == 0; }
+    bool operator!=(const CardUID& other) const { return !(*this == other); }
+    
+    // Byte order, then length: the order of roster images and user pages
+    bool operator<(const CardUID& other) const {
+        int order = memcmp(bytes, other.bytes, UID_MAX_BYTES);
+        return order != 0 ? order < 0 : size < other.size;
+    }
+};
+
+#endif // CARDUID_H
@@ -2,10 +2,10 @@
 #include <WiFi.h>
 #include "hardware.h"
 #include "users.h"
+#include "timeline.h"
 
 // ================== Display State ==================
 bool displayBusy = false;
-unsigned long displayUntilMs = 0;
 unsigned long lastClockUpdate = 0;
 bool showing = false;
 unsigned long showUntilMs = 0;
@@ -29,8 +29,8 @@ bool initializeDisplay() {
     display.setCursor(0, 12);
     display.println("Starting up...");
     display.display();
-    delay(1000);
     
+    // Stays up, with the init progress below it, until setup() moves on
     Serial.println("OLED startup screen shown");
     return true;
 }
@@ -43,13 +43,16 @@ void updateDisplay() {
         }
         lastClockUpdate = millis();
     }
-    
-    // Check if temporary screen should return to idle
-    if (displayBusy && millis() >= displayUntilMs) {
-        displayBusy = false;
-        showIdleScreen();
-        ledIdleBlue(); // Reset LED to idle blue when returning to idle screen
-    }
+}
+
+// Temporary screens go back to idle, and the LED to idle blue, through the
+// timeline; a newer screen replaces the pending return
+static void returnToIdleAfter(uint32_t ms) {
+    displayBusy = true;
+    timelineClear(TIMELINE_SCREEN);
+    timelineClear(TIMELINE_LED);
+    timelineAt(ms, TIMELINE_SCREEN, SCREEN_IDLE);
+    timelineAt(ms, TIMELINE_LED, LED_BLUE);
 }
 
 void showScreen(DisplayScreen screen, const String& message) {
@@ -140,8 +143,7 @@ void showCardDetectedScreen(const String& uid) {
     display.println("Processing...");
     
     display.display();
-    displayBusy = true;
-    displayUntilMs = millis() + DISPLAY_TIMEOUT_MS;
+    returnToIdleAfter(DISPLAY_TIMEOUT_MS);
 }
 
 void showAccessGrantedScreen(const String& name, long credit, bool isEntry) {
@@ -157,8 +159,7 @@ void showAccessGrantedScreen(const String& name, long credit, bool isEntry) {
     display.println("Balance: " + String(credit) + " VND");
     
     display.display();
-    displayBusy = true;
-    displayUntilMs = millis() + DISPLAY_TIMEOUT_MS;
+    returnToIdleAfter(DISPLAY_TIMEOUT_MS);
     
     animateAccessGranted();
 }
@@ -176,8 +177,7 @@ void showAccessDeniedScreen(const String& reason) {
     display.println(truncateText(reason, 21));
     
     display.display();
-    displayBusy = true;
-    displayUntilMs = millis() + DISPLAY_TIMEOUT_MS;
+    returnToIdleAfter(DISPLAY_TIMEOUT_MS);
     
     animateAccessDenied();
 }
@@ -195,8 +195,7 @@ void showInputModeScreen(const String& status) {
     display.println("new user...");
     
     display.display();
-    displayBusy = true;
-    displayUntilMs = millis() + 5000; // Longer timeout for input mode
+    returnToIdleAfter(5000); // Longer timeout for input mode
     
     animateInputMode();
 }
@@ -226,8 +225,7 @@ void showSystemInfoScreen() {
     display.println("FW: v" + String(FW_VERSION));
     
     display.display();
-    displayBusy = true;
-    displayUntilMs = millis() + 5000;
+    returnToIdleAfter(5000);
 }
 
 void showErrorScreen(const String& error) {
@@ -252,8 +250,7 @@ void showErrorScreen(const String& error) {
     }
     
     display.display();
-    displayBusy = true;
-    displayUntilMs = millis() + 5000;
+    returnToIdleAfter(5000);
 }
 
 void showInitProgress(const String& component, bool success) {
@@ -276,8 +273,6 @@ void showInitProgress(const String& component, bool success) {
     
     progressY += 10;
     if (progressY > 54) progressY = 54; // Don't go off screen
-    
-    delay(500); // Show progress for a moment
 }
 
 // ================== Clock and Time Functions ==================
@@ -3,7 +3,6 @@
 
 // ================== Display State Variables ==================
 extern bool displayBusy;
-extern unsigned long displayUntilMs;
 extern unsigned long lastClockUpdate;
 extern bool showing;
 extern unsigned long showUntilMs;
@@ -18,8 +17,7 @@ extern unsigned long showUntilMs;
 #define CLOCK_UPDATE_INTERVAL 1000
 
 // ================== Display State ==================
-extern bool displayBusy;
-extern unsigned long displayUntilMs;
+extern bool displayBusy;            // A temporary screen is up, see timeline.h
 extern unsigned long lastClockUpdate;
 
 // ================== Display Screen Types ==================
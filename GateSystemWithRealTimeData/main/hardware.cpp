@@ -1,5 +1,6 @@
 #include "hardware.h"
 #include "display.h"
+#include "timeline.h"
 
 // ================== Firmware Version ==================
 const char* FW_VERSION = "2.1";
@@ -13,6 +14,20 @@ RTC_DS1307 rtc;  // Using DS1307 for Tiny RTC module
 // ================== Gate State ==================
 unsigned long gateCloseAtMs = 0;
 bool gateIsOpen = false;
+unsigned long gateOpenedUs = 0;
+
+// ================== RFID Interrupt State ==================
+// ComIEnReg: IRqInv (IRQ pin active low) and RxIEn (a frame was received)
+#define RC522_IRQ_RX      0xA0
+#define RC522_IRQ_TIMER   0x01    // TimerIEn, only for the boot check
+
+volatile unsigned long rfidIrqUs = 0;
+static volatile bool rfidIrqPending = false;
+static volatile uint32_t rfidIrqCount = 0;
+static TaskHandle_t rfidWakeTask = NULL;
+static bool rfidIrqActive = false;
+static bool rfidRearm = false;            // Reader was used since the last REQA
+static unsigned long rfidArmedMs = 0;
 
 // ================== Hardware Initialization ==================
 bool initializeHardware() {
@@ -51,10 +66,6 @@ bool initializeHardware() {
     Serial.println(rtcOk ? "RTC OK" : "RTC FAILED");
     showInitProgress("RTC", rtcOk);
     
-    // Show summary
-    // Show completion message on display
-    delay(1000); // Show final status
-    
     Serial.println("=== Hardware Status ===");
     Serial.printf("RFID: %s\n", rfidOk ? "OK" : "FAIL");
     Serial.printf("Servo: %s\n", servoOk ? "OK" : "FAIL");
@@ -67,7 +78,6 @@ bool initializeHardware() {
     display.setCursor(0, 54);
     display.println("Hardware Ready!");
     display.display();
-    delay(1000);
     
     return true;  // Continue even if some components failed
 }
@@ -94,6 +104,95 @@ bool initializeRFID() {
     }
 }
 
+// ================== RFID Interrupt ==================
+static void IRAM_ATTR onRFIDInterrupt() {
+    rfidIrqUs = micros();
+    rfidIrqPending = true;
+    rfidIrqCount++;
+    
+    BaseType_t woken = pdFALSE;
+    if (rfidWakeTask) vTaskNotifyGiveFromISR(rfidWakeTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Sends REQA and leaves the RC522 listening; a card in the field answers
+// within a millisecond and its ATQA raises the IRQ. Four register writes
+// instead of PICC_IsNewCardPresent(), which busy-polls the reader over SPI
+// until its 25 ms timeout whenever no card is there.
+static void sendREQA() {
+    rfid.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    rfid.PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);        // Clear, releases the IRQ line
+    rfid.PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);     // Flush the FIFO
+    rfid.PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+    rfid.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    rfid.PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);    // StartSend, 7-bit short frame
+}
+
+// Run on the task that reads cards, which the IRQ wakes. With the timer
+// interrupt enabled, the REQA nobody answers must raise the IRQ within
+// RFID_IRQ_CHECK_MS; if it does not, the line is not wired and cards are
+// polled as before.
+bool initializeRFIDInterrupt(TaskHandle_t wakeTask) {
+    rfidWakeTask = wakeTask;
+    pinMode(RC522_IRQ, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(RC522_IRQ), onRFIDInterrupt, FALLING);
+    
+    uint32_t before = rfidIrqCount;
+    rfid.PCD_WriteRegister(MFRC522::ComIEnReg, RC522_IRQ_RX | RC522_IRQ_TIMER);
+    sendREQA();
+    delay(RFID_IRQ_CHECK_MS);
+    rfidIrqActive = rfidIrqCount != before;
+    
+    if (rfidIrqActive) {
+        rfid.PCD_WriteRegister(MFRC522::ComIEnReg, RC522_IRQ_RX);
+        Serial.printf("RFID IRQ on GPIO %d - card detection interrupt driven\n", RC522_IRQ);
+    } else {
+        detachInterrupt(digitalPinToInterrupt(RC522_IRQ));
+        rfid.PCD_WriteRegister(MFRC522::ComIEnReg, 0x00);
+        Serial.println("RFID IRQ not responding - polling for cards");
+    }
+    noteRFIDReaderUsed();
+    armRFIDReceive();
+    return rfidIrqActive;
+}
+
+// Once per gate task pass, after any card has been read. Sends a REQA if
+// the reader was used since the last one or RFID_REARM_MS have passed; an
+// unanswered REQA needs no attention until then.
+void armRFIDReceive() {
+    if (!rfidIrqActive) return;
+    if (!rfidRearm && millis() - rfidArmedMs < RFID_REARM_MS) return;
+    rfidRearm = false;
+    rfidArmedMs = millis();
+    rfidIrqPending = false;
+    sendREQA();
+}
+
+// The reader left the listening state (a card was selected, a full poll
+// or the self test ran), so the next armRFIDReceive() sends a REQA at once
+void noteRFIDReaderUsed() {
+    rfidRearm = true;
+}
+
+bool takeRFIDInterrupt() {
+    if (!rfidIrqPending) return false;
+    rfidIrqPending = false;
+    rfidRearm = true;
+    return true;
+}
+
+bool isRFIDInterruptPending() {
+    return rfidIrqPending;
+}
+
+bool isRFIDInterruptActive() {
+    return rfidIrqActive;
+}
+
+uint32_t getRFIDInterruptCount() {
+    return rfidIrqCount;
+}
+
 bool initializeServo() {
     gateServo.attach(SERVO_PIN);
     gateServo.write(GATE_CLOSED_DEG);
@@ -173,6 +272,10 @@ void setLED(bool r, bool g, bool b) {
     digitalWrite(LED_B_PIN, b ? HIGH : LOW);
 }
 
+void setLEDColor(uint8_t color) {
+    setLED(color == LED_RED, color == LED_GREEN, color == LED_BLUE);
+}
+
 void ledIdleBlue() {
     setLED(false, false, true);
 }
@@ -191,7 +294,9 @@ void ledOff() {
 
 // ================== Gate Control Functions ==================
 void gateOpen() {
+    timelineClear(TIMELINE_SERVO);  // A servo test must not close it early
     gateServo.write(GATE_OPEN_DEG);
+    gateOpenedUs = micros();
     gateCloseAtMs = millis() + GATE_OPEN_MS;
     gateIsOpen = true;
     Serial.println("Gate opened");
@@ -220,7 +325,16 @@ void handleGateControl() {
 
 // ================== Hardware Test Functions ==================
 bool testRFID() {
-    return rfid.PCD_PerformSelfTest();
+    bool ok = rfid.PCD_PerformSelfTest();
+    
+    // The self test resets the RC522, interrupt enables included
+    if (rfidIrqActive) {
+        rfid.PCD_Init();
+        rfid.PCD_WriteRegister(MFRC522::ComIEnReg, RC522_IRQ_RX);
+        noteRFIDReaderUsed();
+        armRFIDReceive();
+    }
+    return ok;
 }
 
 bool testOLED() {
@@ -231,25 +345,23 @@ bool testOLED() {
     return true;
 }
 
+// The LED and servo tests queue their moves on the timeline and return
+// at once
 bool testLED() {
     // Test each color
-    setLED(true, false, false);
-    delay(100);
-    setLED(false, true, false);
-    delay(100);
-    setLED(false, false, true);
-    delay(100);
-    ledOff();
+    timelineClear(TIMELINE_LED);
+    setLEDColor(LED_RED);
+    timelineAt(100, TIMELINE_LED, LED_GREEN);
+    timelineAt(200, TIMELINE_LED, LED_BLUE);
+    timelineAt(300, TIMELINE_LED, LED_OFF);
     return true;
 }
 
+// Only while the gate is closed; the self-test waits for a card's
+// opening to end first
 bool testServo() {
-    int currentPos = gateServo.read();
     gateServo.write(GATE_OPEN_DEG);
-    delay(500);
-    gateServo.write(GATE_CLOSED_DEG);
-    delay(500);
-    return true;
+    return timelineAt(500, TIMELINE_SERVO, GATE_CLOSED_DEG);
 }
 
 bool testRTC() {
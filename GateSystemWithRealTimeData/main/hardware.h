@@ -27,6 +27,18 @@ extern const char* FW_VERSION;
 #define RC522_SCK       18
 #define RC522_MOSI      23
 #define RC522_MISO      19
+#define RC522_IRQ        4   // Receive interrupt, active low; unwired falls back to polling
+
+// With the IRQ wired, the gate task sleeps until a card answers a REQA
+// instead of polling the reader. A REQA is answered only by a card already
+// in the field, so it is resent right after a card was read and otherwise
+// every RFID_REARM_MS: an idle reader sees six register writes per REQA
+// (60 a second, against a REQA every 20 ms gate task pass before) and
+// cards are detected within RFID_REARM_MS. A full poll still runs every
+// RFID_FALLBACK_POLL_MS in case the line stops working.
+#define RFID_IRQ_CHECK_MS      50    // Boot check: the RC522 timer must raise the IRQ
+#define RFID_REARM_MS          100
+#define RFID_FALLBACK_POLL_MS  1000
 
 // Servo Gate Control
 #define SERVO_PIN       25
@@ -39,6 +51,13 @@ extern const char* FW_VERSION;
 #define LED_G_PIN       33
 #define LED_B_PIN       32
 
+enum LedColor : uint8_t {
+    LED_OFF,
+    LED_RED,
+    LED_GREEN,
+    LED_BLUE
+};
+
 // RTC Module (I2C - same bus as OLED)
 // Tiny RTC module typically uses DS1307 chip
 #define RTC_SDA         21
@@ -53,6 +72,8 @@ extern RTC_DS1307 rtc;  // Changed to DS1307 for Tiny RTC module
 // ================== Gate State ==================
 extern unsigned long gateCloseAtMs;
 extern bool gateIsOpen;
+extern unsigned long gateOpenedUs;  // micros() of the last open command
+extern volatile unsigned long rfidIrqUs;  // micros() of the last RC522 IRQ
 
 // ================== Hardware Functions ==================
 bool initializeHardware();
@@ -62,8 +83,18 @@ bool initializeServo();
 bool initializeLED();
 bool initializeRTC();
 
+// RFID Interrupt Functions
+bool initializeRFIDInterrupt(TaskHandle_t wakeTask);
+void armRFIDReceive();
+void noteRFIDReaderUsed();
+bool takeRFIDInterrupt();
+bool isRFIDInterruptPending();
+bool isRFIDInterruptActive();
+uint32_t getRFIDInterruptCount();
+
 // LED Control Functions
 void setLED(bool r, bool g, bool b);
+void setLEDColor(uint8_t color);
 void ledIdleBlue();
 void ledAccessGranted();
 void ledAccessDenied();
@@ -0,0 +1,230 @@
+#include "journal.h"
+#include <algorithm>
+#include <esp_rom_crc.h>
+#include "hardware.h"
+#include "roster.h"
+
+// ================== Journal State ==================
+// The file, its size and appendFailed are shared by the gate task
+// (appends) and compaction, under journalMutex
+static File journalFile;
+static bool journalReady = false;
+static size_t journalSize = 0;
+static bool appendFailed = false;        // Compact soon, the change is only in RAM
+static SemaphoreHandle_t journalMutex = nullptr;
+static unsigned long retryAtMs = 0;
+
+static void lockJournal() {
+    if (journalMutex) xSemaphoreTake(journalMutex, portMAX_DELAY);
+}
+
+static void unlockJournal() {
+    if (journalMutex) xSemaphoreGive(journalMutex);
+}
+
+static uint32_t entryCRC(const JournalEntry& entry) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&entry, offsetof(JournalEntry, crc32));
+}
+
+static bool openJournalForAppend() {
+    journalFile = LittleFS.open(JOURNAL_PATH, FILE_APPEND);
+    if (!journalFile) {
+        Serial.println("Failed to open journal for append");
+        journalReady = false;
+        return false;
+    }
+    journalSize = journalFile.size();
+    return true;
+}
+
+// ================== Journal Functions ==================
+bool initializeJournal() {
+    Serial.println("Initializing transaction journal...");
+    journalMutex = xSemaphoreCreateMutex();
+    
+    // Formats the data partition on first use
+    if (!LittleFS.begin(true)) {
+        Serial.println("LittleFS mount failed - scans will write NVS directly");
+        return false;
+    }
+    
+    journalReady = openJournalForAppend();
+    if (journalReady) {
+        Serial.printf("Journal ready (%u bytes)\n", (unsigned)journalSize);
+    }
+    return journalReady;
+}
+
+size_t replayJournal() {
+    if (!journalReady) return 0;
+    
+    lockUserTable();
+    journalFile.close();
+    File file = LittleFS.open(JOURNAL_PATH, FILE_READ);
+    
+    size_t applied = 0;
+    bool damaged = false;
+    JournalEntry entry;
+    while (file && file.available()) {
+        if (file.read((uint8_t*)&entry, sizeof(entry)) != sizeof(entry) || entry.crc32 != entryCRC(entry)) {
+            damaged = true; // Torn write from a power loss, nothing valid follows
+            break;
+        }
+        
+        // Entries hold absolute values, so the last one for a user wins.
+        // Unknown UIDs belong to users deleted after the entry was written.
+        CardUID uid(entry.uid, entry.uidSize);
+        User* user = getUserByUID(uid);
+        if (!user) {
+            User rosterUser;
+            if (getRosterUser(uid, rosterUser)) {
+                rosterUser.credit = entry.credit;
+                rosterUser.in = entry.in != 0;
+                setRosterUserState(rosterUser);
+                applied++;
+            }
+            continue;
+        }
+        
+        if (user->credit != entry.credit) {
+            user->credit = entry.credit;
+            user->dirty |= USER_DIRTY_CREDIT;
+        }
+        if (user->in != (entry.in != 0)) {
+            user->in = entry.in != 0;
+            user->dirty |= USER_DIRTY_IN;
+        }
+        applied++;
+    }
+    if (file) file.close();
+    
+    openJournalForAppend();
+    unlockUserTable();
+    Serial.printf("Replayed %u journal entries\n", (unsigned)applied);
+    
+    // Never append behind a damaged tail - fold what we have into the table
+    if (damaged) {
+        Serial.println("Journal tail damaged - compacting");
+        compactJournal();
+    }
+    return applied;
+}
+
+// Called by the gate task after the table lock is released; `timestamp`
+// is RTC unix time, 0 if the RTC is not set
+bool journalAppend(const User& user, uint32_t timestamp) {
+    if (!journalReady) return false;
+    
+    JournalEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.uidSize = user.uid.size;
+    memcpy(entry.uid, user.uid.bytes, sizeof(entry.uid));
+    entry.in = user.in ? 1 : 0;
+    entry.credit = user.credit;
+    entry.timestamp = timestamp;
+    entry.crc32 = entryCRC(entry);
+    
+    lockJournal();
+    bool ok = journalReady && journalFile.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    if (ok) {
+        journalFile.flush();
+        journalSize += sizeof(entry);
+    } else {
+        appendFailed = true;
+    }
+    unlockJournal();
+    if (!ok) Serial.println("Journal append failed");
+    return ok;
+}
+
+// Starts the journal over with the entries past `covered`. Appends wait for
+// this, but it only copies the few entries written during the table write.
+// The rename replaces the old journal in one step, so a power loss leaves
+// one of the two complete. If the copy fails the tail is dropped: those
+// users are still dirty, and the next compaction writes them to the table.
+static bool restartJournal(size_t covered) {
+    lockJournal();
+    journalFile.close();
+    
+    bool carried = false;
+    if (journalSize > covered) {
+        File from = LittleFS.open(JOURNAL_PATH, FILE_READ);
+        File to = LittleFS.open(JOURNAL_TEMP_PATH, FILE_WRITE);
+        carried = from && to && from.seek(covered);
+        uint8_t buffer[sizeof(JournalEntry) * 8];
+        for (size_t left = journalSize - covered; carried && left > 0;) {
+            size_t length = from.read(buffer, std::min(left, sizeof(buffer)));
+            carried = length > 0 && to.write(buffer, length) == length;
+            left -= length;
+        }
+        if (from) from.close();
+        if (to) to.close();
+        carried = carried && LittleFS.rename(JOURNAL_TEMP_PATH, JOURNAL_PATH);
+        if (!carried) {
+            Serial.println("Journal tail could not be carried over");
+            LittleFS.remove(JOURNAL_TEMP_PATH);
+        }
+    }
+    if (!carried) {
+        LittleFS.remove(JOURNAL_PATH);
+    }
+    bool ok = openJournalForAppend();
+    unlockJournal();
+    return ok;
+}
+
+// Writes every dirty user to the NVS table, then drops the journal entries
+// the write covers. Must run before any direct table write so older
+// entries can never be replayed over newer table data. The table lock is
+// only taken to copy the dirty users, so scans go on while NVS is written.
+bool compactJournal() {
+    if (!journalReady || (journalSize == 0 && !appendFailed)) return true;
+    
+    unsigned long start = millis();
+    lockUserStore();
+    
+    // A scan marks its user dirty before appending, so every entry before
+    // this offset is for a change the table write below includes
+    lockJournal();
+    size_t covered = journalSize;
+    bool hadFailed = appendFailed;
+    appendFailed = false;
+    unlockJournal();
+    
+    if (!saveUsersToBothNVS()) {
+        lockJournal();
+        appendFailed |= hadFailed;
+        unlockJournal();
+        unlockUserStore();
+        Serial.println("Journal compaction postponed - user table write failed");
+        return false;
+    }
+    
+    bool ok = restartJournal(covered);
+    unlockUserStore();
+    Serial.printf("Journal compacted (%u bytes) in %lu ms\n", (unsigned)covered, millis() - start);
+    return ok;
+}
+
+// Network task. Compacts once the journal grows too large or an append
+// failed; without a journal, writes the users scans left dirty.
+void maintainJournal() {
+    if ((long)(millis() - retryAtMs) < 0) return;
+    
+    bool ok = true;
+    if (journalReady) {
+        if (journalSize >= JOURNAL_COMPACT_BYTES || appendFailed) ok = compactJournal();
+    } else if (hasDirtyUsers()) {
+        ok = saveUsersToBothNVS();
+    }
+    if (!ok) retryAtMs = millis() + JOURNAL_RETRY_MS;
+}
+
+// ================== Journal Statistics ==================
+size_t getJournalSize() {
+    return journalSize;
+}
+
+bool isJournalReady() {
+    return journalReady;
+}
@@ -0,0 +1,40 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "users.h"
+
+// ================== Journal Configuration ==================
+// Credit and presence changes from card scans are appended to a journal file
+// on the LittleFS data partition instead of rewriting the user table. On boot
+// the journal is replayed over the NVS user table (the snapshot); once it
+// grows past JOURNAL_COMPACT_BYTES the dirty users are written back to the
+// table and the journal starts over. Scans keep appending while the table
+// is written; their entries are carried over into the new journal.
+#define JOURNAL_PATH           "/journal.bin"
+#define JOURNAL_TEMP_PATH      "/journal.tmp"
+#define JOURNAL_COMPACT_BYTES  (32 * 1024)
+#define JOURNAL_RETRY_MS       1000   // After a failed table write
+
+struct JournalEntry {
+    uint8_t uidSize;
+    uint8_t uid[UID_MAX_BYTES];
+    uint8_t in;
+    int32_t credit;
+    uint32_t timestamp;   // RTC unix time, 0 if the RTC is not set
+    uint32_t crc32;       // Over the fields above, detects torn writes
+};
+
+// ================== Journal Functions ==================
+bool initializeJournal();
+size_t replayJournal();
+bool journalAppend(const User& user, uint32_t timestamp);
+bool compactJournal();
+void maintainJournal();
+
+// ================== Journal Statistics ==================
+size_t getJournalSize();
+bool isJournalReady();
+
+#endif // JOURNAL_H
@@ -2,6 +2,9 @@
 #include "network.h" 
 #include "display.h"
 #include "users.h"
+#include "journal.h"
+#include "tasks.h"
+#include "outbox.h"
 
 void setup() {
     Serial.begin(9600);
@@ -23,60 +26,31 @@ void setup() {
         while(1) delay(1000);
     }
     
+    // Updates the server has not taken yet, from before a reboot
+    initializeOutbox();
+    
     if (!initializeNetwork()) {
         Serial.println("Network initialization failed!");
         showErrorScreen("Network Init Failed");
-        delay(3000); // Show error for 3 seconds
         // Don't stop on network failure, continue without network
     } else {
         // Show IP address on display
         String ip = getDeviceIP();
         Serial.println("ESP32 IP Address: " + ip);
         showSystemInfoScreen(); // This will show the IP
-        delay(3000); // Show IP for 3 seconds
     }
     
+    // The error or IP screen returns to idle by itself once the gate task runs
     Serial.println("All systems initialized successfully!");
-    showIdleScreen();
+    
+    // Card handling and networking run in their own pinned tasks from here
+    if (!startTasks()) {
+        showErrorScreen("Task Start Failed");
+        while(1) delay(1000);
+    }
 }
 
 void loop() {
-    // Handle web server requests
-    handleWebRequests();
-    
-    // Handle gate control (auto-close)
-    gateMaybeClose();
-    
-    // Update display (handle timeouts and return to idle)
-    updateDisplay();
-    
-    // Check for RFID card
-    String cardUID = readRFIDCard();
-    if (cardUID.length() > 0) {
-        processCardScan(cardUID);
-    }
-    
-    // WiFi reconnection check (every 30 seconds)
-    static unsigned long lastWiFiCheck = 0;
-    if (millis() - lastWiFiCheck > 30000) { // 30 seconds
-        if (WiFi.status() != WL_CONNECTED) {
-            Serial.println("WiFi disconnected - attempting reconnection...");
-            connectWiFi();
-        }
-        lastWiFiCheck = millis();
-    }
-    
-    // Periodic user sync (every 5 minutes) - only if WiFi connected
-    static unsigned long lastSync = 0;
-    if (millis() - lastSync > 300000) { // 5 minutes
-        if (WiFi.status() == WL_CONNECTED) {
-            Serial.println("Performing periodic sync with server...");
-            syncUsersWithServer();
-        } else {
-            Serial.println("Skipping sync - WiFi offline (will sync when connected)");
-        }
-        lastSync = millis();
-    }
-    
-    delay(100);
-}
\ No newline at end of file
+    // Everything runs in the gate and network tasks (see tasks.cpp)
+    vTaskDelete(NULL);
+}
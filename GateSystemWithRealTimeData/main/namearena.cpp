@@ -0,0 +1,39 @@
+#include "namearena.h"
+#include <string.h>
+
+// ================== User Name Arena ==================
+NameArena::NameArena() : blockUsed(NAME_ARENA_BLOCK_BYTES), used(0), wasted(0) {}
+
+NameArena::~NameArena() {
+    for (char* block : blocks) {
+        delete[] block;
+    }
+}
+
+// Returns a NUL-terminated copy that stays valid for the arena's lifetime
+const char* NameArena::store(const char* text, size_t length) {
+    if (length >= NAME_ARENA_BLOCK_BYTES) {
+        length = NAME_ARENA_BLOCK_BYTES - 1;
+    }
+    if (blockUsed + length + 1 > NAME_ARENA_BLOCK_BYTES) {
+        // The rest of the current block is too short - it becomes waste
+        if (!blocks.empty()) {
+            wasted += NAME_ARENA_BLOCK_BYTES - blockUsed;
+            used += NAME_ARENA_BLOCK_BYTES - blockUsed;
+        }
+        blocks.push_back(new char[NAME_ARENA_BLOCK_BYTES]);
+        blockUsed = 0;
+    }
+    
+    char* copy = blocks.back() + blockUsed;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    blockUsed += length + 1;
+    used += length + 1;
+    return copy;
+}
+
+// Marks a stored name as no longer referenced by the newest user table
+void NameArena::release(const char* text) {
+    wasted += strlen(text) + 1;
+}
@@ -0,0 +1,38 @@
+#ifndef NAMEARENA_H
+#define NAMEARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// ================== Name Arena Configuration ==================
+#define NAME_ARENA_BLOCK_BYTES  2048
+
+// ================== User Name Arena ==================
+// Append-only storage for user names in fixed-size blocks. A stored name
+// never moves, so User::name can be a plain pointer and user table copies
+// share one arena instead of allocating a String per user. Renamed and
+// deleted users leave their old bytes behind as waste; owners compact by
+// copying the live names into a fresh arena (see users.cpp).
+class NameArena {
+public:
+    NameArena();
+    ~NameArena();
+    NameArena(const NameArena&) = delete;
+    NameArena& operator=(const NameArena&) = delete;
+    
+    const char* store(const char* text, size_t length);
+    void release(const char* text);
+    
+    size_t capacityBytes() const { return blocks.size() * NAME_ARENA_BLOCK_BYTES; }
+    size_t usedBytes() const { return used; }
+    size_t wastedBytes() const { return wasted; }
+    
+private:
+    std::vector<char*> blocks;
+    size_t blockUsed;   // Bytes taken in the last block
+    size_t used;        // Bytes taken in all blocks, including waste
+    size_t wasted;
+};
+
+#endif // NAMEARENA_H
@@ -1,6 +1,13 @@
 #include "network.h"
+#include <esp_heap_caps.h>
 #include "hardware.h"
 #include "users.h"
+#include "userstore.h"
+#include "journal.h"
+#include "roster.h"
+#include "userdigest.h"
+#include "tasks.h"
+#include "outbox.h"
 
 // ================== Network Configuration ==================
 const char* WIFI_SSID = "Hanu";
@@ -18,52 +25,117 @@ bool serverConnected = false;
 String deviceIP = "";
 long lastHeartbeat = 0;
 
-// ================== Network Initialization ==================
-bool initializeNetwork() {
-    Serial.println("Initializing network...");
-    connectWiFi();
-    if (wifiConnected) {
+// ================== WiFi Connection ==================
+// Non-blocking: maintainWiFi() advances the connection one step per call
+// from the network task, and waits between failed attempts with
+// exponential backoff. Nothing else ever waits on the radio; an outage
+// only shows in wifiConnected.
+enum WiFiState : uint8_t {
+    WIFI_STATE_CONNECTING,
+    WIFI_STATE_CONNECTED,
+    WIFI_STATE_WAITING      // Backing off after a failed attempt
+};
+
+static WiFiState wifiState = WIFI_STATE_WAITING;
+static unsigned long wifiStateAtMs = 0;
+static unsigned long wifiRetryMs = 0;
+static uint8_t wifiFailures = 0;
+static volatile bool webServerStarted = false;  // Polled by the HTTP task
+static bool syncDue = false;  // Pull changes made while offline
+
+static const char* wifiStateName() {
+    switch (wifiState) {
+        case WIFI_STATE_CONNECTING: return "connecting";
+        case WIFI_STATE_CONNECTED: return "connected";
+        default: return "waiting";
+    }
+}
+
+static void closeRPCConnection();
+
+static void onWiFiConnected() {
+    wifiState = WIFI_STATE_CONNECTED;
+    wifiConnected = true;
+    wifiFailures = 0;
+    deviceIP = WiFi.localIP().toString();
+    Serial.printf("WiFi connected! IP: %s\n", deviceIP.c_str());
+    Serial.printf("RSSI: %d dBm\n", WiFi.RSSI());
+    
+    if (!webServerStarted) {
         setupWebServer();
-        deviceIP = getDeviceIP();
-        Serial.println("Network initialization complete");
-        return true;
-    } else {
-        Serial.println("Network initialization failed - WiFi not connected");
-        return false;
+        webServerStarted = true;
     }
+    syncDue = true;
 }
 
+// Starts an attempt and returns at once
 void connectWiFi() {
-    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
     WiFi.begin(WIFI_SSID, WIFI_PASS);
-    
-    Serial.printf("Connecting to WiFi '%s'", WIFI_SSID);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-        wifiConnected = true;
-        deviceIP = WiFi.localIP().toString();
-        Serial.printf("\nWiFi connected! IP: %s\n", deviceIP.c_str());
-        Serial.printf("RSSI: %d dBm\n", WiFi.RSSI());
-    } else {
-        wifiConnected = false;
-        Serial.println("\nWiFi connection failed!");
+    wifiState = WIFI_STATE_CONNECTING;
+    wifiStateAtMs = millis();
+    Serial.printf("Connecting to WiFi '%s'...\n", WIFI_SSID);
+}
+
+void maintainWiFi() {
+    bool linked = WiFi.status() == WL_CONNECTED;
+    switch (wifiState) {
+        case WIFI_STATE_CONNECTED:
+            if (!linked) {
+                wifiConnected = false;
+                closeRPCConnection();
+                Serial.println("WiFi disconnected - attempting reconnection...");
+                connectWiFi();
+            }
+            break;
+        case WIFI_STATE_CONNECTING:
+            if (linked) {
+                onWiFiConnected();
+            } else if (millis() - wifiStateAtMs >= WIFI_CONNECT_TIMEOUT_MS) {
+                // 5 s, 10 s, 20 s ... up to 5 minutes
+                if (wifiFailures < 16) wifiFailures++;
+                wifiRetryMs = WIFI_RETRY_BASE_MS;
+                for (uint8_t i = 1; i < wifiFailures && wifiRetryMs < WIFI_RETRY_MAX_MS; i++) wifiRetryMs *= 2;
+                if (wifiRetryMs > WIFI_RETRY_MAX_MS) wifiRetryMs = WIFI_RETRY_MAX_MS;
+                WiFi.disconnect();
+                wifiState = WIFI_STATE_WAITING;
+                wifiStateAtMs = millis();
+                Serial.printf("WiFi connection failed - retrying in %lu s\n", wifiRetryMs / 1000);
+            }
+            break;
+        case WIFI_STATE_WAITING:
+            if (linked) {
+                onWiFiConnected();
+            } else if (millis() - wifiStateAtMs >= wifiRetryMs) {
+                connectWiFi();
+            }
+            break;
     }
 }
 
 bool checkWiFiConnection() {
-    if (WiFi.status() != WL_CONNECTED) {
-        wifiConnected = false;
-        Serial.println("WiFi disconnected, attempting reconnection...");
-        connectWiFi();
+    return WiFi.status() == WL_CONNECTED;
+}
+
+// ================== Network Initialization ==================
+// At boot, before any card is read, the first attempt is waited for so the
+// IP can be shown; after that the network task keeps trying
+bool initializeNetwork() {
+    Serial.println("Initializing network...");
+    WiFi.mode(WIFI_STA);
+    connectWiFi();
+    while (wifiState == WIFI_STATE_CONNECTING) {
+        delay(100);
+        maintainWiFi();
+    }
+    
+    if (wifiConnected) {
+        Serial.println("Network initialization complete");
+        return true;
+    } else {
+        Serial.println("Network initialization failed - WiFi not connected");
+        return false;
     }
-    return wifiConnected;
 }
 
 void setupWebServer() {
@@ -74,116 +146,297 @@ void setupWebServer() {
     
     server.on("/api/info", HTTP_GET, handleInfo);
     server.on("/api/state", HTTP_GET, handleState);
+    server.on("/api/users", HTTP_GET, handleUsersQuery);
+    server.on("/api/users/export", HTTP_GET, handleUsersExport);
+    server.on("/api/users/digest", HTTP_GET, handleUserDigest);
     server.on("/api/open", HTTP_POST, handleOpen);
     server.on("/api/led", HTTP_POST, handleLED);
     server.on("/api/input/mode", HTTP_POST, handleInputMode);
     server.on("/api/time/sync", HTTP_POST, handleTimeSync);
-    server.on("/api/database/sync", HTTP_POST, handleDatabaseSync);
+    server.on("/api/database/sync", HTTP_POST, handleDatabaseSync, handleDatabaseSyncBody);
     server.on("/api/input/last", HTTP_GET, handleLastInput);
+    server.on("/api/selftest", HTTP_POST, handleSelfTestStart);
     server.on("/api/selftest", HTTP_GET, handleSelfTest);
     
+    // Sync bodies are decoded according to their Content-Type
+    static const char* requestHeaders[] = {"Content-Type"};
+    server.collectHeaders(requestHeaders, 1);
+    
     server.begin();
     Serial.println("Web server started on port 80");
 }
 
 void handleWebRequests() {
-    server.handleClient();
+    if (webServerStarted) {
+        server.handleClient();
+    }
+}
+
+// Keeps WiFi up and pulls user changes; runs on the network task
+void maintainNetwork() {
+    maintainWiFi();
+    
+    // Periodic user sync (every 5 minutes, and after every reconnect) -
+    // only if WiFi connected
+    static unsigned long lastSync = 0;
+    if (syncDue || millis() - lastSync > 300000) { // 5 minutes
+        syncDue = false;
+        if (WiFi.status() == WL_CONNECTED) {
+            Serial.println("Performing periodic sync with server...");
+            syncUsersWithServer();
+        } else {
+            Serial.println("Skipping sync - WiFi offline (will sync when connected)");
+        }
+        lastSync = millis();
+    }
+}
+
+// Pulls user changes on the next pass of the network task
+void requestUserSync() {
+    syncDue = true;
+}
+
+// ================== Wire Format ==================
+// Every request offers MessagePack in Accept. A server that answers in it
+// gets its request bodies as MessagePack too, which are smaller than JSON
+// and cheaper to parse (bench/wire_format_bench.cpp); a 415 switches back
+// to JSON.
+static bool serverSpeaksMsgPack = false;
+
+static bool isMsgPack(const String& contentType) {
+    return contentType.startsWith(MSGPACK_CONTENT_TYPE);
+}
+
+// ================== RPC Connection ==================
+// Every RPC and the user sync go over one TCP connection to
+// SERVER_HOST:SERVER_PORT that HTTPClient keeps alive between requests,
+// instead of a handshake per scan update, heartbeat and event. Only the
+// network task uses it, so one connection is the whole pool.
+static WiFiClient rpcClient;
+static unsigned long rpcLastUsedMs = 0;
+static bool rpcReused = false;          // Current request went out on an open connection
+static RPCConnectionStats rpcStats = {0, 0, 0, 0, 0, 0};
+static uint64_t rpcNewRttTotal = 0;
+static uint64_t rpcReusedRttTotal = 0;
+
+static void closeRPCConnection() {
+    rpcClient.stop();
+}
+
+// Points httpClient at endpoint on the pooled connection. A connection the
+// server has closed, or that sat idle long enough that it may be about to,
+// is replaced; HTTPClient connects on the first send.
+static void beginRPC(const String& endpoint, const char* contentType = nullptr) {
+    static const char* responseHeaders[] = {"Content-Type"};
+    rpcReused = rpcClient.connected() && millis() - rpcLastUsedMs < RPC_KEEPALIVE_IDLE_MS;
+    if (!rpcReused) {
+        closeRPCConnection();
+        rpcStats.connects++;
+    }
+    
+    httpClient.begin(rpcClient, SERVER_HOST, SERVER_PORT, endpoint);
+    httpClient.setReuse(true);
+    if (contentType) httpClient.addHeader("Content-Type", contentType);
+    httpClient.addHeader("Accept", MSGPACK_CONTENT_TYPE ", application/json;q=0.5");
+    httpClient.collectHeaders(responseHeaders, 1);
+    httpClient.setTimeout(RPC_TIMEOUT_MS);
+}
+
+// After the whole answer has been read, the connection stays open for the
+// next request unless the server asked to close it; keepOpen false drops
+// it when part of the answer was left unread
+static void endRPC(bool keepOpen, unsigned long startUs) {
+    httpClient.end();
+    if (!keepOpen) closeRPCConnection();
+    rpcLastUsedMs = millis();
+    
+    uint32_t rtt = micros() - startUs;
+    rpcStats.requests++;
+    if (rpcReused) {
+        rpcStats.reused++;
+        rpcReusedRttTotal += rtt;
+        rpcStats.avgReusedRttUs = rpcReusedRttTotal / rpcStats.reused;
+    } else {
+        rpcNewRttTotal += rtt;
+        rpcStats.avgNewRttUs = rpcNewRttTotal / (rpcStats.requests - rpcStats.reused);
+    }
+}
+
+// Writing the request to a kept-alive connection failed, i.e. the server
+// had closed it and the request never reached it, so sending again on a new
+// one cannot apply it twice. A connection lost after the request was sent
+// is not retried: the server may already have applied the POST, and events
+// and UID notifications carry no sequence number to deduplicate them.
+static bool isStaleConnection(int httpCode) {
+    return rpcReused && (httpCode == HTTPC_ERROR_SEND_HEADER_FAILED ||
+                         httpCode == HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+}
+
+RPCConnectionStats getRPCConnectionStats() {
+    return rpcStats;
+}
+
+// Sends on the pooled connection, and once more on a new one if that had
+// gone stale; startUs is when the request that counts went out
+static int sendRPC(const String& endpoint, const String& method, uint8_t* body, size_t length,
+                   const char* contentType, unsigned long& startUs) {
+    for (uint8_t attempt = 0;; attempt++) {
+        startUs = micros();
+        beginRPC(endpoint, contentType);
+        
+        int httpCode;
+        if (method == "POST") {
+            httpCode = httpClient.sendRequest("POST", body, length);
+        } else if (method == "PUT") {
+            httpCode = httpClient.sendRequest("PUT", body, length);
+        } else {
+            httpCode = httpClient.GET();
+        }
+        if (attempt > 0 || !isStaleConnection(httpCode)) return httpCode;
+        
+        endRPC(false, startUs);
+        rpcStats.staleRetries++;
+    }
 }
 
 // ================== RPC Communication Functions ==================
-RPCResponse sendRPCRequest(const String& endpoint, const String& method, const String& payload) {
+
+static RPCResponse performRPC(const String& endpoint, const String& method,
+                              uint8_t* body, size_t length, const char* contentType) {
     RPCResponse response;
     
-    if (!checkWiFiConnection()) {
+    // Reconnecting is left to maintainNetwork(); waiting for it here would
+    // hold every queued RPC and the web server for up to 15 s
+    if (WiFi.status() != WL_CONNECTED) {
+        wifiConnected = false;
         response.error = "WiFi not connected";
         return response;
     }
     
-    String url = createURL(endpoint);
-    httpClient.begin(url);
-    httpClient.addHeader("Content-Type", "application/json");
-    httpClient.setTimeout(5000);
-    
-    int httpCode;
-    if (method == "POST") {
-        httpCode = httpClient.POST(payload);
-    } else if (method == "PUT") {
-        httpCode = httpClient.PUT(payload);
-    } else {
-        httpCode = httpClient.GET();
-    }
+    unsigned long startUs;
+    int httpCode = sendRPC(endpoint, method, body, length, contentType, startUs);
+    response.status = httpCode;
     
     if (httpCode > 0) {
+        bool msgPack = isMsgPack(httpClient.header("Content-Type"));
         String responseBody = httpClient.getString();
         
         if (httpCode == 200) {
-            DeserializationError error = deserializeJson(response.data, responseBody);
+            DeserializationError error;
+            if (msgPack) {
+                serverSpeaksMsgPack = true;
+                error = deserializeMsgPack(response.data, (const uint8_t*)responseBody.c_str(), responseBody.length());
+            } else {
+                error = deserializeJson(response.data, responseBody);
+            }
             if (error) {
-                response.error = "JSON parse error: " + String(error.c_str());
+                response.error = String(msgPack ? "MessagePack" : "JSON") + " parse error: " + String(error.c_str());
             } else {
                 response.success = true;
             }
         } else {
-            response.error = "HTTP " + String(httpCode) + ": " + responseBody;
+            if (httpCode == 415 && isMsgPack(contentType)) {
+                serverSpeaksMsgPack = false;
+            }
+            response.error = "HTTP " + String(httpCode) + ": " + (msgPack ? String("(MessagePack body)") : responseBody);
         }
     } else {
         response.error = "Connection error: " + httpClient.errorToString(httpCode);
     }
     
-    httpClient.end();
+    endRPC(httpCode > 0, startUs);
     return response;
 }
 
+RPCResponse sendRPCRequest(const String& endpoint, const String& method, const String& payload) {
+    return performRPC(endpoint, method, (uint8_t*)payload.c_str(), payload.length(), "application/json");
+}
+
+RPCResponse sendRPCRequest(const String& endpoint, const String& method, const JsonDocument& payload) {
+    if (serverSpeaksMsgPack) {
+        std::vector<uint8_t> body(measureMsgPack(payload));
+        serializeMsgPack(payload, body.data(), body.size());
+        RPCResponse response = performRPC(endpoint, method, body.data(), body.size(), MSGPACK_CONTENT_TYPE);
+        if (serverSpeaksMsgPack) {
+            return response;
+        }
+        // Refused with 415: resend as JSON
+    }
+    
+    String payloadStr;
+    serializeJson(payload, payloadStr);
+    return sendRPCRequest(endpoint, method, payloadStr);
+}
+
 RPCResponse getUsersFromServer() {
     return sendRPCRequest("/api/database/users", "GET");
 }
 
-RPCResponse sendUserToServer(const String& uid, const String& name, long credit) {
+RPCResponse sendUserToServer(const CardUID& uid, const String& name, long credit) {
     DynamicJsonDocument payload(512);
-    payload["uid"] = uid;
+    payload["uid"] = uidToHex(uid);
     payload["name"] = name;
     payload["credit"] = credit;
     
-    String payloadStr;
-    serializeJson(payload, payloadStr);
-    
-    return sendRPCRequest("/api/database/users/add", "POST", payloadStr);
+    return sendRPCRequest("/api/database/users/add", "POST", payload);
 }
 
-RPCResponse updateUserOnServer(const String& uid, const String& name, long credit, bool in) {
+// timestamp: RTC time of the change, read by the gate task (empty if unset)
+// seq: per-device sequence number in getUpdateEpoch() (see outbox.h), 0 if none
+RPCResponse updateUserOnServer(const CardUID& uid, const String& name, long credit, bool in,
+                               const char* timestamp, uint32_t seq) {
     DynamicJsonDocument payload(512);
-    payload["uid"] = uid;
+    if (seq) {
+        payload["device"] = deviceId();
+        payload["epoch"] = getUpdateEpoch();
+        payload["seq"] = seq;
+    }
+    payload["uid"] = uidToHex(uid);
     payload["name"] = name;
     payload["credit"] = credit;
     payload["in"] = in;
     
     // Add RTC timestamp for accurate time tracking
-    DateTime now = rtc.now();
-    if (now.year() >= 2023) { // Valid RTC time
-        char timestamp[25];
-        sprintf(timestamp, "%04d-%02d-%02dT%02d:%02d:%02d.000Z",
-                now.year(), now.month(), now.day(),
-                now.hour(), now.minute(), now.second());
+    if (timestamp && timestamp[0]) {
         payload["timestamp"] = timestamp;
     }
     
-    String payloadStr;
-    serializeJson(payload, payloadStr);
+    return sendRPCRequest("/api/database/users/update", "POST", payload);
+}
+
+// Several queued updates in one request; the server answers with the UIDs
+// it did not know in "rejected"
+RPCResponse updateUsersOnServer(const NetworkJob* updates, size_t count) {
+    DynamicJsonDocument payload(256 + count * 160);
+    payload["device"] = deviceId();
+    payload["epoch"] = getUpdateEpoch();
+    JsonArray list = payload.createNestedArray("updates");
+    for (size_t i = 0; i < count; i++) {
+        const NetworkJob& update = updates[i];
+        JsonObject item = list.createNestedObject();
+        if (update.seq) {
+            item["seq"] = update.seq;
+        }
+        item["uid"] = uidToHex(update.uid);
+        item["name"] = (const char*)update.name;  // Not copied; the batch outlives the request
+        item["credit"] = update.credit;
+        item["in"] = update.in;
+        if (update.timestamp[0]) {
+            item["timestamp"] = (const char*)update.timestamp;
+        }
+    }
     
-    return sendRPCRequest("/api/database/users/update", "POST", payloadStr);
+    return sendRPCRequest("/api/database/users/batch", "POST", payload);
 }
 
-RPCResponse notifyNewUID(const String& uid, bool isNew) {
+RPCResponse notifyNewUID(const CardUID& uid, bool isNew) {
     DynamicJsonDocument payload(512);
-    payload["uid"] = uid;
+    payload["uid"] = uidToHex(uid);
     payload["isNew"] = isNew;
     payload["timestamp"] = millis();
     payload["device_ip"] = deviceIP;
     
-    String payloadStr;
-    serializeJson(payload, payloadStr);
-    
-    return sendRPCRequest("/api/input/new-uid", "POST", payloadStr);
+    return sendRPCRequest("/api/input/new-uid", "POST", payload);
 }
 
 RPCResponse syncTimeWithServer() {
@@ -197,27 +450,131 @@ RPCResponse notifyServerEvent(const String& event, const String& details) {
     payload["timestamp"] = millis();
     payload["device_ip"] = deviceIP;
     
-    String payloadStr;
-    serializeJson(payload, payloadStr);
-    
-    return sendRPCRequest("/api/events/notify", "POST", payloadStr);
+    return sendRPCRequest("/api/events/notify", "POST", payload);
 }
 
+// ================== Chunked Responses ==================
+// Responses of unknown length are sent with chunked transfer encoding in
+// CHUNK_SIZE pieces, so their size is not limited by RAM.
+#define CHUNK_SIZE 1024
+
+class ChunkedResponse : public Print {
+public:
+    ChunkedResponse() : length(0) {}
+    
+    void begin(const char* contentType) {
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(200, contentType, "");
+    }
+    
+    size_t write(uint8_t c) {
+        buffer[length++] = c;
+        if (length == CHUNK_SIZE) flush();
+        return 1;
+    }
+    
+    size_t write(const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < size; i++) write(data[i]);
+        return size;
+    }
+    
+    void flush() {
+        if (length > 0) {
+            server.sendContent(buffer, length);
+            length = 0;
+        }
+    }
+    
+    // Sends the rest and the terminating empty chunk
+    void end() {
+        flush();
+        server.sendContent("");
+    }
+    
+private:
+    char buffer[CHUNK_SIZE];
+    size_t length;
+};
+
 // ================== Server Response Handlers ==================
 void handleInfo() {
-    DynamicJsonDocument doc(1024);
+    DynamicJsonDocument doc(1536);  // About 60 members plus strings
     doc["fwVersion"] = FW_VERSION;
     doc["version"] = FW_VERSION;
     doc["ip"] = deviceIP;
+    doc["device"] = deviceId();
     doc["ssid"] = WIFI_SSID;
     doc["rssi"] = getWiFiRSSI();
+    doc["wifi"] = wifiStateName();
+    doc["wifiFailures"] = wifiFailures;
     doc["uptime"] = millis() / 1000;
     doc["uptime_s"] = millis() / 1000;
     doc["freeHeap"] = ESP.getFreeHeap();
     doc["heap"] = ESP.getFreeHeap();
+    
+    // Fragmentation: a large gap between free heap and the largest block
+    size_t freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    doc["largestFreeBlock"] = largestBlock;
+    doc["heapFragmentation"] = freeBytes ? 100 - (int)(largestBlock * 100 / freeBytes) : 0;
+    doc["nameArenaBytes"] = getNameArenaBytes();
+    doc["nameArenaWasted"] = getNameArenaWastedBytes();
     doc["users"] = getTotalUserCount();
     doc["static"] = getStaticUserCount();
     doc["dynamic"] = getDynamicUserCount();
+    doc["nvsWrites"] = getNVSWriteCount();
+    doc["journalBytes"] = getJournalSize();
+    doc["syncRevision"] = getUserSyncRevision();
+    
+    // Bodies /api/database/sync accepts, by Content-Type
+    JsonArray formats = doc.createNestedArray("formats");
+    formats.add("json");
+    formats.add("msgpack");
+    doc["roster"] = getRosterUserCount();
+    doc["rosterOverlay"] = getRosterOverlaySize();
+    doc["inside"] = getInsideUserCount();
+    
+    // Card-to-gate time of granted scans, and RPCs waiting for the network task
+    ScanLatency latency = getScanLatency();
+    JsonObject scan = doc.createNestedObject("scanLatencyUs");
+    scan["count"] = latency.count;
+    scan["last"] = latency.lastUs;
+    scan["min"] = latency.minUs;
+    scan["max"] = latency.maxUs;
+    scan["avg"] = latency.avgUs;
+    doc["rfidIrq"] = isRFIDInterruptActive();
+    doc["rfidInterrupts"] = getRFIDInterruptCount();
+    NetworkQueueStats queue = getNetworkQueueStats();
+    JsonObject rpc = doc.createNestedObject("networkQueue");
+    rpc["depth"] = queue.depth;
+    rpc["capacity"] = queue.capacity;
+    rpc["dropped"] = queue.dropped;
+    rpc["failed"] = queue.failed;
+    rpc["retries"] = queue.retries;
+    rpc["sent"] = queue.sent;
+    rpc["batches"] = queue.batches;
+    rpc["outbox"] = queue.outbox;
+    rpc["outboxBytes"] = queue.outboxBytes;
+    rpc["outboxDropped"] = queue.outboxDropped;
+    rpc["retryInMs"] = queue.retryInMs;
+    
+    // Kept-alive server connection; compare the round trips to see what a
+    // reused connection saves
+    RPCConnectionStats connection = getRPCConnectionStats();
+    JsonObject pool = doc.createNestedObject("rpcConnection");
+    pool["connects"] = connection.connects;
+    pool["requests"] = connection.requests;
+    pool["reused"] = connection.reused;
+    pool["staleRetries"] = connection.staleRetries;
+    pool["avgNewRttUs"] = connection.avgNewRttUs;
+    pool["avgReusedRttUs"] = connection.avgReusedRttUs;
+    
+    JsonObject filter = doc.createNestedObject("uidFilter");
+    filter["bytes"] = getUidFilterBytes();
+    filter["flashBytes"] = getRosterFilterBytes();
+    filter["falsePositiveRate"] = getUidFilterFalsePositiveRate();
+    filter["rejects"] = getUidFilterRejectCount();
+    filter["falsePositives"] = getUidFilterFalsePositiveCount();
     
     String response;
     serializeJson(doc, response);
@@ -225,20 +582,106 @@ void handleInfo() {
 }
 
 void handleState() {
-    DynamicJsonDocument doc(2048);
-    doc["inputMode"] = isInputModeActive();
-    doc["gateOpen"] = gateIsOpen;
+    ChunkedResponse out;
+    out.begin("application/json");
+    out.print(isInputModeActive() ? "{\"inputMode\":true" : "{\"inputMode\":false");
+    out.print(gateIsOpen ? ",\"gateOpen\":true,\"users\":" : ",\"gateOpen\":false,\"users\":");
+    writeUsersJson(out);
+    out.write('}');
+    out.end();
+}
+
+void handleUsersExport() {
+    ChunkedResponse out;
+    out.begin("application/json");
+    out.print("{\"device\":\"" + deviceIP + "\",\"users\":");
+    uint32_t count = writeUsersJson(out);
+    out.print(",\"count\":" + String(count) + "}");
+    out.end();
+}
+
+// GET /api/users?limit=&after=<uid>&inside=1&creditBelow=&prefix=
+void handleUsersQuery() {
+    UserPageQuery query;
+    if (server.hasArg("after") && !parseUID(server.arg("after"), query.after)) {
+        server.send(400, "application/json", "{\"success\":false,\"error\":\"Invalid after UID\"}");
+        return;
+    }
+    if (server.hasArg("limit")) query.limit = constrain(server.arg("limit").toInt(), 1, USER_PAGE_MAX);
+    query.insideOnly = server.arg("inside") == "1" || server.arg("inside") == "true";
+    if (server.hasArg("creditBelow")) {
+        query.hasCreditBelow = true;
+        query.creditBelow = server.arg("creditBelow").toInt();
+    }
+    query.namePrefix = server.arg("prefix");
     
-    JsonArray users = doc.createNestedArray("users");
-    populateUsersJson(users);
+    CardUID next;
+    ChunkedResponse out;
+    out.begin("application/json");
+    out.print("{\"users\":");
+    uint32_t count = writeUserPageJson(out, query, next);
+    out.print(",\"count\":" + String(count));
+    out.print(next.isEmpty() ? String(",\"next\":null}") : ",\"next\":\"" + uidToHex(next) + "\"}");
+    out.end();
+}
+
+// GET /api/users/digest: root and group hashes; ?group=g: that group's
+// bucket hashes; ?bucket=b: the users of that bucket with their hashes
+void handleUserDigest() {
+    const int groupCount = DIGEST_BUCKETS / DIGEST_FANOUT;
+    
+    if (server.hasArg("bucket")) {
+        int bucket = server.arg("bucket").toInt();
+        if (bucket < 0 || bucket >= DIGEST_BUCKETS) {
+            server.send(400, "application/json", "{\"success\":false,\"error\":\"Invalid bucket\"}");
+            return;
+        }
+        ChunkedResponse out;
+        out.begin("application/json");
+        out.print("{\"bucket\":" + String(bucket) + ",\"users\":");
+        writeUserDigestBucketJson(out, bucket);
+        out.write('}');
+        out.end();
+        return;
+    }
+    
+    DynamicJsonDocument doc(768);
+    JsonArray hashes;
+    uint32_t values[DIGEST_FANOUT > groupCount ? DIGEST_FANOUT : groupCount];
+    int count;
+    if (server.hasArg("group")) {
+        int group = server.arg("group").toInt();
+        if (group < 0 || group >= groupCount) {
+            server.send(400, "application/json", "{\"success\":false,\"error\":\"Invalid group\"}");
+            return;
+        }
+        getUserDigestBuckets(group, values);
+        doc["group"] = group;
+        hashes = doc.createNestedArray("buckets");
+        count = DIGEST_FANOUT;
+    } else {
+        getUserDigestGroups(values);
+        doc["root"] = getUserDigestRoot();
+        doc["users"] = getTotalUserCount() + getRosterUserCount();
+        doc["revision"] = getUserSyncRevision();
+        hashes = doc.createNestedArray("groups");
+        count = groupCount;
+    }
+    for (int i = 0; i < count; i++) {
+        hashes.add(values[i]);
+    }
     
     String response;
     serializeJson(doc, response);
     server.send(200, "application/json", response);
 }
 
+// Hardware belongs to the gate task; handlers queue commands for it
 void handleOpen() {
-    gateOpen();
+    if (!queueGateCommand(GATE_OPEN)) {
+        server.send(503, "application/json", "{\"success\":false,\"error\":\"Gate busy\"}");
+        return;
+    }
     server.send(200, "application/json", "{\"success\":true}");
 }
 
@@ -246,16 +689,19 @@ void handleLED() {
     String color = server.hasArg("c") ? server.arg("c") : "OFF";
     color.toUpperCase();
     
+    uint8_t led = LED_OFF;
     if (color == "RED") {
-        setLED(true, false, false);
+        led = LED_RED;
     } else if (color == "GREEN") {
-        setLED(false, true, false);
+        led = LED_GREEN;
     } else if (color == "BLUE") {
-        setLED(false, false, true);
-    } else {
-        ledOff();
+        led = LED_BLUE;
     }
     
+    if (!queueGateCommand(GATE_LED, led)) {
+        server.send(503, "application/json", "{\"success\":false,\"error\":\"Gate busy\"}");
+        return;
+    }
     server.send(200, "application/json", "{\"success\":true}");
 }
 
@@ -278,14 +724,14 @@ void handleInputMode() {
     
     mode.toLowerCase();
     
-    if (mode == "on") {
-        setInputModeActive(true);
-    } else if (mode == "off") {
-        setInputModeActive(false);
+    // Reports the requested state; the gate task applies it right away
+    bool active = isInputModeActive();
+    if ((mode == "on" || mode == "off") && queueGateCommand(GATE_INPUT_MODE, mode == "on")) {
+        active = mode == "on";
     }
     
     DynamicJsonDocument doc(256);
-    doc["active"] = isInputModeActive();
+    doc["active"] = active;
     
     String response;
     serializeJson(doc, response);
@@ -296,8 +742,7 @@ void handleTimeSync() {
     if (server.hasArg("timestamp")) {
         long timestamp = server.arg("timestamp").toInt();
         
-        if (timestamp > 0) {
-            rtc.adjust(DateTime(timestamp));
+        if (timestamp > 0 && queueGateCommand(GATE_SET_TIME, 0, timestamp)) {
             server.send(200, "application/json", "{\"success\":true}");
             return;
         }
@@ -306,20 +751,163 @@ void handleTimeSync() {
     server.send(400, "application/json", "{\"success\":false,\"error\":\"Invalid timestamp\"}");
 }
 
-void handleDatabaseSync() {
-    String payload = server.arg("plain");
-    DynamicJsonDocument doc(4096);
+// ================== Streaming Sync ==================
+// Sync bodies, pushed to /api/database/sync or pulled from the server, are
+// parsed while they arrive instead of being collected in a String, so
+// roster size is not limited by RAM. The sync itself starts with the first
+// user, once the parser has seen whether it is a delta ("since").
+enum StreamedSyncState : uint8_t {
+    SYNC_IDLE,
+    SYNC_FEEDING,       // Body arriving, no user yet
+    SYNC_STARTED,
+    SYNC_REFUSED,       // Delta against a revision this device does not hold
+    SYNC_FAILED
+};
+
+static bool syncParserUser(const SyncUserRecord& user, void* context);
+
+static UserSyncParser syncParser(syncParserUser);
+static StreamedSyncState syncState = SYNC_IDLE;
+
+// A push (HTTP task) and a pull (network task) may overlap; the one that
+// claims the parser first runs, the other is turned away
+static portMUX_TYPE syncClaimMux = portMUX_INITIALIZER_UNLOCKED;
+static bool syncClaimed = false;
+
+static bool claimStreamedSync() {
+    portENTER_CRITICAL(&syncClaimMux);
+    bool claimed = !syncClaimed;
+    syncClaimed = true;
+    portEXIT_CRITICAL(&syncClaimMux);
+    return claimed;
+}
+
+static void releaseStreamedSync() {
+    portENTER_CRITICAL(&syncClaimMux);
+    syncClaimed = false;
+    portEXIT_CRITICAL(&syncClaimMux);
+}
+
+static bool startStreamedSync() {
+    if (syncState == SYNC_FEEDING) {
+        uint32_t since = syncParser.since();
+        if (since > 0 && since != getUserSyncRevision()) {
+            syncState = SYNC_REFUSED;
+        } else {
+            syncState = beginUserSync(since) ? SYNC_STARTED : SYNC_FAILED;
+        }
+    }
+    return syncState == SYNC_STARTED;
+}
+
+static bool syncParserUser(const SyncUserRecord& user, void* context) {
+    return startStreamedSync() && syncUser(user);
+}
+
+// False if another sync holds the parser
+static bool beginStreamedSync(SyncFormat format) {
+    if (!claimStreamedSync()) return false;
+    syncParser.reset(format);
+    syncState = SYNC_FEEDING;
+    return true;
+}
+
+static void feedStreamedSync(const uint8_t* data, size_t length) {
+    if (syncState == SYNC_FEEDING || syncState == SYNC_STARTED) {
+        syncParser.feed(data, length);
+    }
+}
+
+static void abortStreamedSync() {
+    if (syncState == SYNC_STARTED) {
+        endUserSync(false);
+    }
+    syncState = SYNC_IDLE;
+    releaseStreamedSync();
+}
+
+// Publishes a completely parsed body. Returns the HTTP status to answer
+// with: 200, 400 (bad body), 409 (delta not made for this device) or 500.
+static int endStreamedSync() {
+    bool parsed = syncParser.finish();
+    if (parsed) {
+        startStreamedSync();  // A delta may have no users at all
+    }
     
-    DeserializationError error = deserializeJson(doc, payload);
-    if (error) {
-        server.send(400, "application/json", "{\"success\":false,\"error\":\"Invalid JSON\"}");
+    int code;
+    if (syncState == SYNC_REFUSED) {
+        code = 409;
+    } else if (!parsed) {
+        if (syncState == SYNC_STARTED) {
+            endUserSync(false);
+        }
+        code = syncParser.error() == SYNC_PARSE_REJECTED ? 500 : 400;
+    } else if (syncState != SYNC_STARTED) {
+        code = 500;
+    } else {
+        code = endUserSync(true, syncParser.revision()) ? 200 : 500;
+    }
+    syncState = SYNC_IDLE;
+    releaseStreamedSync();
+    return code;
+}
+
+// Lets HTTPClient::writeToStream() hand a response body to the parser
+class SyncParserStream : public Stream {
+public:
+    size_t write(uint8_t c) { feedStreamedSync(&c, 1); return 1; }
+    size_t write(const uint8_t* buffer, size_t size) { feedStreamedSync(buffer, size); return size; }
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+};
+
+static SyncFormat syncFormatOf(const String& contentType) {
+    return isMsgPack(contentType) ? SYNC_FORMAT_MSGPACK : SYNC_FORMAT_JSON;
+}
+
+// State of the pushed body, seen only by the HTTP task
+enum PushedSyncState : uint8_t { PUSH_NONE, PUSH_STREAMING, PUSH_BUSY };
+static PushedSyncState pushState = PUSH_NONE;
+
+void handleDatabaseSyncBody() {
+    HTTPRaw& raw = server.raw();
+    if (raw.status == RAW_START) {
+        pushState = beginStreamedSync(syncFormatOf(server.header("Content-Type"))) ? PUSH_STREAMING : PUSH_BUSY;
+    } else if (raw.status == RAW_WRITE) {
+        if (pushState == PUSH_STREAMING) feedStreamedSync(raw.buf, raw.currentSize);
+    } else if (raw.status == RAW_ABORTED) {
+        if (pushState == PUSH_STREAMING) abortStreamedSync();
+        pushState = PUSH_NONE;
+    }
+}
+
+void handleDatabaseSync() {
+    // Bodies the server did not hand to handleDatabaseSyncBody (e.g. form
+    // encoded) are still in the "plain" argument
+    if (pushState == PUSH_NONE) {
+        String payload = server.arg("plain");
+        pushState = beginStreamedSync(syncFormatOf(server.header("Content-Type"))) ? PUSH_STREAMING : PUSH_BUSY;
+        if (pushState == PUSH_STREAMING) feedStreamedSync((const uint8_t*)payload.c_str(), payload.length());
+    }
+    if (pushState == PUSH_BUSY) {
+        pushState = PUSH_NONE;
+        server.send(503, "application/json", "{\"success\":false,\"error\":\"Sync in progress\"}");
         return;
     }
+    pushState = PUSH_NONE;
     
-    if (syncUsersFromJson(doc)) {
-        server.send(200, "application/json", "{\"success\":true}");
+    int code = endStreamedSync();
+    String revision = String(getUserSyncRevision());
+    if (code == 200) {
+        server.send(200, "application/json", "{\"success\":true,\"revision\":" + revision + "}");
+    } else if (code == 409) {
+        // The server resends from the revision the device holds
+        server.send(409, "application/json",
+                    "{\"success\":false,\"error\":\"Revision mismatch\",\"revision\":" + revision + "}");
     } else {
-        server.send(500, "application/json", "{\"success\":false,\"error\":\"Sync failed\"}");
+        String error = code == 400 ? syncParser.errorString() : "Sync failed";
+        server.send(code, "application/json", "{\"success\":false,\"error\":\"" + error + "\"}");
     }
 }
 
@@ -328,7 +916,7 @@ void handleLastInput() {
     
     LastScanResult lastScan = getLastScan();
     doc["hasInput"] = !lastScan.uid.isEmpty();
-    doc["uid"] = lastScan.uid;
+    doc["uid"] = uidToHex(lastScan.uid);
     doc["timestamp"] = lastScan.timestamp;
     doc["isNew"] = lastScan.isNew;
     doc["inputMode"] = isInputModeActive();
@@ -342,13 +930,52 @@ void handleLastInput() {
     server.send(200, "application/json", response);
 }
 
+// Starts a self-test job on the gate task and answers at once; poll
+// GET /api/selftest?id= for the results
+void handleSelfTestStart() {
+    uint32_t id = startSelfTest();
+    if (id == 0) {
+        server.send(503, "application/json", "{\"success\":false,\"error\":\"Gate busy\"}");
+        return;
+    }
+    
+    DynamicJsonDocument doc(128);
+    doc["success"] = true;
+    doc["id"] = id;
+    doc["state"] = selfTestStateName(getSelfTest().state);
+    
+    String response;
+    serializeJson(doc, response);
+    server.send(202, "application/json", response);
+}
+
+// The latest job, or the one asked for by ?id= while it is still the latest
 void handleSelfTest() {
-    DynamicJsonDocument doc(512);
-    doc["rc522"] = testRFID();
-    doc["oled"] = testOLED();
-    doc["led"] = testLED();
-    doc["servo"] = testServo();
-    doc["rtc"] = testRTC();
+    SelfTestJob job = getSelfTest();
+    if (server.hasArg("id") && (uint32_t)server.arg("id").toInt() != job.id) {
+        server.send(404, "application/json", "{\"success\":false,\"error\":\"Unknown self-test job\"}");
+        return;
+    }
+    
+    DynamicJsonDocument doc(768);
+    doc["success"] = true;
+    doc["id"] = job.id;
+    doc["state"] = selfTestStateName(job.state);
+    if (job.state == SELF_TEST_DONE) {
+        doc["durationMs"] = job.durationMs;
+    }
+    
+    // Components tested so far: pass/fail and how long each took; a
+    // skipped one was not run and is not ok
+    JsonObject results = doc.createNestedObject("results");
+    for (uint8_t i = 0; i < job.completed; i++) {
+        JsonObject component = results.createNestedObject(selfTestComponentName(i));
+        component["ok"] = job.ok[i];
+        component["us"] = job.us[i];
+        if (job.skipped[i]) {
+            component["skipped"] = true;
+        }
+    }
     
     String response;
     serializeJson(doc, response);
@@ -356,6 +983,15 @@ void handleSelfTest() {
 }
 
 // ================== Utility Functions ==================
+// Stable name of this gate for the server, unlike its DHCP address
+String deviceId() {
+    static String id;
+    if (id.isEmpty()) {
+        id = WiFi.macAddress();
+    }
+    return id;
+}
+
 String getDeviceIP() {
     return WiFi.localIP().toString();
 }
@@ -364,30 +1000,48 @@ long getWiFiRSSI() {
     return WiFi.RSSI();
 }
 
+// Pulls the users changed since the revision this device holds; the server
+// answers with everything when that revision is too old
 void syncUsersWithServer() {
     Serial.println("Syncing users with server...");
     
-    RPCResponse response = getUsersFromServer();
-    if (!response.success) {
-        Serial.println("Failed to sync users: " + response.error);
+    if (!checkWiFiConnection()) {
+        Serial.println("Failed to sync users: WiFi not connected");
         return;
     }
     
-    if (response.data.containsKey("users")) {
-        JsonArray users = response.data["users"];
-        Serial.println("Received " + String(users.size()) + " users from server");
-        
-        // This would typically update the local user database
-        // For now, just log the received data
-        for (JsonVariant user : users) {
-            String uid = user["uid"].as<String>();
-            String name = user["name"].as<String>();
-            long credit = user["credit"].as<long>();
-            Serial.println("Server user: " + name + " (" + uid + ") - Credit: " + String(credit));
-        }
+    unsigned long startUs;
+    String endpoint = "/api/database/users?since=" + String(getUserSyncRevision());
+    int httpCode = sendRPC(endpoint, "GET", nullptr, 0, nullptr, startUs);
+    if (httpCode != 200) {
+        Serial.println("Failed to sync users: " + (httpCode > 0 ? "HTTP " + String(httpCode) : httpClient.errorToString(httpCode)));
+        endRPC(false, startUs);
+        return;
     }
     
-    Serial.println("User sync completed");
+    // Bodies left unread close the connection rather than confuse the next
+    // request on it
+    SyncParserStream parserStream;
+    if (!beginStreamedSync(syncFormatOf(httpClient.header("Content-Type")))) {
+        endRPC(false, startUs);
+        Serial.println("User sync skipped - a pushed sync is in progress");
+        return;
+    }
+    int received = httpClient.writeToStream(&parserStream);
+    endRPC(received >= 0, startUs);
+    if (received < 0) {
+        abortStreamedSync();
+        Serial.println("Failed to sync users: " + httpClient.errorToString(received));
+        return;
+    }
+    
+    int code = endStreamedSync();
+    if (code == 200) {
+        Serial.printf("User sync completed: %lu records, %d bytes, revision %lu\n",
+                      (unsigned long)syncParser.userCount(), received, (unsigned long)getUserSyncRevision());
+    } else {
+        Serial.printf("User sync failed (%d): %s\n", code, syncParser.errorString());
+    }
 }
 
 void sendHeartbeat() {
@@ -7,12 +7,23 @@
 #include <WebServer.h>
 #include <ArduinoJson.h>
 #include <vector>
+#include "carduid.h"
 
 // ================== Network Configuration ==================
 extern const char* WIFI_SSID;
 extern const char* WIFI_PASS;
 extern const char* SERVER_HOST;
 extern const int SERVER_PORT;
+#define WIFI_CONNECT_TIMEOUT_MS  15000   // Per attempt
+#define WIFI_RETRY_BASE_MS       5000    // Backoff after the first failed attempt
+#define WIFI_RETRY_MAX_MS        300000
+#define MSGPACK_CONTENT_TYPE "application/msgpack"  // Alternative to JSON for RPC and sync bodies
+
+// RPCs and the user sync share one kept-alive connection to the server.
+// One left idle longer than RPC_KEEPALIVE_IDLE_MS is reopened instead of
+// reused; keep it below the server's keep-alive timeout (65 s, server.js).
+#define RPC_TIMEOUT_MS           5000
+#define RPC_KEEPALIVE_IDLE_MS    55000
 
 // ================== Server Objects ==================
 extern WebServer server;
@@ -27,44 +38,71 @@ extern long lastHeartbeat;
 // ================== RPC Response Structure ==================
 struct RPCResponse {
     bool success;
+    int status;     // HTTP status, HTTPClient error (< 0) or 0 if never sent
     String error;
     DynamicJsonDocument data;
     
-    RPCResponse() : success(false), data(1024) {}
+    RPCResponse() : success(false), status(0), data(1024) {}
+};
+
+// Totals since boot for the pooled server connection. Round trips are
+// from sending a request to having read the whole answer.
+struct RPCConnectionStats {
+    uint32_t connects;       // TCP connections opened
+    uint32_t requests;
+    uint32_t reused;         // Requests sent over an already open connection
+    uint32_t staleRetries;   // Reused connection found closed, resent on a new one
+    uint32_t avgNewRttUs;    // Requests that had to connect first
+    uint32_t avgReusedRttUs;
 };
 
 // ================== Network Functions ==================
 bool initializeNetwork();
 void connectWiFi();
+void maintainWiFi();
 bool checkWiFiConnection();
 void setupWebServer();
 void startWebServer();
 void handleWebRequests();
 void handleWebServerRequests();
 void syncUsersWithServer();
+void requestUserSync();
+void maintainNetwork();
+
+struct NetworkJob;
 
 // ================== RPC Communication Functions ==================
 RPCResponse sendRPCRequest(const String& endpoint, const String& method = "GET", const String& payload = "");
+RPCResponse sendRPCRequest(const String& endpoint, const String& method, const JsonDocument& payload);
 RPCResponse getUsersFromServer();
-RPCResponse sendUserToServer(const String& uid, const String& name, long credit);
-RPCResponse updateUserOnServer(const String& uid, const String& name, long credit, bool in);
-RPCResponse notifyNewUID(const String& uid, bool isNew);
+RPCResponse sendUserToServer(const CardUID& uid, const String& name, long credit);
+RPCResponse updateUserOnServer(const CardUID& uid, const String& name, long credit, bool in,
+                               const char* timestamp, uint32_t seq = 0);
+RPCResponse updateUsersOnServer(const NetworkJob* updates, size_t count);
+RPCResponse notifyNewUID(const CardUID& uid, bool isNew);
 RPCResponse syncTimeWithServer();
 RPCResponse notifyServerEvent(const String& event, const String& details);
+RPCConnectionStats getRPCConnectionStats();
 void sendAdminAlert(const String& event, const String& uid, const String& userName, long credit, const String& reason);
 
 // ================== Server Response Handlers ==================
 void handleInfo();
 void handleState();
+void handleUsersExport();
+void handleUsersQuery();
+void handleUserDigest();
 void handleOpen();
 void handleLED();
 void handleInputMode();
 void handleTimeSync();
 void handleDatabaseSync();
+void handleDatabaseSyncBody();
 void handleLastInput();
+void handleSelfTestStart();
 void handleSelfTest();
 
 // ================== Utility Functions ==================
+String deviceId();
 String getDeviceIP();
 long getWiFiRSSI();
 void sendHeartbeat();
@@ -0,0 +1,240 @@
+#include "outbox.h"
+#include <esp_rom_crc.h>
+#include "journal.h"
+
+// ================== Outbox State ==================
+static File outboxFile;
+static bool outboxReady = false;
+static size_t outboxBytes = 0;      // File size, sent entries included
+static size_t readOffset = 0;       // First entry not yet taken by the server
+static uint32_t pendingCount = 0;
+static uint32_t dropCount = 0;
+static uint32_t seqNext = 1;
+static uint32_t seqReserved = 0;    // Highest number recorded in OUTBOX_SEQ_PATH
+static uint32_t seqEpoch = 0;       // Numbering the server keeps apart, see outbox.h
+
+struct OutboxSeqRecord {
+    uint32_t epoch;
+    uint32_t reserved;
+    uint32_t crc32;       // Over the fields above
+};
+
+static uint32_t seqRecordCRC(const OutboxSeqRecord& record) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(OutboxSeqRecord, crc32));
+}
+
+static uint32_t entryCRC(const OutboxEntry& entry) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&entry, offsetof(OutboxEntry, crc32));
+}
+
+static bool openOutboxForAppend() {
+    outboxFile = LittleFS.open(OUTBOX_PATH, FILE_APPEND);
+    if (!outboxFile) {
+        Serial.println("Failed to open outbox for append");
+        return false;
+    }
+    outboxBytes = outboxFile.size();
+    return true;
+}
+
+// Numbers handed out survive a reboot without a flash write per update:
+// after one, numbering resumes past the whole reserved block
+static bool reserveSeqBlock() {
+    OutboxSeqRecord record;
+    record.epoch = seqEpoch;
+    record.reserved = (seqReserved > seqNext - 1 ? seqReserved : seqNext - 1) + OUTBOX_SEQ_BLOCK;
+    record.crc32 = seqRecordCRC(record);
+    
+    File file = LittleFS.open(OUTBOX_SEQ_PATH, FILE_WRITE);
+    if (!file || file.write((const uint8_t*)&record, sizeof(record)) != sizeof(record)) {
+        if (file) file.close();
+        Serial.println("Failed to record outbox sequence block");
+        return false;
+    }
+    file.close();
+    seqReserved = record.reserved;
+    return true;
+}
+
+// Without a readable record (new or reformatted file system, older
+// firmware) numbering starts again from 1 in a new random epoch, so the
+// server does not take the new numbers for repeats of the old ones
+static void loadSeqBlock() {
+    OutboxSeqRecord record;
+    File file = LittleFS.open(OUTBOX_SEQ_PATH, FILE_READ);
+    if (file && file.read((uint8_t*)&record, sizeof(record)) == sizeof(record) &&
+        record.crc32 == seqRecordCRC(record) && record.epoch != 0) {
+        seqEpoch = record.epoch;
+        seqReserved = record.reserved;
+    } else {
+        do {
+            seqEpoch = esp_random();
+        } while (seqEpoch == 0);
+        seqReserved = 0;
+        Serial.printf("Outbox sequence numbering starts in epoch %08lx\n", (unsigned long)seqEpoch);
+    }
+    if (file) file.close();
+    seqNext = seqReserved + 1;
+}
+
+// Counts the entries and keeps only the valid prefix if the last append
+// was torn by a power loss
+static bool scanOutbox() {
+    File file = LittleFS.open(OUTBOX_PATH, FILE_READ);
+    if (!file) return true; // Nothing waiting
+    
+    OutboxEntry entry;
+    size_t valid = 0;
+    bool damaged = false;
+    while (file.available()) {
+        if (file.read((uint8_t*)&entry, sizeof(entry)) != sizeof(entry) || entry.crc32 != entryCRC(entry)) {
+            damaged = true;
+            break;
+        }
+        if (entry.seq >= seqNext) seqNext = entry.seq + 1;
+        valid++;
+    }
+    
+    if (damaged) {
+        Serial.printf("Outbox tail damaged - keeping %u entries\n", (unsigned)valid);
+        File copy = LittleFS.open(OUTBOX_PATH ".tmp", FILE_WRITE);
+        file.seek(0);
+        for (size_t i = 0; copy && i < valid; i++) {
+            file.read((uint8_t*)&entry, sizeof(entry));
+            copy.write((const uint8_t*)&entry, sizeof(entry));
+        }
+        if (copy) copy.close();
+        file.close();
+        LittleFS.remove(OUTBOX_PATH);
+        if (!LittleFS.rename(OUTBOX_PATH ".tmp", OUTBOX_PATH)) return false;
+    } else {
+        file.close();
+    }
+    
+    pendingCount = valid;
+    return true;
+}
+
+// ================== Outbox Functions ==================
+// After initializeJournal(), which mounts LittleFS
+bool initializeOutbox() {
+    if (!isJournalReady()) {
+        Serial.println("Outbox disabled - LittleFS not mounted");
+        return false;
+    }
+    
+    loadSeqBlock();
+    outboxReady = scanOutbox() && openOutboxForAppend();
+    if (outboxReady) {
+        Serial.printf("Outbox ready (%lu updates waiting, next sequence %lu)\n",
+                      (unsigned long)pendingCount, (unsigned long)seqNext);
+    }
+    return outboxReady;
+}
+
+// 0 (unnumbered, never skipped by the server) without flash to keep the
+// count in: a number not recorded there would be handed out again after
+// a reboot, and the server would skip that update as a repeat
+uint32_t nextUpdateSeq() {
+    if (!outboxReady) return 0;
+    if (seqNext > seqReserved && !reserveSeqBlock()) return 0;
+    return seqNext++;
+}
+
+uint32_t getUpdateEpoch() {
+    return seqEpoch;
+}
+
+bool outboxAppend(const NetworkJob& job) {
+    if (!outboxReady || outboxBytes + sizeof(OutboxEntry) > OUTBOX_MAX_BYTES) {
+        dropCount++;
+        return false;
+    }
+    
+    OutboxEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.seq = job.seq;
+    entry.uidSize = job.uid.size;
+    memcpy(entry.uid, job.uid.bytes, sizeof(entry.uid));
+    entry.in = job.in ? 1 : 0;
+    entry.credit = job.credit;
+    memcpy(entry.name, job.name, sizeof(entry.name));
+    memcpy(entry.timestamp, job.timestamp, sizeof(entry.timestamp));
+    entry.crc32 = entryCRC(entry);
+    
+    if (outboxFile.write((const uint8_t*)&entry, sizeof(entry)) != sizeof(entry)) {
+        Serial.println("Outbox append failed");
+        dropCount++;
+        return false;
+    }
+    outboxFile.flush();
+    outboxBytes += sizeof(entry);
+    pendingCount++;
+    return true;
+}
+
+// The oldest waiting updates, in order; they stay waiting until
+// acknowledged
+size_t outboxRead(NetworkJob* jobs, size_t max) {
+    if (!outboxReady || pendingCount == 0) return 0;
+    
+    File file = LittleFS.open(OUTBOX_PATH, FILE_READ);
+    if (!file || !file.seek(readOffset)) {
+        if (file) file.close();
+        return 0;
+    }
+    
+    size_t count = 0;
+    OutboxEntry entry;
+    while (count < max && count < pendingCount &&
+           file.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)) {
+        NetworkJob& job = jobs[count++];
+        job.type = JOB_USER_UPDATE;
+        job.uid = CardUID(entry.uid, entry.uidSize);
+        memcpy(job.name, entry.name, sizeof(job.name));
+        job.name[sizeof(job.name) - 1] = '\0';
+        job.credit = entry.credit;
+        job.in = entry.in != 0;
+        job.isNew = false;
+        memcpy(job.timestamp, entry.timestamp, sizeof(job.timestamp));
+        job.timestamp[sizeof(job.timestamp) - 1] = '\0';
+        job.queuedAtMs = millis();
+        job.seq = entry.seq;
+    }
+    file.close();
+    return count;
+}
+
+// Drops the oldest count updates. The position is kept in RAM only: after
+// a reboot the outbox is replayed from the start and the server skips what
+// it already has by sequence number.
+void outboxAcknowledge(size_t count) {
+    if (count > pendingCount) count = pendingCount;
+    readOffset += count * sizeof(OutboxEntry);
+    pendingCount -= count;
+    
+    if (pendingCount == 0 && outboxBytes > 0) {
+        outboxFile.close();
+        LittleFS.remove(OUTBOX_PATH);
+        readOffset = 0;
+        outboxReady = openOutboxForAppend();
+        Serial.println("Outbox drained");
+    }
+}
+
+// ================== Outbox Statistics ==================
+uint32_t getOutboxPending() {
+    return pendingCount;
+}
+
+size_t getOutboxBytes() {
+    return outboxBytes;
+}
+
+uint32_t getOutboxDropCount() {
+    return dropCount;
+}
+
+bool isOutboxReady() {
+    return outboxReady;
+}
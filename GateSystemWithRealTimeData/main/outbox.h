@@ -0,0 +1,50 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "tasks.h"
+
+// ================== Outbox Configuration ==================
+// User updates the server could not take (WiFi down, server failing) are
+// appended to an outbox file on the LittleFS data partition and replayed
+// in order once it answers again, so no IN/OUT transition or deduction is
+// lost to an outage or a reboot. While entries are waiting, newer updates
+// queue behind them. Every update carries a sequence number the server
+// remembers per device, so an update sent twice (a reply lost, a reboot
+// during replay) is applied once. The numbers belong to a random epoch kept
+// with them in OUTBOX_SEQ_PATH; if that file is lost (LittleFS formatted,
+// partition table changed) numbering restarts in a new epoch, which the
+// server tracks separately. Only the network task uses the outbox.
+#define OUTBOX_PATH                "/outbox.bin"
+#define OUTBOX_SEQ_PATH            "/outbox.seq"
+#define OUTBOX_MAX_BYTES           (128 * 1024)  // About 1,500 updates
+#define OUTBOX_SEQ_BLOCK           256           // Sequence numbers reserved per flash write
+#define OUTBOX_REPLAY_INTERVAL_MS  500           // Between replayed batches
+
+struct OutboxEntry {
+    uint32_t seq;
+    uint8_t uidSize;
+    uint8_t uid[UID_MAX_BYTES];
+    uint8_t in;
+    int32_t credit;
+    char name[USER_NAME_MAX];
+    char timestamp[25];
+    uint32_t crc32;       // Over the fields above, detects torn writes
+};
+
+// ================== Outbox Functions ==================
+bool initializeOutbox();
+uint32_t nextUpdateSeq();
+uint32_t getUpdateEpoch();
+bool outboxAppend(const NetworkJob& job);
+size_t outboxRead(NetworkJob* jobs, size_t max);
+void outboxAcknowledge(size_t count);
+
+// ================== Outbox Statistics ==================
+uint32_t getOutboxPending();
+size_t getOutboxBytes();
+uint32_t getOutboxDropCount();
+bool isOutboxReady();
+
+#endif // OUTBOX_H
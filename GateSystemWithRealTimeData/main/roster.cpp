@@ -0,0 +1,615 @@
+#include "roster.h"
+#include <algorithm>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <LittleFS.h>
+#include "network.h"
+
+// ================== Roster State ==================
+struct RosterOverlayEntry {
+    uint32_t index;              // Record position in the image
+    int32_t credit;
+    uint8_t in;
+    uint8_t reserved[3];
+};
+
+struct RosterOverlayHeader {
+    uint32_t generation;         // Image the overlay belongs to
+    uint32_t count;
+    uint32_t crc32;              // Over the entries that follow
+};
+
+// A published image in one half of the partition. The overlay belongs to
+// the image and is only read and changed under the user table lock.
+struct RosterImage {
+    const RosterHeader* header;
+    const RosterEntry* entries;               // In the order they were sent
+    const uint32_t* order;                    // Record positions sorted by UID
+    uint32_t count;
+    uint8_t half;
+    UidFilter filter;                         // Attached to the mapped buckets
+    std::vector<RosterOverlayEntry> overlay;  // Sorted by index
+};
+typedef std::shared_ptr<RosterImage> RosterImagePtr;
+
+static const esp_partition_t* rosterPartition = nullptr;
+static esp_partition_mmap_handle_t rosterMapHandle;
+static const uint8_t* rosterMapped = nullptr;
+static size_t rosterHalfSize = 0;
+
+// Only accessed through std::atomic_load/std::atomic_store
+static RosterImagePtr activeImage;
+static RosterImagePtr retiredImage;      // Previous image, until its half is rewritten
+static bool overlayDirty = false;
+
+// Image being streamed into the inactive half
+#define ROSTER_WRITE_BATCH  32                // Records staged per flash write
+#define ROSTER_RETIRE_WAIT_MS  2000           // For readers of the image in the target half
+
+struct RosterBuild {
+    bool active;
+    bool failed;
+    uint8_t half;
+    size_t offset;                            // Of the half in the partition
+    size_t erased;                            // Bytes of the half erased so far
+    uint32_t written;                         // Records in flash
+    uint32_t crc;                             // Over the records in flash
+    unsigned long start;
+    std::vector<RosterEntry> batch;
+};
+static RosterBuild build = {};
+
+// ================== Image Helpers ==================
+static uint32_t rosterHeaderCRC(const RosterHeader& header) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&header, offsetof(RosterHeader, crc32));
+}
+
+static int compareKey(const uint8_t* uid, uint8_t uidSize, const RosterEntry& entry) {
+    int result = memcmp(uid, entry.uid, UID_MAX_BYTES);
+    if (result != 0) return result;
+    return (int)uidSize - (int)entry.uidSize;
+}
+
+// Image in one half of the mapped partition, or nullptr if that half has
+// none. Only the header is checked so boot stays O(1) in roster size.
+static RosterImagePtr openImage(uint8_t half) {
+    const RosterHeader* header = (const RosterHeader*)(rosterMapped + half * rosterHalfSize);
+    if (header->magic != ROSTER_MAGIC || header->crc32 != rosterHeaderCRC(*header) ||
+        header->version != ROSTER_VERSION || header->entrySize != sizeof(RosterEntry) ||
+        header->count > header->entryCount ||
+        sizeof(RosterHeader) + (size_t)header->entryCount * sizeof(RosterEntry) > header->orderOffset ||
+        header->orderOffset % 4 != 0 ||
+        header->orderOffset + (size_t)header->count * sizeof(uint32_t) > header->filterOffset ||
+        header->filterOffset % 4 != 0 ||
+        header->filterOffset + (size_t)header->filterBuckets * UID_FILTER_BUCKET_SLOTS * sizeof(uint16_t) > rosterHalfSize) {
+        return nullptr;
+    }
+    
+    RosterImagePtr image = std::make_shared<RosterImage>();
+    image->header = header;
+    image->entries = (const RosterEntry*)(header + 1);
+    image->order = (const uint32_t*)((const uint8_t*)header + header->orderOffset);
+    image->count = header->count;
+    image->half = half;
+    image->filter.attach((const uint16_t*)((const uint8_t*)header + header->filterOffset), header->filterBuckets, header->count);
+    return image;
+}
+
+// Record position of `uid` in the image, or -1
+static int32_t findEntry(const RosterImage& image, const CardUID& uid) {
+    uint8_t key[UID_MAX_BYTES];
+    memcpy(key, uid.bytes, sizeof(key));
+    
+    uint32_t low = 0, high = image.count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int order = compareKey(key, uid.size, image.entries[image.order[mid]]);
+        if (order == 0) return image.order[mid];
+        if (order < 0) high = mid;
+        else low = mid + 1;
+    }
+    return -1;
+}
+
+static std::vector<RosterOverlayEntry>::iterator findOverlay(RosterImage& image, uint32_t index) {
+    return std::lower_bound(image.overlay.begin(), image.overlay.end(), index,
+                            [](const RosterOverlayEntry& entry, uint32_t i) { return entry.index < i; });
+}
+
+// Caller holds the user table lock
+static void fillUser(RosterImage& image, uint32_t index, User& out) {
+    // makeRosterEntry keeps the last name byte NUL, so the name is used in place
+    const RosterEntry& entry = image.entries[index];
+    out = User(CardUID(entry.uid, entry.uidSize), entry.name, entry.credit, entry.in != 0, USER_ROSTER);
+    out.dirty = 0;
+    
+    auto it = findOverlay(image, index);
+    if (it != image.overlay.end() && it->index == index) {
+        out.credit = it->credit;
+        out.in = it->in != 0;
+    }
+}
+
+// ================== Overlay Persistence ==================
+static uint32_t overlayCRC(const RosterOverlayEntry* entries, uint32_t count) {
+    return esp_rom_crc32_le(0, (const uint8_t*)entries, count * sizeof(RosterOverlayEntry));
+}
+
+// Older firmware kept the overlay as a blob in NVS; it is read once and
+// removed after the first save to the file
+static bool loadLegacyRosterOverlay(RosterImage& image) {
+    size_t length = userPrefs.getBytesLength("roster_ovl");
+    if (length < 2 * sizeof(uint32_t)) return false;
+    
+    std::vector<uint8_t> blob(length);
+    userPrefs.getBytes("roster_ovl", blob.data(), length);
+    uint32_t generation, count;
+    memcpy(&generation, blob.data(), sizeof(generation));
+    memcpy(&count, blob.data() + sizeof(generation), sizeof(count));
+    size_t offset = 2 * sizeof(uint32_t);
+    if (generation != image.header->generation || length != offset + count * sizeof(RosterOverlayEntry)) {
+        return false;
+    }
+    image.overlay.resize(count);
+    memcpy(image.overlay.data(), blob.data() + offset, count * sizeof(RosterOverlayEntry));
+    overlayDirty = true;
+    return true;
+}
+
+// After LittleFS is mounted (initializeJournal)
+static void loadRosterOverlay(RosterImage& image) {
+    overlayDirty = false;
+    
+    File file = LittleFS.open(ROSTER_OVERLAY_PATH, FILE_READ);
+    if (!file) {
+        loadLegacyRosterOverlay(image);
+        return;
+    }
+    
+    RosterOverlayHeader header;
+    bool valid = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                 header.generation == image.header->generation &&
+                 header.count <= ROSTER_OVERLAY_MAX &&
+                 file.size() == sizeof(header) + header.count * sizeof(RosterOverlayEntry);
+    if (valid) {
+        image.overlay.resize(header.count);
+        size_t bytes = header.count * sizeof(RosterOverlayEntry);
+        valid = file.read((uint8_t*)image.overlay.data(), bytes) == bytes &&
+                overlayCRC(image.overlay.data(), header.count) == header.crc32;
+    }
+    file.close();
+    if (!valid) {
+        image.overlay.clear();
+        Serial.println("Discarding roster overlay of an older image");
+    }
+}
+
+// The file is put together under the table lock and written without it;
+// a scan during the write marks the overlay dirty again. It is written
+// beside the old one and renamed over it, so a power loss keeps one of
+// the two complete.
+bool saveRosterOverlay() {
+    if (!overlayDirty) return true;
+    
+    lockUserStore();
+    lockUserTable();
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    std::vector<RosterOverlayEntry> overlay;
+    if (image) {
+        overlay = image->overlay;
+    }
+    overlayDirty = false;
+    unlockUserTable();
+    
+    // Past the cap the overlay is saved in part, see roster.h
+    static bool overflowReported = false;
+    if (overlay.size() > ROSTER_OVERLAY_MAX) {
+        if (!overflowReported) {
+            Serial.printf("Roster overlay of %u users is past the %u saved - requesting a sync\n",
+                          (unsigned)overlay.size(), (unsigned)ROSTER_OVERLAY_MAX);
+            overflowReported = true;
+        }
+        overlay.resize(ROSTER_OVERLAY_MAX);
+        requestUserSync();
+    } else {
+        overflowReported = false;
+    }
+    
+    RosterOverlayHeader header;
+    header.generation = image ? image->header->generation : 0;
+    header.count = overlay.size();
+    header.crc32 = overlayCRC(overlay.data(), header.count);
+    size_t bytes = overlay.size() * sizeof(RosterOverlayEntry);
+    
+    File file = LittleFS.open(ROSTER_OVERLAY_TEMP_PATH, FILE_WRITE);
+    bool ok = file && file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t*)overlay.data(), bytes) == bytes;
+    if (file) file.close();
+    ok = ok && LittleFS.rename(ROSTER_OVERLAY_TEMP_PATH, ROSTER_OVERLAY_PATH);
+    if (ok) {
+        if (userPrefs.isKey("roster_ovl")) userPrefs.remove("roster_ovl");
+    } else {
+        LittleFS.remove(ROSTER_OVERLAY_TEMP_PATH);
+        lockUserTable();
+        overlayDirty = true;
+        unlockUserTable();
+        Serial.println("Failed to save roster overlay");
+    }
+    unlockUserStore();
+    return ok;
+}
+
+bool isRosterOverlayDirty() {
+    return overlayDirty;
+}
+
+size_t getRosterOverlaySize() {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    return image ? image->overlay.size() : 0;
+}
+
+// ================== Roster Functions ==================
+bool initializeRoster() {
+    rosterPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                               ROSTER_PARTITION_LABEL);
+    if (!rosterPartition) {
+        Serial.println("No roster partition - using NVS user table");
+        return false;
+    }
+    
+    // Mapped once for good: flash writes invalidate the cache for the
+    // range they touch, so the rewritten half reads back correctly
+    const void* mapped = nullptr;
+    if (esp_partition_mmap(rosterPartition, 0, rosterPartition->size, ESP_PARTITION_MMAP_DATA,
+                           &mapped, &rosterMapHandle) != ESP_OK) {
+        Serial.println("Failed to map roster partition");
+        rosterPartition = nullptr;
+        return false;
+    }
+    rosterMapped = (const uint8_t*)mapped;
+    rosterHalfSize = (rosterPartition->size / 2) & ~(size_t)4095;
+    
+    // The newer of the two halves is live, the other one is the fallback
+    // for an interrupted image write
+    RosterImagePtr first = openImage(0);
+    RosterImagePtr second = openImage(1);
+    RosterImagePtr image = first;
+    if (second && (!first || (int32_t)(second->header->generation - first->header->generation) > 0)) {
+        image = second;
+    }
+    
+    if (image) {
+        loadRosterOverlay(*image);
+    }
+    std::atomic_store(&activeImage, image);
+    Serial.printf("Roster partition mapped: %lu users, %u overlay entries\n",
+                  (unsigned long)getRosterUserCount(), (unsigned)getRosterOverlaySize());
+    return true;
+}
+
+bool isRosterAvailable() {
+    return rosterPartition != nullptr;
+}
+
+void makeRosterEntry(const CardUID& uid, const String& name, long credit, bool in, RosterEntry& entry) {
+    memset(&entry, 0, sizeof(entry));
+    entry.uidSize = uid.size;
+    memcpy(entry.uid, uid.bytes, sizeof(entry.uid));
+    entry.in = in ? 1 : 0;
+    entry.credit = credit;
+    
+    // Truncate long names on a UTF-8 character boundary
+    size_t len = name.length();
+    if (len > ROSTER_NAME_MAX - 1) {
+        len = ROSTER_NAME_MAX - 1;
+        while (len > 0 && (name[len] & 0xC0) == 0x80) len--;
+    }
+    memcpy(entry.name, name.c_str(), len);
+}
+
+// ================== Roster Image Builder ==================
+// Erases the target half up to `end` a sector at a time, just ahead of the
+// writes, so a sync does not stall on erasing the whole half up front
+static bool eraseBuildThrough(size_t end) {
+    size_t wanted = (end + 4095) & ~(size_t)4095;
+    if (wanted <= build.erased) return true;
+    if (esp_partition_erase_range(rosterPartition, build.offset + build.erased, wanted - build.erased) != ESP_OK) {
+        return false;
+    }
+    build.erased = wanted;
+    return true;
+}
+
+static bool flushBuildBatch() {
+    if (build.batch.empty()) return true;
+    
+    size_t position = sizeof(RosterHeader) + (size_t)build.written * sizeof(RosterEntry);
+    size_t bytes = build.batch.size() * sizeof(RosterEntry);
+    if (position + bytes > rosterHalfSize) {
+        Serial.printf("Roster of more than %lu users does not fit the roster partition\n", (unsigned long)build.written);
+        return false;
+    }
+    if (!eraseBuildThrough(position + bytes) ||
+        esp_partition_write(rosterPartition, build.offset + position, build.batch.data(), bytes) != ESP_OK) {
+        Serial.println("Roster image write failed");
+        return false;
+    }
+    build.crc = esp_rom_crc32_le(build.crc, (const uint8_t*)build.batch.data(), bytes);
+    build.written += build.batch.size();
+    build.batch.clear();
+    return true;
+}
+
+bool beginRosterImage() {
+    if (!rosterPartition) return false;
+    abortRosterImage();
+    
+    // The image previously published from the target half may still be in
+    // use by a scan that looked it up before the last swap, or by a slow
+    // client paging through /api/users. The sync fails rather than waiting
+    // on that client, and the next one tries again.
+    unsigned long waitStart = millis();
+    while (retiredImage && retiredImage.use_count() > 1) {
+        if (millis() - waitStart >= ROSTER_RETIRE_WAIT_MS) {
+            Serial.println("Previous roster image still in use - sync postponed");
+            return false;
+        }
+        delay(1);
+    }
+    retiredImage.reset();
+    
+    RosterImagePtr current = std::atomic_load(&activeImage);
+    build.active = true;
+    build.failed = false;
+    build.half = current ? 1 - current->half : 0;
+    build.offset = build.half * rosterHalfSize;
+    build.erased = 0;
+    build.written = 0;
+    build.crc = 0;
+    build.start = millis();
+    build.batch.reserve(ROSTER_WRITE_BATCH);
+    return true;
+}
+
+bool addRosterEntry(const RosterEntry& entry) {
+    if (!build.active || build.failed) return false;
+    
+    build.batch.push_back(entry);
+    if (build.batch.size() >= ROSTER_WRITE_BATCH && !flushBuildBatch()) {
+        build.failed = true;
+    }
+    return !build.failed;
+}
+
+void abortRosterImage() {
+    // The half has no header yet, so boot never picks the partial image
+    build.active = false;
+    build.batch.clear();
+    build.batch.shrink_to_fit();
+}
+
+// Sorts the streamed records by UID through a position table, adds the
+// filter and writes the header last, so an interrupted write leaves the
+// old image live. Publishes the new image with a pointer swap.
+bool finishRosterImage(const std::vector<CardUID>& scanned) {
+    if (!build.active) return false;
+    if (build.failed || !flushBuildBatch()) {
+        abortRosterImage();
+        return false;
+    }
+    build.active = false;
+    build.batch.shrink_to_fit();
+    
+    // Flash writes invalidate the cache for the range they touch, so the
+    // records read back through the mapping
+    const RosterEntry* entries = (const RosterEntry*)(rosterMapped + build.offset + sizeof(RosterHeader));
+    std::vector<uint32_t> order(build.written);
+    for (uint32_t i = 0; i < build.written; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [entries](uint32_t a, uint32_t b) {
+        int result = compareKey(entries[a].uid, entries[a].uidSize, entries[b]);
+        return result != 0 ? result < 0 : a < b;
+    });
+    order.erase(std::unique(order.begin(), order.end(), [entries](uint32_t a, uint32_t b) {
+        return compareKey(entries[a].uid, entries[a].uidSize, entries[b]) == 0;
+    }), order.end());
+    
+    // A failed cuckoo insert means the filter is too full - retry bigger
+    UidFilter filter;
+    for (size_t reserve = order.size() + 1; ; reserve *= 2) {
+        filter.reserve(reserve);
+        bool complete = true;
+        for (size_t i = 0; i < order.size() && complete; i++) {
+            const RosterEntry& entry = entries[order[i]];
+            complete = filter.insert(CardUID(entry.uid, entry.uidSize));
+        }
+        if (complete) break;
+    }
+    
+    size_t entriesSize = (size_t)build.written * sizeof(RosterEntry);
+    size_t orderOffset = (sizeof(RosterHeader) + entriesSize + 3) & ~(size_t)3;
+    size_t orderSize = order.size() * sizeof(uint32_t);
+    size_t filterOffset = orderOffset + orderSize;
+    size_t imageSize = filterOffset + filter.memoryBytes();
+    if (imageSize > rosterHalfSize) {
+        Serial.printf("Roster of %u users does not fit the roster partition\n", (unsigned)order.size());
+        return false;
+    }
+    
+    RosterHeader header;
+    header.magic = ROSTER_MAGIC;
+    header.version = ROSTER_VERSION;
+    header.entrySize = sizeof(RosterEntry);
+    header.count = order.size();
+    header.entryCount = build.written;
+    RosterImagePtr current = std::atomic_load(&activeImage);
+    header.generation = current ? current->header->generation + 1 : 1;
+    header.orderOffset = orderOffset;
+    header.filterOffset = filterOffset;
+    header.filterBuckets = filter.bucketCount();
+    header.entriesCrc32 = esp_rom_crc32_le(esp_rom_crc32_le(build.crc, (const uint8_t*)order.data(), orderSize),
+                                           (const uint8_t*)filter.data(), filter.memoryBytes());
+    header.crc32 = rosterHeaderCRC(header);
+    
+    size_t offset = build.offset;
+    bool ok = eraseBuildThrough(imageSize) &&
+              esp_partition_write(rosterPartition, offset + orderOffset, order.data(), orderSize) == ESP_OK &&
+              esp_partition_write(rosterPartition, offset + filterOffset, filter.data(),
+                                  filter.memoryBytes()) == ESP_OK &&
+              esp_partition_write(rosterPartition, offset, &header, sizeof(header)) == ESP_OK;
+    
+    RosterImagePtr image = ok ? openImage(build.half) : nullptr;
+    if (!image || image->count != order.size() ||
+        esp_rom_crc32_le(esp_rom_crc32_le(esp_rom_crc32_le(0, (const uint8_t*)image->entries, entriesSize),
+                                          (const uint8_t*)image->order, orderSize),
+                         (const uint8_t*)image->filter.data(), filter.memoryBytes()) != header.entriesCrc32) {
+        Serial.println("Roster image write failed");
+        return false;
+    }
+    
+    // The new image carries the server's credit/in values, so it starts
+    // with an empty overlay. Users scanned while it was built keep their
+    // live state instead, from the user table or the old image.
+    lockUserStore();
+    lockUserTable();
+    UserTablePtr table = acquireUserTable();
+    std::vector<User> carried;
+    for (const CardUID& uid : scanned) {
+        const User* tableUser = table->find(uid);
+        int32_t index = !tableUser && current ? findEntry(*current, uid) : -1;
+        if (tableUser) {
+            carried.push_back(*tableUser);
+        } else if (index >= 0) {
+            carried.emplace_back();
+            fillUser(*current, index, carried.back());
+        }
+    }
+    std::atomic_store(&activeImage, image);
+    for (const User& user : carried) {
+        setRosterUserState(user);
+    }
+    retiredImage = current;
+    overlayDirty = true;
+    unlockUserTable();
+    saveRosterOverlay();
+    unlockUserStore();
+    
+    Serial.printf("Roster image written: %lu users in %lu ms\n", (unsigned long)image->count, millis() - build.start);
+    return true;
+}
+
+// ================== Roster Lookup ==================
+bool rosterContains(const CardUID& uid) {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    return image && findEntry(*image, uid) >= 0;
+}
+
+// Constant-time check against the filter stored with the image
+bool rosterMayContain(const CardUID& uid) {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    return image && image->filter.mayContain(uid);
+}
+
+bool getRosterUser(const CardUID& uid, User& out, RosterHold* hold) {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    if (!image) return false;
+    
+    int32_t index = findEntry(*image, uid);
+    if (index < 0) return false;
+    lockUserTable();
+    fillUser(*image, index, out);
+    unlockUserTable();
+    if (hold) *hold = image;
+    return true;
+}
+
+// Users in UID order
+bool getRosterUserAt(uint32_t index, User& out, RosterHold* hold) {
+    return getRosterUsersAt(index, &out, 1, hold) == 1;
+}
+
+// Up to `count` users in UID order from `index`, under one table lock;
+// fewer means the end was reached
+uint32_t getRosterUsersAt(uint32_t index, User* out, uint32_t count, RosterHold* hold) {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    if (!image || index >= image->count) return 0;
+    
+    count = std::min(count, image->count - index);
+    lockUserTable();
+    for (uint32_t i = 0; i < count; i++) {
+        fillUser(*image, image->order[index + i], out[i]);
+    }
+    unlockUserTable();
+    if (hold) *hold = image;
+    return count;
+}
+
+uint32_t getRosterIndexAfter(const CardUID& uid) {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    if (!image) return 0;
+    
+    uint8_t key[UID_MAX_BYTES];
+    memcpy(key, uid.bytes, sizeof(key));
+    
+    uint32_t low = 0, high = image->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (compareKey(key, uid.size, image->entries[image->order[mid]]) < 0) high = mid;
+        else low = mid + 1;
+    }
+    return low;
+}
+
+uint32_t getRosterUserCount() {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    return image ? image->count : 0;
+}
+
+// Filter buckets live in the mapped partition, not in heap
+size_t getRosterFilterBytes() {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    return image ? image->filter.memoryBytes() : 0;
+}
+
+float getRosterFilterFalsePositiveRate() {
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    return image ? image->filter.falsePositiveRate() : 0.0f;
+}
+
+// ================== Roster Overlay ==================
+bool setRosterUserState(const User& user) {
+    lockUserTable();
+    RosterImagePtr image = std::atomic_load(&activeImage);
+    int32_t index = image ? findEntry(*image, user.uid) : -1;
+    if (index < 0) {
+        unlockUserTable();
+        return false;
+    }
+    
+    const RosterEntry& entry = image->entries[index];
+    auto it = findOverlay(*image, index);
+    bool present = it != image->overlay.end() && it->index == (uint32_t)index;
+    
+    if (user.credit == entry.credit && user.in == (entry.in != 0)) {
+        // Back at the provisioned values - the overlay entry is no longer needed
+        if (present) {
+            image->overlay.erase(it);
+            overlayDirty = true;
+        }
+    } else {
+        if (!present) {
+            RosterOverlayEntry added;
+            memset(&added, 0, sizeof(added));
+            added.index = index;
+            it = image->overlay.insert(it, added);
+        }
+        if (!present || it->credit != user.credit || (it->in != 0) != user.in) {
+            it->credit = user.credit;
+            it->in = user.in ? 1 : 0;
+            overlayDirty = true;
+        }
+    }
+    unlockUserTable();
+    return true;
+}
@@ -0,0 +1,103 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <Arduino.h>
+#include <vector>
+#include "users.h"
+#include "uidfilter.h"
+
+// ================== Roster Partition Format ==================
+// Centrally provisioned sites can give the roster its own flash partition
+// (see partitions_roster.csv). Server syncs then write a read-only image:
+//   RosterHeader, `entryCount` RosterEntry records in the order they were
+//   sent, `count` uint32 record positions sorted by UID, then the image's
+//   UidFilter buckets
+// into one half of the partition while the other half stays live, and
+// publish it with a pointer swap. Records are streamed to flash as a sync
+// delivers them, so building an image needs 4 bytes of RAM per user (the
+// position table) plus the filter, not a copy of the roster. The partition
+// is memory-mapped and searched in place, so the roster never sits in heap
+// and boot time does not depend on its size. Credit and presence changes
+// since the image was written live in a small RAM overlay that is persisted through the journal and the "roster_ovl" NVS blob.
+// Without a "roster" partition every sync keeps using the NVS user table.
+#define ROSTER_PARTITION_LABEL  "roster"
+#define ROSTER_MAGIC            0x52545352UL  // "RSTR"
+#define ROSTER_VERSION          3
+#define ROSTER_NAME_MAX         32            // Bytes incl. terminator, UTF-8
+
+struct RosterHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t count;              // Users, i.e. positions in the order table
+    uint32_t entryCount;         // Records written, including repeated UIDs
+    uint32_t generation;         // Bumped on every image write
+    uint32_t orderOffset;        // From the header, 4-byte aligned
+    uint32_t filterOffset;       // From the header, 4-byte aligned
+    uint32_t filterBuckets;
+    uint32_t entriesCrc32;       // Records, order table and filter, checked when written
+    uint32_t crc32;              // Over the fields above
+};
+
+struct RosterEntry {
+    uint8_t uidSize;
+    uint8_t uid[UID_MAX_BYTES];  // Zero padded, order key with uidSize
+    uint8_t in;                  // Values as provisioned, see overlay
+    int32_t credit;
+    char name[ROSTER_NAME_MAX];  // NUL padded
+};
+
+// ================== Roster Functions ==================
+bool initializeRoster();
+bool isRosterAvailable();
+void makeRosterEntry(const CardUID& uid, const String& name, long credit, bool in, RosterEntry& entry);
+
+// ================== Roster Image Builder ==================
+// beginRosterImage() claims the inactive half, addRosterEntry() streams
+// records into it and finishRosterImage() sorts, verifies and publishes the
+// image. Scans keep using the live image throughout; after an abort or a
+// failure it simply stays live. The first record sent for a UID wins, except
+// for the credit and presence of the `scanned` users (see syncscans.h).
+bool beginRosterImage();
+bool addRosterEntry(const RosterEntry& entry);
+bool finishRosterImage(const std::vector<CardUID>& scanned);
+void abortRosterImage();
+
+// ================== Roster Lookup ==================
+// Roster users point into the mapped image (User::name). Pass a hold to
+// keep that image from being rewritten while the copy is in use. Walks
+// over every user read ROSTER_READ_BATCH at a time, which takes the user
+// table lock once per batch instead of once per user.
+#define ROSTER_READ_BATCH  16
+
+typedef std::shared_ptr<const void> RosterHold;
+
+bool rosterContains(const CardUID& uid);
+bool rosterMayContain(const CardUID& uid);
+bool getRosterUser(const CardUID& uid, User& out, RosterHold* hold = nullptr);
+bool getRosterUserAt(uint32_t index, User& out, RosterHold* hold = nullptr);
+uint32_t getRosterUsersAt(uint32_t index, User* out, uint32_t count, RosterHold* hold = nullptr);
+uint32_t getRosterIndexAfter(const CardUID& uid);  // First getRosterUserAt index past `uid`
+uint32_t getRosterUserCount();
+size_t getRosterFilterBytes();
+float getRosterFilterFalsePositiveRate();
+
+// ================== Roster Overlay ==================
+// Credit and presence changes of roster users since the image was written,
+// kept until a sync brings a new one. Saved as a file on the LittleFS data
+// partition, beside the journal and the outbox, rather than in the small
+// NVS partition the user table uses. At most ROSTER_OVERLAY_MAX users are
+// saved. Past that every change still applies in RAM and goes to the server
+// through the outbox, and a sync is requested to fold them into a new
+// image. Users beyond the cap revert to their image values if the device
+// restarts before that sync.
+#define ROSTER_OVERLAY_PATH       "/roster.ovl"
+#define ROSTER_OVERLAY_TEMP_PATH  "/roster.tmp"
+#define ROSTER_OVERLAY_MAX        4096   // 48 KB of file
+
+bool setRosterUserState(const User& user);
+bool saveRosterOverlay();
+bool isRosterOverlayDirty();
+size_t getRosterOverlaySize();
+
+#endif // ROSTER_H
@@ -0,0 +1,60 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// ================== Single-Producer Single-Consumer Queue ==================
+// Bounded ring buffer between exactly one producing and one consuming task.
+// push() and pop() never block and take no lock: each side only writes its
+// own index and publishes it with release/acquire ordering, so a consumer
+// stuck in a slow HTTP call can never stall the producer. A push onto a
+// full queue fails and is counted in dropCount().
+//
+// N must be a power of two; the queue holds up to N - 1 items. Items are
+// copied, so keep T trivially copyable.
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+    
+public:
+    SpscQueue() : head(0), tail(0), drops(0) {}
+    
+    // Producer side
+    bool push(const T& item) {
+        size_t at = head.load(std::memory_order_relaxed);
+        size_t next = (at + 1) & (N - 1);
+        if (next == tail.load(std::memory_order_acquire)) {
+            drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[at] = item;
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer side
+    bool pop(T& item) {
+        size_t at = tail.load(std::memory_order_relaxed);
+        if (at == head.load(std::memory_order_acquire)) return false;
+        item = items[at];
+        tail.store((at + 1) & (N - 1), std::memory_order_release);
+        return true;
+    }
+    
+    // Either side; a snapshot that may already be stale
+    size_t size() const {
+        return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)) & (N - 1);
+    }
+    size_t capacity() const { return N - 1; }
+    uint32_t dropCount() const { return drops.load(std::memory_order_relaxed); }
+    
+private:
+    T items[N];
+    std::atomic<size_t> head;      // Next slot to write, owned by the producer
+    std::atomic<size_t> tail;      // Next slot to read, owned by the consumer
+    std::atomic<uint32_t> drops;
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,603 @@
+#include "syncparser.h"
+#include <string.h>
+#include <stdlib.h>
+
+// ================== Token Helpers ==================
+static int hexDigit(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool isLiteralChar(uint8_t c) {
+    return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '-' || c == '+' || c == '.';
+}
+
+// JSON number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool isNumber(const char* s) {
+    if (*s == '-') s++;
+    if (!isDigit(*s)) return false;
+    if (*s == '0') s++;
+    else while (isDigit(*s)) s++;
+    if (*s == '.') {
+        s++;
+        if (!isDigit(*s)) return false;
+        while (isDigit(*s)) s++;
+    }
+    if (*s == 'e' || *s == 'E') {
+        s++;
+        if (*s == '+' || *s == '-') s++;
+        if (!isDigit(*s)) return false;
+        while (isDigit(*s)) s++;
+    }
+    return *s == '\0';
+}
+
+// Whole part of a decoded floating point number, saturated
+static int64_t toInteger(double value) {
+    if (!(value == value)) return 0;  // NaN
+    if (value >= 9.2e18) return INT64_MAX;
+    if (value <= -9.2e18) return INT64_MIN;
+    return (int64_t)value;
+}
+
+// ================== Streaming Sync Parser ==================
+UserSyncParser::UserSyncParser(SyncUserFn onUser, void* context) : onUser(onUser), context(context) {
+    reset();
+}
+
+void UserSyncParser::reset(SyncFormat format) {
+    this->format = format;
+    arrayBits = 0;
+    depth = 0;
+    expect = EXPECT_VALUE;
+    lex = LEX_NONE;
+    tokenIsKey = false;
+    startToken();
+    number = 0;
+    pending = 0;
+    usersKey = false;
+    inUsers = false;
+    sawUsers = false;
+    inRecord = false;
+    field = FIELD_NONE;
+    users = 0;
+    sinceRevision = 0;
+    toRevision = 0;
+    failure = SYNC_PARSE_OK;
+}
+
+bool UserSyncParser::feed(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length && failure == SYNC_PARSE_OK; i++) {
+        if (format == SYNC_FORMAT_MSGPACK) consumeMsgPack(data[i]);
+        else consumeJson(data[i]);
+    }
+    return failure == SYNC_PARSE_OK;
+}
+
+// Call once the whole body has been fed
+bool UserSyncParser::finish() {
+    if (failure == SYNC_PARSE_OK && (lex != LEX_NONE || expect != EXPECT_END)) {
+        fail(SYNC_PARSE_INCOMPLETE);
+    }
+    if (failure == SYNC_PARSE_OK && !sawUsers) {
+        fail(SYNC_PARSE_NO_USERS);
+    }
+    return failure == SYNC_PARSE_OK;
+}
+
+const char* UserSyncParser::errorString() const {
+    bool msgPack = format == SYNC_FORMAT_MSGPACK;
+    switch (failure) {
+        case SYNC_PARSE_OK:         return "OK";
+        case SYNC_PARSE_INVALID:    return msgPack ? "Invalid MessagePack" : "Invalid JSON";
+        case SYNC_PARSE_INCOMPLETE: return msgPack ? "Incomplete MessagePack" : "Incomplete JSON";
+        case SYNC_PARSE_TOO_DEEP:   return msgPack ? "MessagePack nested too deeply" : "JSON nested too deeply";
+        case SYNC_PARSE_NO_USERS:   return "No users array";
+        case SYNC_PARSE_REJECTED:   return "Sync failed";
+    }
+    return "Unknown error";
+}
+
+void UserSyncParser::fail(SyncParseError error) {
+    if (failure == SYNC_PARSE_OK) {
+        failure = error;
+    }
+}
+
+void UserSyncParser::consumeJson(uint8_t c) {
+    switch (lex) {
+        case LEX_STRING:
+            if (c == '"') {
+                lex = LEX_NONE;
+                endString();
+            } else if (c == '\\') {
+                lex = LEX_ESCAPE;
+            } else if (c < 0x20) {
+                fail(SYNC_PARSE_INVALID);
+            } else {
+                append(c);
+            }
+            return;
+        
+        case LEX_ESCAPE:
+            lex = LEX_STRING;
+            switch (c) {
+                case '"': case '\\': case '/': append(c); break;
+                case 'b': append('\b'); break;
+                case 'f': append('\f'); break;
+                case 'n': append('\n'); break;
+                case 'r': append('\r'); break;
+                case 't': append('\t'); break;
+                case 'u':
+                    lex = LEX_UNICODE;
+                    unicode = 0;
+                    unicodeDigits = 0;
+                    break;
+                default: fail(SYNC_PARSE_INVALID); break;
+            }
+            return;
+        
+        case LEX_UNICODE: {
+            int digit = hexDigit(c);
+            if (digit < 0) {
+                fail(SYNC_PARSE_INVALID);
+                return;
+            }
+            unicode = (unicode << 4) | digit;
+            if (++unicodeDigits == 4) {
+                lex = LEX_STRING;
+                appendCodePoint(unicode);
+            }
+            return;
+        }
+        
+        case LEX_LITERAL:
+            if (isLiteralChar(c)) {
+                append(c);
+                return;
+            }
+            // The literal ends here, `c` is handled below
+            lex = LEX_NONE;
+            endLiteral();
+            if (failure != SYNC_PARSE_OK) return;
+            break;
+        
+        default:
+            break;
+    }
+    
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return;
+    
+    switch (c) {
+        case '{':
+        case '[':
+            if (!expectsValue()) fail(SYNC_PARSE_INVALID);
+            else beginContainer(c == '[');
+            break;
+        
+        case '}':
+        case ']': {
+            bool isArray = c == ']';
+            bool empty = expect == (isArray ? EXPECT_FIRST_VALUE : EXPECT_FIRST_KEY);
+            if (depth == 0 || topIsArray() != isArray || !(empty || expect == EXPECT_COMMA)) {
+                fail(SYNC_PARSE_INVALID);
+            } else {
+                endContainer();
+            }
+            break;
+        }
+        
+        case ':':
+            if (expect != EXPECT_COLON) fail(SYNC_PARSE_INVALID);
+            else expect = EXPECT_VALUE;
+            break;
+        
+        case ',':
+            if (expect != EXPECT_COMMA) fail(SYNC_PARSE_INVALID);
+            else expect = topIsArray() ? EXPECT_VALUE : EXPECT_KEY;
+            break;
+        
+        case '"':
+            if (expect == EXPECT_KEY || expect == EXPECT_FIRST_KEY) {
+                tokenIsKey = true;
+            } else if (expectsValue() && depth > 0) {
+                tokenIsKey = false;
+            } else {
+                fail(SYNC_PARSE_INVALID);
+                break;
+            }
+            startToken();
+            lex = LEX_STRING;
+            break;
+        
+        default:
+            // Numbers and true/false/null; the document itself must be an object
+            if (expectsValue() && depth > 0 && (c == '-' || isDigit(c) || c == 't' || c == 'f' || c == 'n')) {
+                startToken();
+                append(c);
+                lex = LEX_LITERAL;
+            } else {
+                fail(SYNC_PARSE_INVALID);
+            }
+            break;
+    }
+}
+
+void UserSyncParser::startToken() {
+    tokenLength = 0;
+    tokenTruncated = false;
+    highSurrogate = 0;
+    token[0] = '\0';
+}
+
+void UserSyncParser::append(uint8_t c) {
+    if (tokenLength < SYNC_TOKEN_MAX - 1) {
+        token[tokenLength++] = c;
+        token[tokenLength] = '\0';
+    } else {
+        tokenTruncated = true;
+    }
+}
+
+// \uXXXX escapes are stored as UTF-8, surrogate pairs combined
+void UserSyncParser::appendCodePoint(uint32_t codePoint) {
+    if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+        highSurrogate = codePoint;
+        return;
+    }
+    if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+        codePoint = highSurrogate ? 0x10000 + ((highSurrogate - 0xD800) << 10) + (codePoint - 0xDC00) : 0xFFFD;
+    }
+    highSurrogate = 0;
+    
+    if (codePoint < 0x80) {
+        append(codePoint);
+    } else if (codePoint < 0x800) {
+        append(0xC0 | (codePoint >> 6));
+        append(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        append(0xE0 | (codePoint >> 12));
+        append(0x80 | ((codePoint >> 6) & 0x3F));
+        append(0x80 | (codePoint & 0x3F));
+    } else {
+        append(0xF0 | (codePoint >> 18));
+        append(0x80 | ((codePoint >> 12) & 0x3F));
+        append(0x80 | ((codePoint >> 6) & 0x3F));
+        append(0x80 | (codePoint & 0x3F));
+    }
+}
+
+void UserSyncParser::endString() {
+    if (tokenIsKey) {
+        onKey();
+        expect = EXPECT_COLON;
+    } else {
+        onScalar(SCALAR_STRING);
+        expect = EXPECT_COMMA;
+    }
+}
+
+void UserSyncParser::endLiteral() {
+    if (strcmp(token, "true") == 0) {
+        onScalar(SCALAR_TRUE);
+    } else if (strcmp(token, "false") == 0) {
+        onScalar(SCALAR_FALSE);
+    } else if (strcmp(token, "null") == 0) {
+        onScalar(SCALAR_NULL);
+    } else if (!tokenTruncated && isNumber(token)) {
+        number = strpbrk(token, ".eE") ? toInteger(strtod(token, nullptr)) : strtoll(token, nullptr, 10);
+        onScalar(SCALAR_NUMBER);
+    } else {
+        fail(SYNC_PARSE_INVALID);
+        return;
+    }
+    expect = EXPECT_COMMA;
+}
+
+void UserSyncParser::onKey() {
+    if (depth == 1) {
+        usersKey = strcmp(token, "users") == 0;
+        if (strcmp(token, "since") == 0) field = FIELD_SINCE;
+        else if (strcmp(token, "revision") == 0) field = FIELD_REVISION;
+        else field = FIELD_NONE;
+    } else if (inRecord && depth == 3) {
+        if (strcmp(token, "uid") == 0) field = FIELD_UID;
+        else if (strcmp(token, "name") == 0) field = FIELD_NAME;
+        else if (strcmp(token, "credit") == 0) field = FIELD_CREDIT;
+        else if (strcmp(token, "in") == 0) field = FIELD_IN;
+        else if (strcmp(token, "deleted") == 0) field = FIELD_DELETED;
+        else if (strcmp(token, "rev") == 0) field = FIELD_REV;
+        else field = FIELD_NONE;
+    }
+}
+
+// Members of a user object with an unexpected type keep their defaults
+void UserSyncParser::onScalar(Scalar type) {
+    if (depth == 1) {
+        if (type == SCALAR_NUMBER && field == FIELD_SINCE) sinceRevision = number;
+        if (type == SCALAR_NUMBER && field == FIELD_REVISION) toRevision = number;
+        field = FIELD_NONE;
+        return;
+    }
+    if (!inRecord || depth != 3) return;
+    
+    switch (field) {
+        case FIELD_UID:
+            // A cut UID would name another card, so it is dropped instead
+            if (type == SCALAR_STRING && !tokenTruncated) {
+                memcpy(record.uid, token, tokenLength + 1);
+            }
+            break;
+        case FIELD_NAME:
+            if (type == SCALAR_STRING) {
+                memcpy(record.name, token, tokenLength + 1);
+            }
+            break;
+        case FIELD_CREDIT:
+            if (type == SCALAR_NUMBER) {
+                record.credit = number;
+                record.hasCredit = true;
+            }
+            break;
+        case FIELD_IN:
+            if (type == SCALAR_TRUE || type == SCALAR_FALSE) {
+                record.in = type == SCALAR_TRUE;
+            }
+            break;
+        case FIELD_DELETED:
+            record.deleted = type == SCALAR_TRUE;
+            break;
+        case FIELD_REV:
+            if (type == SCALAR_NUMBER) {
+                record.rev = number;
+            }
+            break;
+        default:
+            break;
+    }
+    field = FIELD_NONE;
+}
+
+void UserSyncParser::beginContainer(bool isArray) {
+    if (depth == 0 && isArray) {
+        fail(SYNC_PARSE_INVALID);
+        return;
+    }
+    if (depth == SYNC_MAX_DEPTH) {
+        fail(SYNC_PARSE_TOO_DEEP);
+        return;
+    }
+    
+    if (depth == 1 && isArray && usersKey) {
+        inUsers = true;
+        sawUsers = true;
+    } else if (depth == 2 && !isArray && inUsers) {
+        memset(&record, 0, sizeof(record));
+        inRecord = true;
+        field = FIELD_NONE;
+    }
+    
+    if (isArray) arrayBits |= 1UL << depth;
+    else arrayBits &= ~(1UL << depth);
+    depth++;
+    expect = isArray ? EXPECT_FIRST_VALUE : EXPECT_FIRST_KEY;
+}
+
+void UserSyncParser::endContainer() {
+    depth--;
+    if (depth == 2 && inRecord) {
+        inRecord = false;
+        users++;
+        if (!onUser(record, context)) {
+            fail(SYNC_PARSE_REJECTED);
+        }
+    } else if (depth == 1 && inUsers) {
+        inUsers = false;
+    }
+    expect = depth == 0 ? EXPECT_END : EXPECT_COMMA;
+}
+
+// ================== MessagePack Input ==================
+void UserSyncParser::consumeMsgPack(uint8_t c) {
+    switch (lex) {
+        case LEX_MP_ARGUMENT:
+            argument = (argument << 8) | c;
+            if (--argumentBytes == 0) {
+                lex = LEX_NONE;
+                msgPackArgumentDone();
+            }
+            return;
+        
+        case LEX_MP_STRING:
+            append(c);
+            if (--pending == 0) {
+                lex = LEX_NONE;
+                msgPackStringDone();
+            }
+            return;
+        
+        case LEX_MP_SKIP:
+            if (--pending == 0) {
+                lex = LEX_NONE;
+                msgPackScalar(SCALAR_NULL);
+            }
+            return;
+        
+        default:
+            break;
+    }
+    
+    if (expect == EXPECT_END) {
+        fail(SYNC_PARSE_INVALID);
+        return;
+    }
+    msgPackHeader(c);
+}
+
+void UserSyncParser::msgPackHeader(uint8_t c) {
+    if (c <= 0x7F) {
+        number = c;
+        msgPackScalar(SCALAR_NUMBER);
+    } else if (c >= 0xE0) {
+        number = (int8_t)c;
+        msgPackScalar(SCALAR_NUMBER);
+    } else if (c <= 0x8F) {
+        msgPackContainer(false, c & 0x0F);
+    } else if (c <= 0x9F) {
+        msgPackContainer(true, c & 0x0F);
+    } else if (c <= 0xBF) {
+        msgPackString(c & 0x1F);
+    } else if (c >= 0xD4 && c <= 0xD8) {
+        msgPackSkip(1 + (1 << (c - 0xD4)));  // fixext: type byte and 1-16 data bytes
+    } else {
+        switch (c) {
+            case 0xC0: msgPackScalar(SCALAR_NULL); break;
+            case 0xC2: msgPackScalar(SCALAR_FALSE); break;
+            case 0xC3: msgPackScalar(SCALAR_TRUE); break;
+            case 0xC4: msgPackArgument(MP_BIN, 1); break;
+            case 0xC5: msgPackArgument(MP_BIN, 2); break;
+            case 0xC6: msgPackArgument(MP_BIN, 4); break;
+            case 0xC7: msgPackArgument(MP_EXT, 1); break;
+            case 0xC8: msgPackArgument(MP_EXT, 2); break;
+            case 0xC9: msgPackArgument(MP_EXT, 4); break;
+            case 0xCA: msgPackArgument(MP_FLOAT32, 4); break;
+            case 0xCB: msgPackArgument(MP_FLOAT64, 8); break;
+            case 0xCC: msgPackArgument(MP_UINT, 1); break;
+            case 0xCD: msgPackArgument(MP_UINT, 2); break;
+            case 0xCE: msgPackArgument(MP_UINT, 4); break;
+            case 0xCF: msgPackArgument(MP_UINT, 8); break;
+            case 0xD0: msgPackArgument(MP_INT, 1); break;
+            case 0xD1: msgPackArgument(MP_INT, 2); break;
+            case 0xD2: msgPackArgument(MP_INT, 4); break;
+            case 0xD3: msgPackArgument(MP_INT, 8); break;
+            case 0xD9: msgPackArgument(MP_STR, 1); break;
+            case 0xDA: msgPackArgument(MP_STR, 2); break;
+            case 0xDB: msgPackArgument(MP_STR, 4); break;
+            case 0xDC: msgPackArgument(MP_ARRAY, 2); break;
+            case 0xDD: msgPackArgument(MP_ARRAY, 4); break;
+            case 0xDE: msgPackArgument(MP_MAP, 2); break;
+            case 0xDF: msgPackArgument(MP_MAP, 4); break;
+            default: fail(SYNC_PARSE_INVALID); break;  // 0xC1 is never used
+        }
+    }
+}
+
+void UserSyncParser::msgPackArgument(MsgPackArgument kind, uint8_t bytes) {
+    argumentKind = kind;
+    argumentBytes = bytes;
+    argumentWidth = bytes;
+    argument = 0;
+    lex = LEX_MP_ARGUMENT;
+}
+
+void UserSyncParser::msgPackArgumentDone() {
+    switch (argumentKind) {
+        case MP_UINT:
+            number = argument > (uint64_t)INT64_MAX ? INT64_MAX : (int64_t)argument;
+            msgPackScalar(SCALAR_NUMBER);
+            break;
+        case MP_INT: {
+            int shift = 64 - argumentWidth * 8;
+            number = shift ? (int64_t)(argument << shift) >> shift : (int64_t)argument;
+            msgPackScalar(SCALAR_NUMBER);
+            break;
+        }
+        case MP_FLOAT32: {
+            uint32_t bits = argument;
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            number = toInteger(value);
+            msgPackScalar(SCALAR_NUMBER);
+            break;
+        }
+        case MP_FLOAT64: {
+            double value;
+            memcpy(&value, &argument, sizeof(value));
+            number = toInteger(value);
+            msgPackScalar(SCALAR_NUMBER);
+            break;
+        }
+        case MP_STR:   msgPackString(argument); break;
+        case MP_BIN:   msgPackSkip(argument); break;
+        case MP_EXT:   msgPackSkip(argument + 1); break;
+        case MP_ARRAY: msgPackContainer(true, argument); break;
+        case MP_MAP:   msgPackContainer(false, argument); break;
+    }
+}
+
+void UserSyncParser::msgPackString(uint32_t length) {
+    if (depth == 0) {
+        fail(SYNC_PARSE_INVALID);
+        return;
+    }
+    tokenIsKey = msgPackKeyPosition();
+    startToken();
+    if (length == 0) {
+        msgPackStringDone();
+        return;
+    }
+    pending = length;
+    lex = LEX_MP_STRING;
+}
+
+void UserSyncParser::msgPackStringDone() {
+    if (tokenIsKey) onKey();
+    else onScalar(SCALAR_STRING);
+    msgPackValueDone();
+}
+
+// Binary and extension values are not used by a sync and only skipped
+void UserSyncParser::msgPackSkip(uint32_t length) {
+    if (length == 0) {
+        msgPackScalar(SCALAR_NULL);
+        return;
+    }
+    pending = length;
+    lex = LEX_MP_SKIP;
+}
+
+void UserSyncParser::msgPackScalar(Scalar type) {
+    if (depth == 0) {
+        fail(SYNC_PARSE_INVALID);
+        return;
+    }
+    if (msgPackKeyPosition()) {
+        // Only string keys can name a member
+        startToken();
+        onKey();
+    } else {
+        onScalar(type);
+    }
+    msgPackValueDone();
+}
+
+void UserSyncParser::msgPackContainer(bool isArray, uint64_t count) {
+    if (msgPackKeyPosition() || count > (isArray ? 0xFFFFFFFFULL : 0x7FFFFFFFULL)) {
+        fail(SYNC_PARSE_INVALID);
+        return;
+    }
+    beginContainer(isArray);
+    if (failure != SYNC_PARSE_OK) return;
+    
+    remaining[depth - 1] = isArray ? count : count * 2;
+    if (remaining[depth - 1] == 0) {
+        endContainer();
+        msgPackValueDone();
+    }
+}
+
+// Counts a finished value against its container and closes every
+// container that it completes
+void UserSyncParser::msgPackValueDone() {
+    while (depth > 0 && failure == SYNC_PARSE_OK) {
+        if (--remaining[depth - 1] > 0) return;
+        endContainer();
+    }
+}
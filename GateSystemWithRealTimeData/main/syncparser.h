@@ -0,0 +1,146 @@
+#ifndef SYNCPARSER_H
+#define SYNCPARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ================== Sync Parser Configuration ==================
+#define SYNC_TOKEN_MAX  64   // Bytes kept of a key, string or number; longer names are cut
+#define SYNC_MAX_DEPTH  32   // Deepest container nesting accepted
+
+// One entry of the "users" array, as sent
+struct SyncUserRecord {
+    char uid[SYNC_TOKEN_MAX];    // Empty if missing or not a string
+    char name[SYNC_TOKEN_MAX];   // UTF-8, escapes decoded
+    long credit;
+    bool hasCredit;
+    bool in;
+    bool deleted;                // Tombstone of a delta sync
+    uint32_t rev;                // Server revision of this change, 0 if none
+};
+
+// Encodings of a sync body, see UserSyncParser::reset()
+enum SyncFormat : uint8_t {
+    SYNC_FORMAT_JSON,
+    SYNC_FORMAT_MSGPACK      // MessagePack, Content-Type application/msgpack
+};
+
+// Called for every user record; returning false stops the parse
+typedef bool (*SyncUserFn)(const SyncUserRecord& user, void* context);
+
+enum SyncParseError : uint8_t {
+    SYNC_PARSE_OK,
+    SYNC_PARSE_INVALID,      // Not well-formed, or not an object
+    SYNC_PARSE_INCOMPLETE,   // Body ended inside the document
+    SYNC_PARSE_TOO_DEEP,
+    SYNC_PARSE_NO_USERS,     // Well-formed, but without a "users" array
+    SYNC_PARSE_REJECTED      // The SyncUserFn returned false
+};
+
+// ================== Streaming Sync Parser ==================
+// Push parser for a sync body of the form
+//   {"since": N, "revision": M, "users": [{...}, ...], ...}
+// where "since" (0 or absent for a full sync) and "revision" describe a
+// delta sync and must come before "users" to be seen by the callback.
+// The body, JSON or the same document in MessagePack, is fed in chunks as
+// it arrives and every user object is handed to the callback as soon as it
+// is complete, so memory use is fixed (about 450 bytes) whatever the
+// number of users. Other members are checked for well-formedness and
+// skipped.
+class UserSyncParser {
+public:
+    UserSyncParser(SyncUserFn onUser, void* context = nullptr);
+    
+    void reset(SyncFormat format = SYNC_FORMAT_JSON);
+    bool feed(const uint8_t* data, size_t length);
+    bool finish();
+    
+    SyncParseError error() const { return failure; }
+    const char* errorString() const;
+    uint32_t userCount() const { return users; }
+    uint32_t since() const { return sinceRevision; }
+    uint32_t revision() const { return toRevision; }
+    
+private:
+    enum Lexer : uint8_t {
+        LEX_NONE, LEX_STRING, LEX_ESCAPE, LEX_UNICODE, LEX_LITERAL,
+        LEX_MP_ARGUMENT, LEX_MP_STRING, LEX_MP_SKIP
+    };
+    enum MsgPackArgument : uint8_t {
+        MP_UINT, MP_INT, MP_FLOAT32, MP_FLOAT64, MP_STR, MP_BIN, MP_EXT, MP_ARRAY, MP_MAP
+    };
+    enum Expect : uint8_t {
+        EXPECT_VALUE, EXPECT_FIRST_VALUE,   // Value, or ']' for the first one
+        EXPECT_KEY, EXPECT_FIRST_KEY,       // Key, or '}' for the first one
+        EXPECT_COLON, EXPECT_COMMA,         // ',' or the closing bracket
+        EXPECT_END                          // Only whitespace may follow
+    };
+    enum Field : uint8_t {
+        FIELD_NONE, FIELD_UID, FIELD_NAME, FIELD_CREDIT, FIELD_IN, FIELD_DELETED, FIELD_REV,
+        FIELD_SINCE, FIELD_REVISION    // Top-level members
+    };
+    enum Scalar : uint8_t { SCALAR_STRING, SCALAR_NUMBER, SCALAR_TRUE, SCALAR_FALSE, SCALAR_NULL };
+    
+    SyncUserFn onUser;
+    void* context;
+    SyncFormat format;
+    
+    uint32_t arrayBits;      // Bit n set if the container at depth n is an array
+    uint8_t depth;
+    Expect expect;
+    Lexer lex;
+    bool tokenIsKey;
+    bool tokenTruncated;
+    uint8_t tokenLength;
+    char token[SYNC_TOKEN_MAX];
+    uint8_t unicodeDigits;
+    uint16_t unicode;
+    uint16_t highSurrogate;
+    int64_t number;          // Value of the last number
+    
+    // MessagePack: containers end by count, not by a closing bracket
+    uint32_t remaining[SYNC_MAX_DEPTH];  // Items left in the container at depth n
+    uint64_t argument;       // Big-endian length or value being read
+    uint32_t pending;        // String or skipped payload bytes left
+    uint8_t argumentBytes;
+    uint8_t argumentWidth;
+    MsgPackArgument argumentKind;
+    
+    bool usersKey;           // Current top-level member is "users"
+    bool inUsers;
+    bool sawUsers;
+    bool inRecord;
+    Field field;
+    SyncUserRecord record;
+    uint32_t users;
+    uint32_t sinceRevision;
+    uint32_t toRevision;
+    SyncParseError failure;
+    
+    void consumeJson(uint8_t c);
+    void consumeMsgPack(uint8_t c);
+    void fail(SyncParseError error);
+    void startToken();
+    void append(uint8_t c);
+    void appendCodePoint(uint32_t codePoint);
+    void endString();
+    void endLiteral();
+    void onKey();
+    void onScalar(Scalar type);
+    void beginContainer(bool isArray);
+    void endContainer();
+    void msgPackHeader(uint8_t c);
+    void msgPackArgument(MsgPackArgument kind, uint8_t bytes);
+    void msgPackArgumentDone();
+    void msgPackString(uint32_t length);
+    void msgPackStringDone();
+    void msgPackSkip(uint32_t length);
+    void msgPackScalar(Scalar type);
+    void msgPackContainer(bool isArray, uint64_t count);
+    void msgPackValueDone();
+    bool msgPackKeyPosition() const { return depth > 0 && !topIsArray() && remaining[depth - 1] % 2 == 0; }
+    bool expectsValue() const { return expect == EXPECT_VALUE || expect == EXPECT_FIRST_VALUE; }
+    bool topIsArray() const { return depth > 0 && (arrayBits >> (depth - 1)) & 1; }
+};
+
+#endif // SYNCPARSER_H
@@ -0,0 +1,95 @@
+#ifndef SYNCSCANS_H
+#define SYNCSCANS_H
+
+#include <algorithm>
+#include <vector>
+#include "user.h"
+
+// ================== Scans During a Sync ==================
+// A sync builds the next user table or roster image from a copy of the
+// users, while the gate keeps scanning on the live ones. The server copy
+// was made before those scans, so every user scanned during a sync keeps
+// its live credit and presence when the sync publishes. SyncScanLog
+// records those users from the copy to the publish; it is used under the
+// user table lock. Header-only, so the host test in test/ runs this code.
+
+// What a granted scan changes on a user: presence goes the way of the scan
+// and `cost` credit is deducted if the user has it. True if presence
+// changed. updateUserState() applies it to the live table.
+inline bool applyScan(User& user, bool isEntry, long cost) {
+    bool moved = user.in != isEntry;
+    if (moved) {
+        user.in = isEntry;
+        user.dirty |= USER_DIRTY_IN;
+    }
+    if (cost > 0 && user.credit >= cost) {
+        user.credit -= cost;
+        user.dirty |= USER_DIRTY_CREDIT;
+    }
+    return moved;
+}
+
+// Entries are free, exits cost COST_PER_EXIT
+inline long scanCost(bool isEntry) {
+    return isEntry ? 0 : COST_PER_EXIT;
+}
+
+// Copies the credit and presence of the live user into the sync's copy.
+// They are dirty if they differ from the copy or were not yet written from
+// the live user, so the publish saves what the scans changed.
+inline void takeScannedState(User& user, const User& live) {
+    if (user.credit != live.credit) {
+        user.credit = live.credit;
+        user.dirty |= USER_DIRTY_CREDIT;
+    }
+    if (user.in != live.in) {
+        user.in = live.in;
+        user.dirty |= USER_DIRTY_IN;
+    }
+    user.dirty |= live.dirty & (USER_DIRTY_CREDIT | USER_DIRTY_IN);
+    if (user.slot == USER_SLOT_NONE) {
+        user.slot = live.slot;
+    }
+}
+
+class SyncScanLog {
+public:
+    SyncScanLog() : recording(false) {}
+    
+    void begin() {
+        uids.clear();
+        recording = true;
+    }
+    
+    void end() {
+        uids.clear();
+        recording = false;
+    }
+    
+    void note(const CardUID& uid) {
+        if (recording && std::find(uids.begin(), uids.end(), uid) == uids.end()) {
+            uids.push_back(uid);
+        }
+    }
+    
+    const std::vector<CardUID>& scanned() const { return uids; }
+    
+    // Brings the live state of every scanned user that is also in `next`
+    // over. Table is a UserTable, or anything with User* find(const CardUID&).
+    template <typename Table>
+    void merge(Table& next, Table& live) const {
+        for (const CardUID& uid : uids) {
+            const User* scannedUser = live.find(uid);
+            User* user = next.find(uid);
+            if (scannedUser && user) {
+                takeScannedState(*user, *scannedUser);
+            }
+        }
+    }
+    
+private:
+    std::vector<CardUID> uids;
+    bool recording;
+};
+
+#endif // SYNCSCANS_H
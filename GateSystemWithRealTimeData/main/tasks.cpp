@@ -0,0 +1,571 @@
+#include "tasks.h"
+#include <string.h>
+#include "spscqueue.h"
+#include "hardware.h"
+#include "display.h"
+#include "network.h"
+#include "users.h"
+#include "journal.h"
+#include "outbox.h"
+#include "timeline.h"
+
+// ================== Task State ==================
+static TaskHandle_t gateTaskHandle = NULL;
+static TaskHandle_t networkTaskHandle = NULL;
+static TaskHandle_t httpTaskHandle = NULL;
+
+// Between the tasks; each queue has exactly one producer and one consumer.
+// Input-mode UIDs skip past user updates waiting for a retry.
+static SpscQueue<NetworkJob, NETWORK_QUEUE_SIZE> networkJobs;
+static SpscQueue<NetworkJob, INPUT_QUEUE_SIZE> inputJobs;
+static SpscQueue<GateCommand, GATE_QUEUE_SIZE> gateCommands;   // From the HTTP task
+static SpscQueue<GateCommand, INPUT_QUEUE_SIZE> inputResults;   // From the network task
+
+// ================== Self-Test Jobs ==================
+// Written by the gate task (and startSelfTest() on the HTTP task), read by
+// web handlers
+static portMUX_TYPE selfTestMux = portMUX_INITIALIZER_UNLOCKED;
+static SelfTestJob selfTest = {0, SELF_TEST_NONE, 0, {}, {}, {}, 0, 0};
+static uint32_t lastSelfTestId = 0;
+
+SelfTestJob getSelfTest() {
+    portENTER_CRITICAL(&selfTestMux);
+    SelfTestJob copy = selfTest;
+    portEXIT_CRITICAL(&selfTestMux);
+    return copy;
+}
+
+const char* selfTestComponentName(uint8_t component) {
+    static const char* NAMES[SELF_TEST_COUNT] = {"rc522", "oled", "led", "servo", "rtc"};
+    return component < SELF_TEST_COUNT ? NAMES[component] : "unknown";
+}
+
+const char* selfTestStateName(SelfTestState state) {
+    switch (state) {
+        case SELF_TEST_QUEUED:  return "queued";
+        case SELF_TEST_RUNNING: return "running";
+        case SELF_TEST_DONE:    return "done";
+        case SELF_TEST_FAILED:  return "failed";
+        default:                return "none";
+    }
+}
+
+static bool runSelfTestComponent(uint8_t component) {
+    switch (component) {
+        case SELF_TEST_RC522: return testRFID();
+        case SELF_TEST_OLED:  return testOLED();
+        case SELF_TEST_LED:   return testLED();
+        case SELF_TEST_SERVO: return testServo();
+        case SELF_TEST_RTC:   return testRTC();
+        default:              return false;
+    }
+}
+
+// The LED and servo tests only start their sequence on the timeline; they
+// are tested once the timeline has run all of it
+static bool selfTestChannel(uint8_t component, TimelineChannel& channel) {
+    switch (component) {
+        case SELF_TEST_LED:   channel = TIMELINE_LED;   return true;
+        case SELF_TEST_SERVO: channel = TIMELINE_SERVO; return true;
+        default:              return false;
+    }
+}
+
+static bool selfTestWaiting = false;      // For the timeline to finish a sequence
+static unsigned long selfTestStartUs = 0;
+static bool selfTestGateWaiting = false;  // For a card's gate opening to end
+static unsigned long selfTestGateSinceMs = 0;
+
+// One component per gate task pass, so a card is never kept waiting for
+// more than one test
+static void stepSelfTest() {
+    if (selfTest.state != SELF_TEST_RUNNING) return;
+    
+    uint8_t component = selfTest.completed;
+    TimelineChannel channel;
+    bool timed = selfTestChannel(component, channel);
+    bool ok = true;
+    bool skipped = false;
+    if (selfTestWaiting) {
+        if (timelineBusy(channel)) return;
+        selfTestWaiting = false;
+    } else if (component == SELF_TEST_SERVO && gateIsOpen) {
+        if (!selfTestGateWaiting) {
+            selfTestGateWaiting = true;
+            selfTestGateSinceMs = millis();
+        }
+        if (millis() - selfTestGateSinceMs < SELF_TEST_GATE_WAIT_MS) return;
+        selfTestGateWaiting = false;
+        selfTestStartUs = micros();
+        ok = false;
+        skipped = true;
+    } else {
+        selfTestGateWaiting = false;
+        selfTestStartUs = micros();
+        ok = runSelfTestComponent(component);
+        if (ok && timed && timelineBusy(channel)) {
+            selfTestWaiting = true;
+            return;
+        }
+    }
+    uint32_t us = micros() - selfTestStartUs;
+    
+    portENTER_CRITICAL(&selfTestMux);
+    selfTest.ok[component] = ok;
+    selfTest.skipped[component] = skipped;
+    selfTest.us[component] = us;
+    selfTest.completed++;
+    if (selfTest.completed == SELF_TEST_COUNT) {
+        selfTest.state = SELF_TEST_DONE;
+        selfTest.durationMs = millis() - selfTest.queuedMs;
+    }
+    portEXIT_CRITICAL(&selfTestMux);
+    
+    if (selfTest.state == SELF_TEST_DONE) {
+        Serial.printf("Self-test %lu done in %lu ms\n", (unsigned long)selfTest.id, (unsigned long)selfTest.durationMs);
+    }
+}
+
+// ================== Card-to-Gate Latency ==================
+static portMUX_TYPE latencyMux = portMUX_INITIALIZER_UNLOCKED;
+static ScanLatency scanLatency = {0, 0, 0, 0, 0};
+static uint64_t scanLatencyTotal = 0;
+
+static void noteScanLatency(uint32_t us) {
+    portENTER_CRITICAL(&latencyMux);
+    if (scanLatency.count == 0 || us < scanLatency.minUs) scanLatency.minUs = us;
+    if (us > scanLatency.maxUs) scanLatency.maxUs = us;
+    scanLatency.lastUs = us;
+    scanLatency.count++;
+    scanLatencyTotal += us;
+    scanLatency.avgUs = scanLatencyTotal / scanLatency.count;
+    portEXIT_CRITICAL(&latencyMux);
+}
+
+ScanLatency getScanLatency() {
+    portENTER_CRITICAL(&latencyMux);
+    ScanLatency copy = scanLatency;
+    portEXIT_CRITICAL(&latencyMux);
+    return copy;
+}
+
+// ================== Outbound RPC Queue ==================
+// User updates move from the queue into a batch that is sent in one
+// request. A batch that fails stays in front until it is sent or given up,
+// so updates reach the server in scan order; while it waits it keeps
+// filling up. Only the network task touches this.
+static NetworkJob batch[RPC_BATCH_MAX];
+static uint8_t batchLength = 0;
+static bool retryPending = false;
+static uint8_t retryAttempts = 0;
+static unsigned long retryAtMs = 0;
+static bool serverTakesBatches = true;  // Cleared by a 404 from an older server
+static uint32_t rpcSent = 0;
+static uint32_t rpcFailed = 0;
+static uint32_t rpcRetries = 0;
+static uint32_t rpcBatches = 0;
+static unsigned long lastReplayMs = 0;
+
+enum JobResult : uint8_t { JOB_DONE, JOB_RETRY, JOB_FAILED };
+
+NetworkQueueStats getNetworkQueueStats() {
+    NetworkQueueStats stats;
+    stats.depth = networkJobs.size() + batchLength;
+    stats.outbox = getOutboxPending();
+    stats.outboxBytes = getOutboxBytes();
+    stats.outboxDropped = getOutboxDropCount();
+    stats.capacity = networkJobs.capacity();
+    stats.dropped = networkJobs.dropCount();
+    stats.failed = rpcFailed;
+    stats.retries = rpcRetries;
+    stats.sent = rpcSent;
+    stats.batches = rpcBatches;
+    long wait = retryPending ? (long)(retryAtMs - millis()) : 0;
+    stats.retryInMs = wait > 0 ? wait : 0;
+    return stats;
+}
+
+// Server errors and lost connections may pass; other refusals will not
+static bool isRetryable(const RPCResponse& response) {
+    return response.status <= 0 || response.status == 429 || response.status >= 500;
+}
+
+// 1 s, 2 s, 4 s ... up to a minute, plus up to a quarter of that so
+// several gates do not retry in step
+static unsigned long retryDelayMs(uint8_t attempts) {
+    unsigned long delayMs = RPC_RETRY_BASE_MS;
+    for (uint8_t i = 1; i < attempts && delayMs < RPC_RETRY_MAX_MS; i++) delayMs *= 2;
+    if (delayMs > RPC_RETRY_MAX_MS) delayMs = RPC_RETRY_MAX_MS;
+    return delayMs + random(delayMs / 4 + 1);
+}
+
+// ================== Network Jobs ==================
+// Called by the gate task with the RTC unix time of the scan (0 if the RTC
+// is not set). The RTC shares the I2C bus with the OLED, so the gate task
+// reads it and not the network task.
+bool queueUserUpdate(const User& user, uint32_t timestamp) {
+    NetworkJob job;
+    job.type = JOB_USER_UPDATE;
+    job.uid = user.uid;
+    snprintf(job.name, sizeof(job.name), "%s", user.name);
+    job.credit = user.credit;
+    job.in = user.in;
+    job.isNew = false;
+    job.timestamp[0] = '\0';
+    job.queuedAtMs = millis();
+    job.seq = 0; // Numbered by the network task
+    
+    if (timestamp != 0) {
+        DateTime now(timestamp);
+        snprintf(job.timestamp, sizeof(job.timestamp), "%04d-%02d-%02dT%02d:%02d:%02d.000Z",
+                 now.year(), now.month(), now.day(),
+                 now.hour(), now.minute(), now.second());
+    }
+    
+    if (!networkJobs.push(job)) return false;
+    if (networkTaskHandle) xTaskNotifyGive(networkTaskHandle);
+    return true;
+}
+
+bool queueNewUID(const CardUID& uid, bool isNew) {
+    NetworkJob job;
+    job.type = JOB_NEW_UID;
+    job.uid = uid;
+    job.name[0] = '\0';
+    job.credit = 0;
+    job.in = false;
+    job.isNew = isNew;
+    job.timestamp[0] = '\0';
+    job.queuedAtMs = millis();
+    job.seq = 0;
+    
+    if (!inputJobs.push(job)) return false;
+    if (networkTaskHandle) xTaskNotifyGive(networkTaskHandle);
+    return true;
+}
+
+static void wakeGateTask() {
+    if (gateTaskHandle) xTaskNotifyGive(gateTaskHandle);
+}
+
+static JobResult runNetworkJob(const NetworkJob& job) {
+    if (job.type == JOB_USER_UPDATE) {
+        RPCResponse response = updateUserOnServer(job.uid, job.name, job.credit, job.in, job.timestamp, job.seq);
+        if (response.success) {
+            Serial.println("✓ User data successfully synced to server");
+            return JOB_DONE;
+        }
+        Serial.println("⚠ Failed to sync user data to server: " + response.error);
+        return isRetryable(response) ? JOB_RETRY : JOB_FAILED;
+    }
+    
+    // Input mode: the person at the reader is waiting for this answer, so
+    // it is not retried
+    Serial.println("Input mode: Sending new UID to server - " + uidToHex(job.uid));
+    RPCResponse response = notifyNewUID(job.uid, job.isNew);
+    if (response.success) {
+        Serial.println("Successfully notified server of new UID");
+    } else {
+        Serial.println("Failed to notify server: " + response.error);
+    }
+    
+    GateCommand result = {GATE_INPUT_RESULT, response.success, 0, job.uid};
+    if (inputResults.push(result)) wakeGateTask();
+    return response.success ? JOB_DONE : JOB_FAILED;
+}
+
+// Sends the batch. Updates that are finished either way leave it; returns
+// false if the rest should be retried.
+static bool sendBatch() {
+    uint8_t done = 0;
+    if (serverTakesBatches) {
+        RPCResponse response = updateUsersOnServer(batch, batchLength);
+        if (response.success) {
+            uint32_t rejected = response.data["rejected"].size();
+            uint32_t duplicates = response.data["duplicates"] | 0;
+            Serial.printf("✓ %u user updates synced to server in one request\n", batchLength);
+            if (rejected > 0) {
+                Serial.printf("⚠ Server did not know %lu of them\n", (unsigned long)rejected);
+            }
+            if (duplicates > 0) {
+                Serial.printf("  %lu of them had already arrived\n", (unsigned long)duplicates);
+            }
+            rpcBatches++;
+            rpcSent += batchLength - rejected;
+            rpcFailed += rejected;
+            batchLength = 0;
+            return true;
+        }
+        
+        Serial.println("⚠ Failed to sync user updates to server: " + response.error);
+        if (response.status == 404) {
+            serverTakesBatches = false;
+            Serial.println("  Server has no batch endpoint - sending updates one by one");
+        } else if (isRetryable(response)) {
+            return false;
+        } else {
+            rpcFailed += batchLength;
+            batchLength = 0;
+            return true;
+        }
+    }
+    
+    // One request per update, for servers without the batch endpoint
+    bool sent = true;
+    while (done < batchLength) {
+        JobResult result = runNetworkJob(batch[done]);
+        if (result == JOB_RETRY) {
+            sent = false;
+            break;
+        }
+        if (result == JOB_DONE) {
+            rpcBatches++;
+            rpcSent++;
+        } else {
+            rpcFailed++;
+        }
+        done++;
+    }
+    memmove(batch, batch + done, (batchLength - done) * sizeof(NetworkJob));
+    batchLength -= done;
+    return sent;
+}
+
+// Moves the live batch into the outbox, to be replayed in order
+static void spillBatch(const char* reason) {
+    for (uint8_t i = 0; i < batchLength; i++) {
+        outboxAppend(batch[i]);
+    }
+    Serial.printf("⚠ %s - %u user updates kept in the outbox\n", reason, batchLength);
+    batchLength = 0;
+}
+
+// Sends input-mode UIDs at once and user updates by the batch rules.
+// While the outbox holds updates, new ones are appended behind them and
+// the outbox is replayed one batch per OUTBOX_REPLAY_INTERVAL_MS, so a
+// backlog neither floods the server nor keeps the web server waiting.
+static void drainNetworkJobs() {
+    NetworkJob job;
+    while (inputJobs.pop(job)) {
+        runNetworkJob(job);
+    }
+    
+    for (;;) {
+        bool behindOutbox = getOutboxPending() > 0;
+        if (!behindOutbox && batchLength == RPC_BATCH_MAX) break;
+        if (!networkJobs.pop(job)) break;
+        job.seq = nextUpdateSeq();
+        if (behindOutbox) {
+            outboxAppend(job);
+        } else {
+            batch[batchLength++] = job;
+        }
+    }
+    
+    bool replay = batchLength == 0 && getOutboxPending() > 0;
+    if (!replay && batchLength == 0) return;
+    
+    if (retryPending) {
+        if ((long)(millis() - retryAtMs) < 0) return;
+    } else if (replay) {
+        if (millis() - lastReplayMs < OUTBOX_REPLAY_INTERVAL_MS) return;
+    } else if (batchLength < RPC_BATCH_MAX && millis() - batch[0].queuedAtMs < RPC_BATCH_MAX_AGE_MS) {
+        return; // More may follow
+    }
+    
+    // Without WiFi nothing is attempted; the batch waits for the reconnect
+    if (WiFi.status() != WL_CONNECTED) {
+        if (!replay && isOutboxReady()) spillBatch("WiFi offline");
+        return;
+    }
+    
+    if (replay) {
+        batchLength = outboxRead(batch, RPC_BATCH_MAX);
+        lastReplayMs = millis();
+        if (batchLength == 0) return;
+    }
+    
+    uint8_t length = batchLength;
+    bool sent = sendBatch();
+    if (replay) {
+        // The rest stays in the outbox and is read again next time
+        outboxAcknowledge(length - batchLength);
+        batchLength = 0;
+    }
+    if (sent) {
+        retryPending = false;
+        retryAttempts = 0;
+        return;
+    }
+    
+    // The outbox keeps retrying for as long as it takes
+    if (isOutboxReady()) {
+        if (!replay) spillBatch("Server not answering");
+        if (retryAttempts < RPC_MAX_ATTEMPTS) retryAttempts++;
+        rpcRetries++;
+        retryPending = true;
+        retryAtMs = millis() + retryDelayMs(retryAttempts);
+        Serial.printf("  Outbox replay (%lu updates) in %lu ms\n", (unsigned long)getOutboxPending(),
+                      retryAtMs - millis());
+        return;
+    }
+    
+    if (++retryAttempts < RPC_MAX_ATTEMPTS) {
+        rpcRetries++;
+        retryPending = true;
+        retryAtMs = millis() + retryDelayMs(retryAttempts);
+        Serial.printf("  Retry %u of %u updates in %lu ms\n", retryAttempts, batchLength, retryAtMs - millis());
+        return;
+    }
+    
+    rpcFailed += batchLength;
+    batchLength = 0;
+    retryPending = false;
+    retryAttempts = 0;
+    Serial.println("  Giving up; the server catches up at the next reconcile or sync");
+}
+
+// ================== Gate Commands ==================
+// Called by the HTTP task (web handlers)
+bool queueGateCommand(GateCommandType type, uint8_t value, uint32_t arg) {
+    GateCommand command = {type, value, arg, CardUID()};
+    if (!gateCommands.push(command)) return false;
+    wakeGateTask();
+    return true;
+}
+
+// Called by the HTTP task; returns the id of the job to poll, or 0 if the
+// gate queue is full. A job still queued or running is shared instead of
+// starting another one.
+uint32_t startSelfTest() {
+    portENTER_CRITICAL(&selfTestMux);
+    if (selfTest.state == SELF_TEST_QUEUED || selfTest.state == SELF_TEST_RUNNING) {
+        uint32_t id = selfTest.id;
+        portEXIT_CRITICAL(&selfTestMux);
+        return id;
+    }
+    uint32_t id = ++lastSelfTestId;
+    memset(&selfTest, 0, sizeof(selfTest));
+    selfTest.id = id;
+    selfTest.state = SELF_TEST_QUEUED;
+    selfTest.queuedMs = millis();
+    portEXIT_CRITICAL(&selfTestMux);
+    
+    // The hardware tests run on the gate task, which owns the devices
+    if (!queueGateCommand(GATE_SELF_TEST, 0, id)) {
+        portENTER_CRITICAL(&selfTestMux);
+        selfTest.state = SELF_TEST_FAILED;
+        portEXIT_CRITICAL(&selfTestMux);
+        return 0;
+    }
+    return id;
+}
+
+static void runGateCommand(const GateCommand& command) {
+    switch (command.type) {
+        case GATE_OPEN:
+            gateOpen();
+            break;
+        case GATE_LED:
+            setLEDColor(command.value);
+            break;
+        case GATE_INPUT_MODE:
+            setInputModeActive(command.value != 0);
+            break;
+        case GATE_INPUT_RESULT:
+            if (command.value) {
+                showInputModeScreen("Card sent to server!\nUID: " + uidToHex(command.uid));
+            } else {
+                showInputModeScreen("Card detected:\n" + uidToHex(command.uid) + "\n(Server offline)");
+            }
+            break;
+        case GATE_SET_TIME:
+            rtc.adjust(DateTime(command.arg));
+            Serial.printf("RTC set to %lu\n", (unsigned long)command.arg);
+            break;
+        case GATE_SELF_TEST:
+            portENTER_CRITICAL(&selfTestMux);
+            if (selfTest.id == command.arg && selfTest.state == SELF_TEST_QUEUED) {
+                selfTest.state = SELF_TEST_RUNNING;
+            }
+            portEXIT_CRITICAL(&selfTestMux);
+            break;
+    }
+}
+
+// ================== Tasks ==================
+// Reads cards and answers them from local state only; anything for the
+// server is queued. Web handler commands and the RC522 IRQ wake it early.
+static void gateTask(void* parameter) {
+    initializeRFIDInterrupt(xTaskGetCurrentTaskHandle());
+    
+    for (;;) {
+        GateCommand command;
+        while (gateCommands.pop(command) || inputResults.pop(command)) {
+            runGateCommand(command);
+        }
+        
+        gateMaybeClose();
+        runTimeline();
+        stepSelfTest();
+        updateDisplay();
+        
+        // With the IRQ, the card was there from the interrupt on
+        unsigned long polledUs = isRFIDInterruptPending() ? rfidIrqUs : micros();
+        CardUID cardUID = readRFIDCard();
+        if (!cardUID.isEmpty()) {
+            bool inputMode = isInputModeActive();
+            if (processCardScan(cardUID) && !inputMode) {
+                noteScanLatency(gateOpenedUs - polledUs);
+            }
+        }
+        armRFIDReceive();
+        
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timelineWaitMs(GATE_TASK_PERIOD_MS)));
+    }
+}
+
+// Everything that may block on WiFi or the server
+static void networkTask(void* parameter) {
+    for (;;) {
+        drainNetworkJobs();
+        
+        // Fold the journal into the user table once it grows too large
+        maintainJournal();
+        maintainNetwork();
+        
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NETWORK_TASK_PERIOD_MS));
+    }
+}
+
+// The synchronous WebServer serves one request per handleClient() call;
+// polled on its own, answers no longer wait for a scan or an RPC.
+// Handlers share state with the other tasks only through the user table
+// lock, the queues above and the sync parser claim in network.cpp.
+static void httpTask(void* parameter) {
+    for (;;) {
+        handleWebRequests();
+        vTaskDelay(pdMS_TO_TICKS(HTTP_TASK_PERIOD_MS));
+    }
+}
+
+bool startTasks() {
+    if (xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, NULL,
+                                NETWORK_TASK_PRIORITY, &networkTaskHandle, NETWORK_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start network task");
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(httpTask, "http", HTTP_TASK_STACK, NULL,
+                                HTTP_TASK_PRIORITY, &httpTaskHandle, HTTP_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start HTTP task");
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(gateTask, "gate", GATE_TASK_STACK, NULL,
+                                GATE_TASK_PRIORITY, &gateTaskHandle, GATE_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start gate task");
+        return false;
+    }
+    
+    Serial.printf("Tasks started: gate on core %d, network and HTTP on core %d\n", GATE_TASK_CORE, NETWORK_TASK_CORE);
+    return true;
+}
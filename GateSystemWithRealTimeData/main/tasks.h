@@ -0,0 +1,153 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <Arduino.h>
+#include "carduid.h"
+#include "userstore.h"
+
+// ================== Task Configuration ==================
+// The gate task owns the RC522, servo, LED, OLED and RTC and never waits on
+// the network; the network task owns WiFi and every RPC; the HTTP task
+// serves the admin panel, so neither a scan nor a slow RPC delays an
+// answer. Arduino's loop() task is deleted once all are running.
+#define GATE_TASK_CORE        1      // APP_CPU, next to the Arduino core
+#define NETWORK_TASK_CORE     0      // PRO_CPU, next to the WiFi/lwIP tasks
+#define HTTP_TASK_CORE        0
+#define GATE_TASK_PRIORITY    5
+#define HTTP_TASK_PRIORITY    3      // Preempts an RPC in progress
+#define NETWORK_TASK_PRIORITY 2
+#define GATE_TASK_STACK       8192
+#define NETWORK_TASK_STACK    12288
+#define HTTP_TASK_STACK       12288
+#define HTTP_TASK_PERIOD_MS   2      // Web server poll interval
+#define GATE_TASK_PERIOD_MS   20     // RC522 poll interval, see hardware.h
+#define NETWORK_TASK_PERIOD_MS 10    // Batch age check interval
+#define NETWORK_QUEUE_SIZE    32     // Power of two, see spscqueue.h
+#define INPUT_QUEUE_SIZE      4
+#define GATE_QUEUE_SIZE       16
+
+// Failed server updates are retried with exponential backoff, oldest
+// first, from the outbox (see outbox.h). Without one they are dropped
+// after RPC_MAX_ATTEMPTS.
+#define RPC_RETRY_BASE_MS     1000
+#define RPC_RETRY_MAX_MS      60000
+#define RPC_MAX_ATTEMPTS      8
+
+// Queued user updates go out together in one POST /api/database/users/batch
+// once RPC_BATCH_MAX are waiting or the oldest is RPC_BATCH_MAX_AGE_MS old
+#define RPC_BATCH_MAX         16
+#define RPC_BATCH_MAX_AGE_MS  500
+
+// ================== Network Jobs ==================
+// Work the gate task hands to the network task instead of calling the
+// server itself
+enum NetworkJobType : uint8_t {
+    JOB_USER_UPDATE,     // POST /api/database/users/update
+    JOB_NEW_UID          // POST /api/input/new-uid, answered with GATE_INPUT_RESULT
+};
+
+struct NetworkJob {
+    NetworkJobType type;
+    CardUID uid;
+    char name[USER_NAME_MAX];
+    int32_t credit;
+    bool in;
+    bool isNew;
+    char timestamp[25];  // RTC time of the change, empty if the RTC is not set
+    uint32_t queuedAtMs;
+    uint32_t seq;        // User updates: per-device sequence number, see outbox.h
+};
+
+// ================== Gate Commands ==================
+// Hardware requests of web handlers (HTTP task) and input-mode answers
+// (network task), run by the gate task
+enum GateCommandType : uint8_t {
+    GATE_OPEN,
+    GATE_LED,            // value: LedColor
+    GATE_INPUT_MODE,     // value: on/off
+    GATE_INPUT_RESULT,   // value: server took the scanned UID
+    GATE_SET_TIME,       // arg: Unix time
+    GATE_SELF_TEST       // arg: job id, see startSelfTest()
+};
+
+struct GateCommand {
+    GateCommandType type;
+    uint8_t value;
+    uint32_t arg;
+    CardUID uid;         // GATE_INPUT_RESULT
+};
+
+// ================== Self-Test Jobs ==================
+// POST /api/selftest starts a job and answers with its id at once; the gate
+// task tests one component per pass, between card reads, and
+// GET /api/selftest?id= polls the results. Only the latest job is kept.
+// The servo test waits up to SELF_TEST_GATE_WAIT_MS for a gate opened by a
+// card to close, and is reported as skipped if it does not.
+#define SELF_TEST_GATE_WAIT_MS  3000
+enum SelfTestComponent : uint8_t {
+    SELF_TEST_RC522,
+    SELF_TEST_OLED,
+    SELF_TEST_LED,
+    SELF_TEST_SERVO,
+    SELF_TEST_RTC,
+    SELF_TEST_COUNT
+};
+
+enum SelfTestState : uint8_t {
+    SELF_TEST_NONE,      // No job since boot
+    SELF_TEST_QUEUED,
+    SELF_TEST_RUNNING,
+    SELF_TEST_DONE,
+    SELF_TEST_FAILED     // Could not be queued
+};
+
+struct SelfTestJob {
+    uint32_t id;
+    SelfTestState state;
+    uint8_t completed;               // Components tested so far, in enum order
+    bool ok[SELF_TEST_COUNT];
+    bool skipped[SELF_TEST_COUNT];   // Not run: the servo while cards kept the gate open
+    uint32_t us[SELF_TEST_COUNT];    // Time each test took, LED and servo until their sequence ran
+    uint32_t queuedMs;
+    uint32_t durationMs;             // From queued to done
+};
+
+// ================== Card-to-Gate Latency ==================
+// From the RC522 poll or IRQ that saw a card to the servo command, for
+// granted scans
+struct ScanLatency {
+    uint32_t count;
+    uint32_t lastUs;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint32_t avgUs;
+};
+
+// Outbound RPC queue counters; all but depth are totals since boot
+struct NetworkQueueStats {
+    uint32_t depth;      // Queued in RAM, including the batch being sent
+    uint32_t outbox;     // Waiting in flash
+    uint32_t outboxBytes;
+    uint32_t outboxDropped;  // Outbox full or not writable
+    uint32_t capacity;
+    uint32_t dropped;    // Queue full
+    uint32_t failed;     // Given up: refused by the server or out of attempts
+    uint32_t retries;
+    uint32_t sent;       // Updates the server took
+    uint32_t batches;    // Requests that carried them
+    uint32_t retryInMs;  // Until the next retry, 0 if none is waiting
+};
+
+// ================== Task Functions ==================
+bool startTasks();
+bool queueUserUpdate(const User& user, uint32_t timestamp);
+bool queueNewUID(const CardUID& uid, bool isNew);
+bool queueGateCommand(GateCommandType type, uint8_t value = 0, uint32_t arg = 0);
+uint32_t startSelfTest();
+SelfTestJob getSelfTest();
+const char* selfTestComponentName(uint8_t component);
+const char* selfTestStateName(SelfTestState state);
+ScanLatency getScanLatency();
+NetworkQueueStats getNetworkQueueStats();
+
+#endif // TASKS_H
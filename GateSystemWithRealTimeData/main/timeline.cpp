@@ -0,0 +1,100 @@
+#include "timeline.h"
+#include "hardware.h"
+#include "display.h"
+
+// ================== Timeline State ==================
+// In the order queued, so steps due at the same time run in that order
+static TimelineStep steps[TIMELINE_MAX_STEPS];
+static uint8_t stepCount = 0;
+
+static bool isDue(const TimelineStep& step, uint32_t now) {
+    return (int32_t)(now - step.dueMs) >= 0;
+}
+
+static void removeStep(uint8_t index) {
+    memmove(&steps[index], &steps[index + 1], (stepCount - index - 1) * sizeof(TimelineStep));
+    stepCount--;
+}
+
+static void runStep(const TimelineStep& step) {
+    switch (step.channel) {
+        case TIMELINE_LED:
+            setLEDColor(step.value);
+            break;
+        case TIMELINE_SERVO:
+            gateServo.write(step.value);
+            break;
+        case TIMELINE_SCREEN:
+            showScreen((DisplayScreen)step.value);
+            break;
+    }
+}
+
+// ================== Timeline Functions ==================
+bool timelineAt(uint32_t delayMs, TimelineChannel channel, uint8_t value) {
+    if (stepCount >= TIMELINE_MAX_STEPS) {
+        Serial.println("Timeline full - step dropped");
+        return false;
+    }
+    TimelineStep& step = steps[stepCount++];
+    step.dueMs = millis() + delayMs;
+    step.channel = channel;
+    step.value = value;
+    return true;
+}
+
+// Drops what is still waiting on a channel, e.g. before a new screen takes
+// over the display
+void timelineClear(TimelineChannel channel) {
+    for (uint8_t i = 0; i < stepCount;) {
+        if (steps[i].channel == channel) {
+            removeStep(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+// Steps still waiting on a channel
+bool timelineBusy(TimelineChannel channel) {
+    for (uint8_t i = 0; i < stepCount; i++) {
+        if (steps[i].channel == channel) return true;
+    }
+    return false;
+}
+
+// Once per gate task pass; runs every step that has fallen due, earliest
+// first
+void runTimeline() {
+    uint32_t now = millis();
+    for (;;) {
+        int next = -1;
+        for (uint8_t i = 0; i < stepCount; i++) {
+            if (isDue(steps[i], now) &&
+                (next < 0 || (int32_t)(steps[i].dueMs - steps[next].dueMs) < 0)) {
+                next = i;
+            }
+        }
+        if (next < 0) break;
+        
+        TimelineStep step = steps[next];
+        removeStep(next);
+        runStep(step);
+    }
+}
+
+// How long the gate task may sleep without making a step late
+uint32_t timelineWaitMs(uint32_t maxMs) {
+    uint32_t now = millis();
+    uint32_t wait = maxMs;
+    for (uint8_t i = 0; i < stepCount; i++) {
+        if (isDue(steps[i], now)) return 0;
+        uint32_t until = steps[i].dueMs - now;
+        if (until < wait) wait = until;
+    }
+    return wait;
+}
+
+uint8_t getTimelineStepCount() {
+    return stepCount;
+}
@@ -0,0 +1,33 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <Arduino.h>
+
+// ================== Timeline Configuration ==================
+// LED colours, servo moves and screens that should happen later are queued
+// here with a deadline instead of waiting in delay(), and the gate task
+// runs them as they fall due. Only the gate task (and setup(), before the
+// tasks start) may use the timeline.
+#define TIMELINE_MAX_STEPS  16
+
+enum TimelineChannel : uint8_t {
+    TIMELINE_LED,        // value: LedColor
+    TIMELINE_SERVO,      // value: angle in degrees
+    TIMELINE_SCREEN      // value: DisplayScreen without a message
+};
+
+struct TimelineStep {
+    uint32_t dueMs;
+    TimelineChannel channel;
+    uint8_t value;
+};
+
+// ================== Timeline Functions ==================
+bool timelineAt(uint32_t delayMs, TimelineChannel channel, uint8_t value);
+void timelineClear(TimelineChannel channel);
+bool timelineBusy(TimelineChannel channel);
+void runTimeline();
+uint32_t timelineWaitMs(uint32_t maxMs);
+uint8_t getTimelineStepCount();
+
+#endif // TIMELINE_H
@@ -0,0 +1,144 @@
+#include "uidfilter.h"
+
+// ================== Hash Helpers ==================
+// MurmurHash3 finalizer: spreads the FNV-1a UID hash over all 32 bits
+static uint32_t mix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+// ================== UID Cuckoo Filter ==================
+UidFilter::UidFilter() : external(nullptr), buckets(0), count(0), kickState(0x9E3779B9U) {}
+
+void UidFilter::clear() {
+    slots.assign(slots.size(), 0);
+    external = nullptr;
+    count = 0;
+}
+
+void UidFilter::reserve(size_t wanted) {
+    // Power-of-two bucket count that keeps `wanted` below the maximum load
+    size_t needed = UID_FILTER_MIN_BUCKETS;
+    while (needed * UID_FILTER_BUCKET_SLOTS * UID_FILTER_MAX_LOAD < wanted * 100) {
+        needed <<= 1;
+    }
+    
+    buckets = needed;
+    slots.assign(buckets * UID_FILTER_BUCKET_SLOTS, 0);
+    external = nullptr;
+    count = 0;
+}
+
+void UidFilter::attach(const uint16_t* stored, uint32_t bucketCount, size_t itemCount) {
+    slots.clear();
+    slots.shrink_to_fit();
+    external = stored;
+    buckets = bucketCount;
+    count = itemCount;
+}
+
+void UidFilter::locate(const CardUID& uid, uint16_t& fingerprint, uint32_t& first, uint32_t& second) const {
+    uint32_t h = mix32(uid.hash());
+    fingerprint = h >> 16;
+    if (fingerprint == 0) fingerprint = 1; // 0 marks an empty slot
+    first = h & (buckets - 1);
+    second = alternate(first, fingerprint);
+}
+
+// Partial-key cuckoo hashing: either bucket of an item is reachable from the
+// other and the fingerprint alone, so items can move without their key
+uint32_t UidFilter::alternate(uint32_t bucket, uint16_t fingerprint) const {
+    return (bucket ^ mix32(fingerprint)) & (buckets - 1);
+}
+
+bool UidFilter::contains(uint32_t bucket, uint16_t fingerprint) const {
+    const uint16_t* slot = data() + bucket * UID_FILTER_BUCKET_SLOTS;
+    for (int i = 0; i < UID_FILTER_BUCKET_SLOTS; i++) {
+        if (slot[i] == fingerprint) return true;
+    }
+    return false;
+}
+
+bool UidFilter::place(uint32_t bucket, uint16_t fingerprint) {
+    uint16_t* slot = &slots[bucket * UID_FILTER_BUCKET_SLOTS];
+    for (int i = 0; i < UID_FILTER_BUCKET_SLOTS; i++) {
+        if (slot[i] == 0) {
+            slot[i] = fingerprint;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UidFilter::insert(const CardUID& uid) {
+    if (external || buckets == 0) return false;
+    if ((count + 1) * 100 > buckets * UID_FILTER_BUCKET_SLOTS * UID_FILTER_MAX_LOAD) return false;
+    
+    uint16_t fingerprint;
+    uint32_t first, second;
+    locate(uid, fingerprint, first, second);
+    if (place(first, fingerprint) || place(second, fingerprint)) {
+        count++;
+        return true;
+    }
+    
+    // Both buckets full: evict a random fingerprint to its other bucket
+    uint32_t bucket = (kickState & 1) ? first : second;
+    for (int kick = 0; kick < UID_FILTER_MAX_KICKS; kick++) {
+        kickState ^= kickState << 13;
+        kickState ^= kickState >> 17;
+        kickState ^= kickState << 5;
+        
+        uint16_t& victim = slots[bucket * UID_FILTER_BUCKET_SLOTS + kickState % UID_FILTER_BUCKET_SLOTS];
+        uint16_t evicted = victim;
+        victim = fingerprint;
+        fingerprint = evicted;
+        
+        bucket = alternate(bucket, fingerprint);
+        if (place(bucket, fingerprint)) {
+            count++;
+            return true;
+        }
+    }
+    return false; // `fingerprint` is now homeless - owner rebuilds
+}
+
+bool UidFilter::remove(const CardUID& uid) {
+    if (external || buckets == 0) return false;
+    
+    uint16_t fingerprint;
+    uint32_t first, second;
+    locate(uid, fingerprint, first, second);
+    for (uint32_t bucket : {first, second}) {
+        uint16_t* slot = &slots[bucket * UID_FILTER_BUCKET_SLOTS];
+        for (int i = 0; i < UID_FILTER_BUCKET_SLOTS; i++) {
+            if (slot[i] == fingerprint) {
+                slot[i] = 0;
+                count--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool UidFilter::mayContain(const CardUID& uid) const {
+    if (buckets == 0 || count == 0) return false;
+    
+    uint16_t fingerprint;
+    uint32_t first, second;
+    locate(uid, fingerprint, first, second);
+    return contains(first, fingerprint) || contains(second, fingerprint);
+}
+
+float UidFilter::falsePositiveRate() const {
+    if (buckets == 0) return 0.0f;
+    
+    // Each lookup compares against 2 buckets worth of occupied slots
+    float load = (float)count / (buckets * UID_FILTER_BUCKET_SLOTS);
+    return 2.0f * UID_FILTER_BUCKET_SLOTS * load / 65535.0f;
+}
@@ -0,0 +1,56 @@
+#ifndef UIDFILTER_H
+#define UIDFILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "carduid.h"
+
+// ================== UID Filter Configuration ==================
+#define UID_FILTER_BUCKET_SLOTS  4     // Fingerprints per bucket
+#define UID_FILTER_MIN_BUCKETS   4
+#define UID_FILTER_MAX_LOAD      90    // Refuse inserts above 90% of the slots
+#define UID_FILTER_MAX_KICKS     500
+
+// ================== UID Cuckoo Filter ==================
+// Cuckoo filter over binary card UIDs (16-bit fingerprints, 4 per bucket).
+// mayContain() answers "definitely not enrolled" in constant time with a
+// false-positive rate of about 8 * load / 65536, and unlike a Bloom filter
+// it supports remove(). Costs about 2.5 bytes per UID.
+//
+// insert() returns false when the filter is full or a displacement chain
+// gives up; the filter may then have lost a fingerprint, so the owner must
+// rebuild it from its keys with a larger reserve().
+class UidFilter {
+public:
+    UidFilter();
+    
+    void clear();
+    void reserve(size_t count);
+    bool insert(const CardUID& uid);
+    bool remove(const CardUID& uid);
+    bool mayContain(const CardUID& uid) const;
+    
+    // Read-only view of a filter stored elsewhere (e.g. a mapped partition)
+    void attach(const uint16_t* slots, uint32_t bucketCount, size_t itemCount);
+    const uint16_t* data() const { return external ? external : slots.data(); }
+    
+    size_t size() const { return count; }
+    size_t bucketCount() const { return buckets; }
+    size_t memoryBytes() const { return buckets * UID_FILTER_BUCKET_SLOTS * sizeof(uint16_t); }
+    float falsePositiveRate() const;
+    
+private:
+    std::vector<uint16_t> slots;  // buckets * UID_FILTER_BUCKET_SLOTS, 0 = empty
+    const uint16_t* external;
+    size_t buckets;
+    size_t count;
+    uint32_t kickState;
+    
+    void locate(const CardUID& uid, uint16_t& fingerprint, uint32_t& first, uint32_t& second) const;
+    uint32_t alternate(uint32_t bucket, uint16_t fingerprint) const;
+    bool contains(uint32_t bucket, uint16_t fingerprint) const;
+    bool place(uint32_t bucket, uint16_t fingerprint);
+};
+
+#endif // UIDFILTER_H
@@ -0,0 +1,107 @@
+#include "uidindex.h"
+
+// ================== UID Hash Index ==================
+UidIndex::UidIndex() : count(0) {}
+
+void UidIndex::clear() {
+    slots.clear();
+    count = 0;
+}
+
+void UidIndex::reserve(size_t wanted) {
+    // Keep the table below the maximum load factor for `wanted` entries
+    size_t needed = UID_INDEX_MIN_SLOTS;
+    while (needed * UID_INDEX_MAX_LOAD < wanted * 100) {
+        needed <<= 1;
+    }
+    if (needed > slots.size()) {
+        rehash(needed);
+    }
+}
+
+void UidIndex::insert(const CardUID& uid, int32_t userIndex) {
+    reserve(count + 1);
+    
+    Slot slot;
+    slot.hash = uid.hash();
+    slot.value = userIndex;
+    place(slot);
+    count++;
+}
+
+int32_t UidIndex::find(const CardUID& uid, UidMatchFn match, const void* context) const {
+    if (slots.empty()) return -1;
+    
+    uint32_t hash = uid.hash();
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i].value >= 0; i = (i + 1) & mask) {
+        if (slots[i].hash == hash && match(slots[i].value, uid, context)) {
+            return slots[i].value;
+        }
+    }
+    return -1; // Not found
+}
+
+bool UidIndex::remove(const CardUID& uid, UidMatchFn match, const void* context) {
+    if (slots.empty()) return false;
+    
+    uint32_t hash = uid.hash();
+    size_t mask = slots.size() - 1;
+    size_t hole = hash & mask;
+    while (true) {
+        if (slots[hole].value < 0) return false;
+        if (slots[hole].hash == hash && match(slots[hole].value, uid, context)) break;
+        hole = (hole + 1) & mask;
+    }
+    
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole so lookups never need tombstones
+    size_t next = (hole + 1) & mask;
+    while (slots[next].value >= 0) {
+        size_t home = slots[next].hash & mask;
+        bool movable = (hole <= next) ? (home <= hole || home > next)
+                                      : (home <= hole && home > next);
+        if (movable) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    slots[hole].value = -1;
+    count--;
+    return true;
+}
+
+void UidIndex::renumber(int32_t fromIndex, int32_t delta) {
+    // Keep stored indices in step with a vector insert/erase at fromIndex
+    for (Slot& slot : slots) {
+        if (slot.value >= fromIndex) {
+            slot.value += delta;
+        }
+    }
+}
+
+void UidIndex::rehash(size_t newCapacity) {
+    std::vector<Slot> old;
+    old.swap(slots);
+    
+    Slot empty;
+    empty.hash = 0;
+    empty.value = -1;
+    slots.assign(newCapacity, empty);
+    
+    for (const Slot& slot : old) {
+        if (slot.value >= 0) {
+            place(slot);
+        }
+    }
+}
+
+void UidIndex::place(const Slot& slot) {
+    size_t mask = slots.size() - 1;
+    size_t i = slot.hash & mask;
+    while (slots[i].value >= 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+}
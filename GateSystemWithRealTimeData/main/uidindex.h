@@ -0,0 +1,49 @@
+#ifndef UIDINDEX_H
+#define UIDINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "carduid.h"
+
+// ================== UID Index Configuration ==================
+#define UID_INDEX_MIN_SLOTS  16
+#define UID_INDEX_MAX_LOAD   70   // Grow when more than 70% of slots are used
+
+// Called on a hash hit to confirm that the user stored at userIndex really
+// has this UID. Slots only keep the hash, the key bytes live in the user table
+// that `context` points to (nullptr for the global user vectors).
+typedef bool (*UidMatchFn)(int32_t userIndex, const CardUID& uid, const void* context);
+
+// ================== UID Hash Index ==================
+// Open-addressing hash table (linear probing, backward-shift deletion) that
+// maps a binary card UID to a combined user index (static users first, then
+// dynamic users). Each slot costs 8 bytes and lookups are O(1) on average.
+class UidIndex {
+public:
+    UidIndex();
+    
+    void clear();
+    void reserve(size_t count);
+    void insert(const CardUID& uid, int32_t userIndex);
+    int32_t find(const CardUID& uid, UidMatchFn match, const void* context = nullptr) const;
+    bool remove(const CardUID& uid, UidMatchFn match, const void* context = nullptr);
+    void renumber(int32_t fromIndex, int32_t delta);
+    
+    size_t size() const { return count; }
+    size_t capacity() const { return slots.size(); }
+    
+private:
+    struct Slot {
+        uint32_t hash;
+        int32_t value;  // -1 = empty
+    };
+    
+    std::vector<Slot> slots;
+    size_t count;
+    
+    void rehash(size_t newCapacity);
+    void place(const Slot& slot);
+};
+
+#endif // UIDINDEX_H
@@ -0,0 +1,44 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdint.h>
+#include "carduid.h"
+
+// ================== User Data Structures ==================
+// Without Arduino headers, so host programs can build against them
+enum UserType : uint8_t {
+    USER_STATIC = 0,
+    USER_DYNAMIC = 1,
+    USER_ROSTER = 2     // Read-only roster partition entry, see roster.h
+};
+
+// Fields of a User that differ from its NVS record
+enum UserDirtyFlags : uint8_t {
+    USER_DIRTY_UID    = 0x01,
+    USER_DIRTY_NAME   = 0x02,
+    USER_DIRTY_CREDIT = 0x04,
+    USER_DIRTY_IN     = 0x08,
+    USER_DIRTY_ALL    = 0x0F
+};
+
+#define USER_SLOT_NONE 0xFFFF  // Not yet stored in NVS
+
+const long COST_PER_EXIT = 3000;    // 3,000 VND per exit
+
+struct User {
+    CardUID uid;
+    const char* name;  // In the table's NameArena, or the mapped roster image
+    long credit;
+    bool in;        // true = IN, false = OUT
+    UserType type;
+    uint16_t slot;  // Stable user table record slot (see userstore.h)
+    uint8_t dirty;  // UserDirtyFlags not yet written to NVS
+    
+    User() : uid(), name(""), credit(100000), in(false), type(USER_DYNAMIC),
+             slot(USER_SLOT_NONE), dirty(USER_DIRTY_ALL) {}
+    User(const CardUID& u, const char* n, long c, bool i, UserType t) 
+        : uid(u), name(n), credit(c), in(i), type(t),
+          slot(USER_SLOT_NONE), dirty(USER_DIRTY_ALL) {}
+};
+
+#endif // USER_H
@@ -0,0 +1,65 @@
+#include "userdigest.h"
+#include <string.h>
+
+// ================== Hash Helpers ==================
+#define FNV_OFFSET  2166136261u
+#define FNV_PRIME   16777619u
+
+static uint32_t fnvByte(uint32_t hash, uint8_t byte) {
+    return (hash ^ byte) * FNV_PRIME;
+}
+
+static uint32_t fnvWord(uint32_t hash, uint32_t word) {
+    for (int i = 0; i < 4; i++) {
+        hash = fnvByte(hash, word >> (8 * i));
+    }
+    return hash;
+}
+
+// ================== User Digest ==================
+void UserDigest::clear() {
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void UserDigest::update(const CardUID& uid, uint32_t oldHash, uint32_t newHash) {
+    buckets[bucketOf(uid)] ^= oldHash ^ newHash;
+}
+
+uint32_t UserDigest::group(uint8_t index) const {
+    uint32_t hash = FNV_OFFSET;
+    for (int i = 0; i < DIGEST_FANOUT; i++) {
+        hash = fnvWord(hash, buckets[index * DIGEST_FANOUT + i]);
+    }
+    return hash;
+}
+
+uint32_t UserDigest::root() const {
+    uint32_t hash = FNV_OFFSET;
+    for (int i = 0; i < DIGEST_BUCKETS / DIGEST_FANOUT; i++) {
+        hash = fnvWord(hash, group(i));
+    }
+    return hash;
+}
+
+// FNV-1a over uid size, uid bytes, name (cut on a UTF-8 boundary), a NUL,
+// credit as a little-endian int32 and the presence flag
+uint32_t UserDigest::recordHash(const CardUID& uid, const char* name, long credit, bool in) {
+    uint32_t hash = fnvByte(FNV_OFFSET, uid.size);
+    for (uint8_t i = 0; i < uid.size; i++) {
+        hash = fnvByte(hash, uid.bytes[i]);
+    }
+    
+    size_t length = strnlen(name, DIGEST_NAME_MAX + 1);
+    if (length > DIGEST_NAME_MAX) {
+        length = DIGEST_NAME_MAX;
+        while (length > 0 && (name[length] & 0xC0) == 0x80) length--;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash = fnvByte(hash, name[i]);
+    }
+    hash = fnvByte(hash, 0);
+    
+    hash = fnvWord(hash, (uint32_t)(int32_t)credit);
+    hash = fnvByte(hash, in ? 1 : 0);
+    return hash;
+}
@@ -0,0 +1,43 @@
+#ifndef USERDIGEST_H
+#define USERDIGEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "carduid.h"
+
+// ================== User Digest Configuration ==================
+#define DIGEST_BUCKETS   256   // Leaves, chosen by CardUID::hash()
+#define DIGEST_FANOUT    16    // Buckets per group, groups under the root
+#define DIGEST_NAME_MAX  31    // Name bytes hashed, as a user record holds them
+
+// ================== User Digest ==================
+// Two-level hash tree over every user, for anti-entropy with the server.
+// A bucket is the XOR of the record hashes of its users, so adding,
+// removing or changing a user updates one bucket in constant time and the
+// result does not depend on order. Group and root hashes are FNV-1a over
+// the little-endian hashes below them and are computed when asked for.
+//
+// admin-panel/server.js hashes users.json the same way; a check costs the
+// root plus DIGEST_FANOUT group hashes, and only buckets that differ are
+// fetched and repaired.
+class UserDigest {
+public:
+    UserDigest() { clear(); }
+    
+    void clear();
+    // Pass 0 as oldHash for an added user and as newHash for a removed one
+    void update(const CardUID& uid, uint32_t oldHash, uint32_t newHash);
+    
+    uint32_t bucket(uint16_t index) const { return buckets[index]; }
+    void setBucket(uint16_t index, uint32_t hash) { buckets[index] = hash; }
+    uint32_t group(uint8_t index) const;
+    uint32_t root() const;
+    
+    static uint16_t bucketOf(const CardUID& uid) { return uid.hash() % DIGEST_BUCKETS; }
+    static uint32_t recordHash(const CardUID& uid, const char* name, long credit, bool in);
+    
+private:
+    uint32_t buckets[DIGEST_BUCKETS];
+};
+
+#endif // USERDIGEST_H
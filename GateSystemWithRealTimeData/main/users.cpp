@@ -1,37 +1,419 @@
 #include "users.h"
+#include <algorithm>
 #include "hardware.h"
 #include "display.h"
 #include "network.h"
+#include "userstore.h"
+#include "journal.h"
+#include "roster.h"
+#include "userdigest.h"
+#include "syncscans.h"
+#include "tasks.h"
 
 // ================== User Management State ==================
-std::vector<User> staticUsers;
-std::vector<User> dynamicUsers;
 bool inputModeActive = false;
 LastScanResult lastScan;
+static portMUX_TYPE lastScanMux = portMUX_INITIALIZER_UNLOCKED;  // Set by the gate task, read by web handlers
 Preferences userPrefs;
 
+// ================== User Table State ==================
+// Only accessed through std::atomic_load/std::atomic_store
+static UserTablePtr userTable = std::make_shared<UserTable>();
+static SemaphoreHandle_t userTableMutex = nullptr;  // Recursive
+static SemaphoreHandle_t userStoreMutex = nullptr;  // Recursive, see users.h
+
+// Users scanned while a sync builds the next table or roster image, see
+// syncscans.h. Only used under the table lock.
+static SyncScanLog syncScans;
+
+// ================== User Table Access ==================
+UserTablePtr acquireUserTable() {
+    return std::atomic_load(&userTable);
+}
+
+// Caller holds the table lock
+static void publishUserTable(const UserTablePtr& table) {
+    std::atomic_store(&userTable, table);
+}
+
+void lockUserTable() {
+    if (userTableMutex) xSemaphoreTakeRecursive(userTableMutex, portMAX_DELAY);
+}
+
+void unlockUserTable() {
+    if (userTableMutex) xSemaphoreGiveRecursive(userTableMutex);
+}
+
+void lockUserStore() {
+    if (userStoreMutex) xSemaphoreTakeRecursive(userStoreMutex, portMAX_DELAY);
+}
+
+void unlockUserStore() {
+    if (userStoreMutex) xSemaphoreGiveRecursive(userStoreMutex);
+}
+
+// Copy of the current table for a writer to change and publish
+static UserTablePtr copyUserTable() {
+    return std::make_shared<UserTable>(*acquireUserTable());
+}
+
+// ================== User Order ==================
+// UserTable::order keeps table positions sorted by UID so that a user page
+// can start at any UID with a binary search.
+struct PositionLess {
+    UserTable& table;
+    bool operator()(int32_t a, int32_t b) const { return table.at(a)->uid < table.at(b)->uid; }
+};
+
+static void rebuildUserOrder(UserTable& table) {
+    table.order.resize(table.size());
+    for (int i = 0; i < table.size(); i++) {
+        table.order[i] = i;
+    }
+    std::sort(table.order.begin(), table.order.end(), PositionLess{table});
+}
+
+// The user at `position` was just inserted, moving later ones up by one
+static void insertUserOrder(UserTable& table, int position) {
+    for (int32_t& p : table.order) {
+        if (p >= position) p++;
+    }
+    auto it = std::upper_bound(table.order.begin(), table.order.end(), position, PositionLess{table});
+    table.order.insert(it, position);
+}
+
+// The user at `position` is about to be removed
+static void eraseUserOrder(UserTable& table, int position) {
+    table.order.erase(std::remove(table.order.begin(), table.order.end(), position), table.order.end());
+    for (int32_t& p : table.order) {
+        if (p > position) p--;
+    }
+}
+
+// First entry of table.order past `uid`
+static size_t userOrderAfter(UserTable& table, const CardUID& uid) {
+    size_t low = 0, high = table.order.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (uid < table.at(table.order[mid])->uid) high = mid;
+        else low = mid + 1;
+    }
+    return low;
+}
+
+// ================== Presence Index ==================
+// Sorted UIDs of the users inside, table and roster alike, so "who is in"
+// pages never walk the whole roster. Changed under the table lock.
+static std::vector<CardUID> insideUsers;
+
+static void notePresence(const CardUID& uid, bool in) {
+    lockUserTable();
+    auto it = std::lower_bound(insideUsers.begin(), insideUsers.end(), uid);
+    bool listed = it != insideUsers.end() && *it == uid;
+    if (in && !listed) {
+        insideUsers.insert(it, uid);
+    } else if (!in && listed) {
+        insideUsers.erase(it);
+    }
+    unlockUserTable();
+}
+
+size_t getInsideUserCount() {
+    lockUserTable();
+    size_t count = insideUsers.size();
+    unlockUserTable();
+    return count;
+}
+
+// ================== User Digest ==================
+// Hash tree over every user for anti-entropy checks with the server, see
+// userdigest.h. Changed under the table lock.
+static UserDigest userDigest;
+static uint32_t userDigestGeneration = 0;  // Counts changes to userDigest
+
+static uint32_t userDigestHash(const User& user) {
+    return UserDigest::recordHash(user.uid, user.name, user.credit, user.in);
+}
+
+// oldHash 0: the user was added; newHash 0: it was removed
+static void noteUserDigest(const CardUID& uid, uint32_t oldHash, uint32_t newHash) {
+    lockUserTable();
+    userDigest.update(uid, oldHash, newHash);
+    userDigestGeneration++;
+    unlockUserTable();
+}
+
+// ================== Summary Rebuild ==================
+// Presence index and digest from scratch, after loads and syncs, which
+// change many users at once. They are built beside the live ones and
+// swapped in at the end. The table is read in one go, the roster one batch
+// per table lock, so scans are not held up by a walk over the whole
+// roster; a scan of a user the build has already read updates both.
+static std::vector<CardUID> builtInside;     // Unsorted until swapped in
+static UserDigest builtDigest;
+static bool summariesBuilding = false;
+static uint32_t builtRosterUsers = 0;       // Roster users read, in UID order
+
+// Caller holds the table lock
+static bool isSummaryBuilt(const User& user) {
+    if (!summariesBuilding) return false;
+    if (user.type != USER_ROSTER) return true;
+    return getRosterIndexAfter(user.uid) <= builtRosterUsers;
+}
+
+static void noteBuiltUser(const User& user) {
+    if (user.in) builtInside.push_back(user.uid);
+    builtDigest.update(user.uid, 0, userDigestHash(user));
+}
+
+// A scan changed `user` during a build; caller holds the table lock
+static void noteBuiltChange(const User& user, bool wasIn, uint32_t oldHash) {
+    if (!isSummaryBuilt(user)) return;
+    if (user.in && !wasIn) {
+        builtInside.push_back(user.uid);
+    } else if (!user.in && wasIn) {
+        builtInside.erase(std::remove(builtInside.begin(), builtInside.end(), user.uid), builtInside.end());
+    }
+    builtDigest.update(user.uid, oldHash, userDigestHash(user));
+}
+
+static void rebuildUserSummaries() {
+    // Nothing can publish a table or roster image meanwhile
+    lockUserStore();
+    lockUserTable();
+    UserTablePtr table = acquireUserTable();
+    builtInside.clear();
+    builtDigest.clear();
+    for (int i = 0; i < table->size(); i++) {
+        noteBuiltUser(*table->at(i));
+    }
+    builtRosterUsers = 0;
+    summariesBuilding = true;
+    unlockUserTable();
+    
+    User rosterUsers[ROSTER_READ_BATCH];
+    RosterHold rosterHold;
+    for (;;) {
+        lockUserTable();
+        uint32_t count = getRosterUsersAt(builtRosterUsers, rosterUsers, ROSTER_READ_BATCH, &rosterHold);
+        for (uint32_t i = 0; i < count; i++) {
+            noteBuiltUser(rosterUsers[i]);
+        }
+        builtRosterUsers += count;
+        bool done = count < ROSTER_READ_BATCH;
+        if (done) {
+            std::sort(builtInside.begin(), builtInside.end());
+            builtInside.erase(std::unique(builtInside.begin(), builtInside.end()), builtInside.end());
+            insideUsers.swap(builtInside);
+            userDigest = builtDigest;
+            userDigestGeneration++;
+            summariesBuilding = false;
+        }
+        unlockUserTable();
+        if (done) break;
+    }
+    builtInside.clear();
+    builtInside.shrink_to_fit();
+    unlockUserStore();
+}
+
+uint32_t getUserDigestRoot() {
+    lockUserTable();
+    uint32_t root = userDigest.root();
+    unlockUserTable();
+    return root;
+}
+
+void getUserDigestGroups(uint32_t* groups) {
+    lockUserTable();
+    for (int i = 0; i < DIGEST_BUCKETS / DIGEST_FANOUT; i++) {
+        groups[i] = userDigest.group(i);
+    }
+    unlockUserTable();
+}
+
+void getUserDigestBuckets(uint8_t group, uint32_t* buckets) {
+    lockUserTable();
+    for (int i = 0; i < DIGEST_FANOUT; i++) {
+        buckets[i] = userDigest.bucket(group * DIGEST_FANOUT + i);
+    }
+    unlockUserTable();
+}
+
+// Users of one bucket with their record hashes, as a JSON array. Scans
+// every user, but is only asked for buckets known to differ. The scan also
+// corrects the stored bucket, which a scan racing a sync can leave off,
+// unless the digest changed while the users were read.
+uint32_t writeUserDigestBucketJson(Print& out, uint16_t bucket) {
+    uint32_t count = 0;
+    uint32_t scanned = 0;
+    
+    out.write('[');
+    auto writeUser = [&](const CardUID& uid, uint32_t hash) {
+        scanned ^= hash;
+        if (count++ > 0) out.write(',');
+        out.print("{\"uid\":\"" + uidToHex(uid) + "\",\"hash\":" + String(hash) + "}");
+    };
+    
+    // Table users are read under the lock and written out after it
+    std::vector<std::pair<CardUID, uint32_t>> tableUsers;
+    lockUserTable();
+    UserTablePtr table = acquireUserTable();
+    uint32_t generation = userDigestGeneration;
+    for (int i = 0; i < table->size(); i++) {
+        const User& user = *table->at(i);
+        if (UserDigest::bucketOf(user.uid) == bucket) {
+            tableUsers.emplace_back(user.uid, userDigestHash(user));
+        }
+    }
+    unlockUserTable();
+    for (const auto& user : tableUsers) {
+        writeUser(user.first, user.second);
+    }
+    
+    User rosterUsers[ROSTER_READ_BATCH];
+    RosterHold rosterHold;
+    for (uint32_t i = 0, n; (n = getRosterUsersAt(i, rosterUsers, ROSTER_READ_BATCH, &rosterHold)) > 0; i += n) {
+        for (uint32_t j = 0; j < n; j++) {
+            if (UserDigest::bucketOf(rosterUsers[j].uid) == bucket) {
+                writeUser(rosterUsers[j].uid, userDigestHash(rosterUsers[j]));
+            }
+        }
+    }
+    out.write(']');
+    
+    lockUserTable();
+    if (table == acquireUserTable() && generation == userDigestGeneration) {
+        userDigest.setBucket(bucket, scanned);
+    }
+    unlockUserTable();
+    return count;
+}
+
+// ================== User Name Storage ==================
+// Bytes of `text` kept as a user name: what a user table record can hold,
+// cut on a UTF-8 character boundary
+static size_t userNameLength(const char* text) {
+    size_t length = strnlen(text, USER_NAME_MAX);
+    if (length > USER_NAME_MAX - 1) {
+        length = USER_NAME_MAX - 1;
+        while (length > 0 && (text[length] & 0xC0) == 0x80) length--;
+    }
+    return length;
+}
+
+const char* storeUserName(NameArena& names, const char* text) {
+    return names.store(text, userNameLength(text));
+}
+
+// True if storing `name` would give `stored` back
+static bool sameUserName(const char* stored, const String& name) {
+    size_t length = userNameLength(name.c_str());
+    return strlen(stored) == length && strncmp(stored, name.c_str(), length) == 0;
+}
+
+// Moves every name of `table` into a fresh arena of its own
+static void rehomeUserNames(UserTable& table) {
+    std::shared_ptr<NameArena> fresh = std::make_shared<NameArena>();
+    for (User& user : table.staticUsers) {
+        user.name = storeUserName(*fresh, user.name);
+    }
+    for (User& user : table.dynamicUsers) {
+        user.name = storeUserName(*fresh, user.name);
+    }
+    table.names = fresh;
+}
+
+// Renames and deletes leave waste behind; drop it once it is half the arena.
+// Older tables keep the old arena alive for as long as readers hold them.
+static void compactUserNames(UserTable& table) {
+    if (table.names->wastedBytes() * 2 > table.names->usedBytes()) {
+        rehomeUserNames(table);
+    }
+}
+
+// Hash hit confirmation for UserTable::index
+static bool tableUIDMatches(int32_t position, const CardUID& uid, const void* context) {
+    User* user = const_cast<UserTable*>(static_cast<const UserTable*>(context))->at(position);
+    return user && user->uid == uid;
+}
+
+int UserTable::indexOf(const CardUID& uid) const {
+    return index.find(uid, tableUIDMatches, this);
+}
+
+User* UserTable::at(int position) {
+    if (position < 0) return nullptr;
+    
+    if (position < (int)staticUsers.size()) {
+        return &staticUsers[position];
+    } else {
+        int dynamicIndex = position - staticUsers.size();
+        if (dynamicIndex < (int)dynamicUsers.size()) {
+            return &dynamicUsers[dynamicIndex];
+        }
+    }
+    
+    return nullptr;
+}
+
+// ================== Unknown Card Filter State ==================
+static uint32_t filterRejectCount = 0;         // Unknown cards stopped by the filters
+static uint32_t filterFalsePositiveCount = 0;  // Passed the filters, then not found
+
 // ================== Card Debounce State ==================
-String lastCardUID = "";
+CardUID lastCardUID;
 unsigned long lastCardTime = 0;
 const unsigned long CARD_DEBOUNCE_MS = 2000; // 2 seconds debounce
 
 // ================== Constants ==================
-const long COST_PER_EXIT = 3000;    // 3,000 VND per exit
 const long DEFAULT_CREDIT = 100000; // 100,000 VND default credit
 const size_t STATIC_COUNT = 0;      // No static users in modular version
 
+// ================== Sync Revision ==================
+static uint32_t userSyncRevision = 0;
+
+// Highest server revision applied, persisted with the users it describes
+uint32_t getUserSyncRevision() {
+    return userSyncRevision;
+}
+
+static void loadUserSyncRevision() {
+    userSyncRevision = userPrefs.getUInt("sync_rev", 0);
+}
+
+static void saveUserSyncRevision(uint32_t revision) {
+    if (revision != userSyncRevision) {
+        userSyncRevision = revision;
+        userPrefs.putUInt("sync_rev", revision);
+    }
+}
+
 // ================== User Management Initialization ==================
 bool initializeUsers() {
     Serial.println("Initializing user management...");
     
+    userTableMutex = xSemaphoreCreateRecursiveMutex();
+    userStoreMutex = xSemaphoreCreateRecursiveMutex();
+    
     if (!userPrefs.begin("users", false)) {
         Serial.println("Failed to initialize user preferences");
         return false;
     }
     loadUsersFromNVS();
+    loadUserSyncRevision();
+    
+    // Credit/presence changes since the last compaction live in the journal.
+    // It mounts LittleFS, which also holds the roster overlay.
+    bool journal = initializeJournal();
+    initializeRoster();
+    if (journal) {
+        replayJournal();
+    }
+    rebuildUserSummaries();
     
-    Serial.printf("Loaded %d static users, %d dynamic users\n", 
-                  staticUsers.size(), dynamicUsers.size());
+    Serial.printf("Loaded %d static users, %d dynamic users, %lu roster users\n", 
+                  getStaticUserCount(), getDynamicUserCount(), (unsigned long)getRosterUserCount());
     Serial.println("User management initialized");
     return true;
 }
@@ -81,242 +463,284 @@ String normalizeUID(const String& uid) {
 }
 
 void loadUsersFromNVS() {
-    // Load static users
-    size_t staticCount = userPrefs.getUInt("static_count", 0);
-    staticUsers.clear();
-    staticUsers.reserve(staticCount);
+    UserTablePtr loaded = std::make_shared<UserTable>();
     
-    for (size_t i = 0; i < staticCount; i++) {
-        String keyPrefix = "s" + String(i) + "_";
-        
-        String uid = userPrefs.getString((keyPrefix + "uid").c_str(), "");
-        String name = userPrefs.getString((keyPrefix + "name").c_str(), "");
-        long credit = userPrefs.getLong((keyPrefix + "credit").c_str(), DEFAULT_CREDIT);
-        bool in = userPrefs.getBool((keyPrefix + "in").c_str(), false);
-        
-        if (uid.length() > 0 && name.length() > 0) {
-            staticUsers.emplace_back(uid, name, credit, in, USER_STATIC);
+    lockUserStore();
+    loadUserTable(loaded->staticUsers, loaded->dynamicUsers, *loaded->names);
+    rebuildUserIndex(*loaded);
+    lockUserTable();
+    publishUserTable(loaded);
+    unlockUserTable();
+    unlockUserStore();
+}
+
+bool saveUsersToBothNVS() {
+    bool ok = saveStaticUsersToNVS();
+    ok &= saveDynamicUsersToNVS();
+    ok &= saveRosterOverlay();
+    return ok;
+}
+
+// Only records marked dirty are written, see userstore.h. They are copied
+// and marked clean under the table lock and written without it, so scans
+// go on meanwhile; a user scanned during the write is dirty again after
+// it, and a record that failed to write is marked dirty again.
+static bool saveDirtyUsers(UserType type) {
+    lockUserStore();
+    UserTablePtr table = acquireUserTable();
+    std::vector<User>& users = type == USER_STATIC ? table->staticUsers : table->dynamicUsers;
+    std::vector<User> pending;
+    lockUserTable();
+    for (User& user : users) {
+        if (user.dirty) {
+            pending.push_back(user);
+            user.dirty = 0;
         }
     }
+    unlockUserTable();
+    if (pending.empty()) {
+        unlockUserStore();
+        return true;
+    }
     
-    // Load dynamic users
-    size_t dynamicCount = userPrefs.getUInt("dynamic_count", 0);
-    dynamicUsers.clear();
-    dynamicUsers.reserve(dynamicCount);
+    saveDirtyUserRecords(pending);
     
-    for (size_t i = 0; i < dynamicCount; i++) {
-        String keyPrefix = "d" + String(i) + "_";
-        
-        String uid = userPrefs.getString((keyPrefix + "uid").c_str(), "");
-        String name = userPrefs.getString((keyPrefix + "name").c_str(), "");
-        long credit = userPrefs.getLong((keyPrefix + "credit").c_str(), DEFAULT_CREDIT);
-        bool in = userPrefs.getBool((keyPrefix + "in").c_str(), false);
-        
-        if (uid.length() > 0 && name.length() > 0) {
-            dynamicUsers.emplace_back(uid, name, credit, in, USER_DYNAMIC);
+    // Publishing takes the store lock, so `table` is still the current one
+    bool ok = true;
+    lockUserTable();
+    for (const User& saved : pending) {
+        User* user = table->find(saved.uid);
+        if (!user) continue;
+        user->slot = saved.slot;
+        if (saved.dirty) {
+            user->dirty |= saved.dirty;
+            ok = false;
         }
     }
+    unlockUserTable();
+    unlockUserStore();
+    return ok;
 }
 
-void saveUsersToBothNVS() {
-    saveStaticUsersToNVS();
-    saveDynamicUsersToNVS();
+bool saveDynamicUsersToNVS() {
+    return saveDirtyUsers(USER_DYNAMIC);
 }
 
-void saveDynamicUsersToNVS() {
-    // Clear old dynamic user data
-    size_t oldCount = userPrefs.getUInt("dynamic_count", 0);
-    for (size_t i = 0; i < oldCount; i++) {
-        String keyPrefix = "d" + String(i) + "_";
-        userPrefs.remove((keyPrefix + "uid").c_str());
-        userPrefs.remove((keyPrefix + "name").c_str());
-        userPrefs.remove((keyPrefix + "credit").c_str());
-        userPrefs.remove((keyPrefix + "in").c_str());
-    }
-    
-    // Save new dynamic user data
-    userPrefs.putUInt("dynamic_count", dynamicUsers.size());
-    for (size_t i = 0; i < dynamicUsers.size(); i++) {
-        String keyPrefix = "d" + String(i) + "_";
-        const User& user = dynamicUsers[i];
-        
-        userPrefs.putString((keyPrefix + "uid").c_str(), user.uid);
-        userPrefs.putString((keyPrefix + "name").c_str(), user.name);
-        userPrefs.putLong((keyPrefix + "credit").c_str(), user.credit);
-        userPrefs.putBool((keyPrefix + "in").c_str(), user.in);
-    }
+bool saveStaticUsersToNVS() {
+    return saveDirtyUsers(USER_STATIC);
 }
 
-void saveStaticUsersToNVS() {
-    // Clear old static user data
-    size_t oldCount = userPrefs.getUInt("static_count", 0);
-    for (size_t i = 0; i < oldCount; i++) {
-        String keyPrefix = "s" + String(i) + "_";
-        userPrefs.remove((keyPrefix + "uid").c_str());
-        userPrefs.remove((keyPrefix + "name").c_str());
-        userPrefs.remove((keyPrefix + "credit").c_str());
-        userPrefs.remove((keyPrefix + "in").c_str());
+bool hasDirtyUsers() {
+    UserTablePtr table = acquireUserTable();
+    for (const User& user : table->staticUsers) {
+        if (user.dirty) return true;
     }
-    
-    // Save new static user data
-    userPrefs.putUInt("static_count", staticUsers.size());
-    for (size_t i = 0; i < staticUsers.size(); i++) {
-        String keyPrefix = "s" + String(i) + "_";
-        const User& user = staticUsers[i];
-        
-        userPrefs.putString((keyPrefix + "uid").c_str(), user.uid);
-        userPrefs.putString((keyPrefix + "name").c_str(), user.name);
-        userPrefs.putLong((keyPrefix + "credit").c_str(), user.credit);
-        userPrefs.putBool((keyPrefix + "in").c_str(), user.in);
+    for (const User& user : table->dynamicUsers) {
+        if (user.dirty) return true;
     }
+    return isRosterOverlayDirty();
 }
 
 // ================== User Query Functions ==================
-int findUserByUID(const String& uid) {
-    String normalizedUID = normalizeUID(uid);
-    
-    // Check static users first
-    for (size_t i = 0; i < staticUsers.size(); i++) {
-        if (staticUsers[i].uid == normalizedUID) {
-            return (int)i;
-        }
-    }
-    
-    // Check dynamic users
-    for (size_t i = 0; i < dynamicUsers.size(); i++) {
-        if (dynamicUsers[i].uid == normalizedUID) {
-            return (int)(staticUsers.size() + i);
-        }
-    }
-    
-    return -1; // Not found
+int findUserByUID(const CardUID& uid) {
+    return acquireUserTable()->indexOf(uid);
 }
 
-User* getUserByUID(const String& uid) {
-    int index = findUserByUID(uid);
-    if (index < 0) return nullptr;
-    
-    if (index < (int)staticUsers.size()) {
-        return &staticUsers[index];
-    } else {
-        return &dynamicUsers[index - staticUsers.size()];
-    }
+User* getUserByUID(const CardUID& uid) {
+    return acquireUserTable()->find(uid);
 }
 
 User* getUserByIndex(int index) {
-    if (index < 0) return nullptr;
-    
-    if (index < (int)staticUsers.size()) {
-        return &staticUsers[index];
-    } else {
-        int dynamicIndex = index - staticUsers.size();
-        if (dynamicIndex < (int)dynamicUsers.size()) {
-            return &dynamicUsers[dynamicIndex];
-        }
-    }
-    
-    return nullptr;
+    return acquireUserTable()->at(index);
 }
 
 int getTotalUserCount() {
-    return staticUsers.size() + dynamicUsers.size();
+    return acquireUserTable()->size();
 }
 
 int getStaticUserCount() {
-    return staticUsers.size();
+    return acquireUserTable()->staticUsers.size();
 }
 
 int getDynamicUserCount() {
-    return dynamicUsers.size();
+    return acquireUserTable()->dynamicUsers.size();
 }
 
 // ================== User CRUD Functions ==================
-bool addUser(const String& uid, const String& name, long credit, UserType type) {
-    String normalizedUID = normalizeUID(uid);
-    
-    if (!isValidUID(normalizedUID)) {
-        Serial.println("Invalid UID format: " + uid);
+bool addUser(const CardUID& uid, const String& name, long credit, UserType type) {
+    if (!uid.isValid()) {
+        Serial.println("Invalid UID format: " + uidToHex(uid));
         return false;
     }
     
     // Check if user already exists
-    if (findUserByUID(normalizedUID) >= 0) {
-        Serial.println("User already exists: " + normalizedUID);
+    if (findUserByUID(uid) >= 0 || rosterContains(uid)) {
+        Serial.println("User already exists: " + uidToHex(uid));
         return false;
     }
     
-    User newUser(normalizedUID, name, credit, false, type);
+    lockUserStore();
+    
+    // A re-added UID must not pick up journal entries of its previous owner
+    compactJournal();
+    
+    lockUserTable();
+    UserTablePtr table = copyUserTable();
+    User newUser(uid, storeUserName(*table->names, name.c_str()), credit, false, type);
     
     if (type == USER_STATIC) {
-        staticUsers.push_back(newUser);
-        saveStaticUsersToNVS();
+        // Dynamic users sit behind the static ones in the combined index
+        int newIndex = table->staticUsers.size();
+        table->index.renumber(newIndex, 1);
+        table->staticUsers.push_back(newUser);
+        table->index.insert(uid, newIndex);
+        insertUserOrder(*table, newIndex);
     } else {
-        dynamicUsers.push_back(newUser);
-        saveDynamicUsersToNVS();
+        table->dynamicUsers.push_back(newUser);
+        table->index.insert(uid, table->size() - 1);
+        insertUserOrder(*table, table->size() - 1);
+    }
+    if (!table->filter.insert(uid)) {
+        rebuildUserIndex(*table); // Filter full - regrow it
     }
+    noteUserDigest(uid, 0, userDigestHash(newUser));
+    
+    publishUserTable(table);
+    unlockUserTable();
+    saveDirtyUsers(type);
+    unlockUserStore();
     
-    Serial.println("Added user: " + name + " (" + normalizedUID + ")");
+    Serial.println("Added user: " + name + " (" + uidToHex(uid) + ")");
     return true;
 }
 
-bool updateUser(const String& uid, const String& name, long credit, bool in) {
-    User* user = getUserByUID(uid);
-    if (!user) {
-        Serial.println("User not found for update: " + uid);
+bool updateUser(const CardUID& uid, const String& name, long credit, bool in) {
+    lockUserStore();
+    
+    if (findUserByUID(uid) < 0) {
+        unlockUserStore();
+        Serial.println("User not found for update: " + uidToHex(uid));
         return false;
     }
     
-    if (name.length() > 0) {
-        user->name = name;
+    // Compact before copying so the copy carries no pending changes. Names
+    // are not safe to change under a reader, so the copy gets edited.
+    compactJournal();
+    lockUserTable();
+    UserTablePtr table = copyUserTable();
+    User* user = table->find(uid);
+    uint32_t oldHash = userDigestHash(*user);
+    
+    if (name.length() > 0 && !sameUserName(user->name, name)) {
+        table->names->release(user->name);
+        user->name = storeUserName(*table->names, name.c_str());
+        user->dirty |= USER_DIRTY_NAME;
     }
-    if (credit >= 0) {
+    if (credit >= 0 && credit != user->credit) {
         user->credit = credit;
+        user->dirty |= USER_DIRTY_CREDIT;
     }
-    user->in = in;
-    
-    // Save to appropriate storage
-    if (user->type == USER_STATIC) {
-        saveStaticUsersToNVS();
-    } else {
-        saveDynamicUsersToNVS();
+    if (in != user->in) {
+        user->in = in;
+        user->dirty |= USER_DIRTY_IN;
     }
+    notePresence(uid, in);
+    noteUserDigest(uid, oldHash, userDigestHash(*user));
     
-    Serial.println("Updated user: " + user->name + " (" + user->uid + ")");
+    UserType type = user->type;
+    compactUserNames(*table);
+    publishUserTable(table);
+    unlockUserTable();
+    saveDirtyUsers(type);
+    unlockUserStore();
+    
+    Serial.printf("Updated user: %s (%s)\n", table->find(uid)->name, uidToHex(uid).c_str());
     return true;
 }
 
-bool deleteUser(const String& uid) {
-    String normalizedUID = normalizeUID(uid);
+bool deleteUser(const CardUID& uid) {
+    lockUserStore();
     
-    // Check static users
-    for (auto it = staticUsers.begin(); it != staticUsers.end(); ++it) {
-        if (it->uid == normalizedUID) {
-            Serial.println("Deleted static user: " + it->name + " (" + it->uid + ")");
-            staticUsers.erase(it);
-            saveStaticUsersToNVS();
-            return true;
-        }
+    int index = findUserByUID(uid);
+    if (index < 0) {
+        unlockUserStore();
+        Serial.println("User not found for deletion: " + uidToHex(uid));
+        return false;
     }
     
-    // Check dynamic users
-    for (auto it = dynamicUsers.begin(); it != dynamicUsers.end(); ++it) {
-        if (it->uid == normalizedUID) {
-            Serial.println("Deleted dynamic user: " + it->name + " (" + it->uid + ")");
-            dynamicUsers.erase(it);
-            saveDynamicUsersToNVS();
-            return true;
-        }
+    compactJournal();
+    
+    // The record goes first: one that cannot be erased would bring the user
+    // back on the next boot, so the user stays
+    User removed = *acquireUserTable()->at(index);
+    if (!eraseUserRecord(removed)) {
+        unlockUserStore();
+        Serial.println("Failed to erase user record: " + uidToHex(uid));
+        return false;
     }
     
-    Serial.println("User not found for deletion: " + normalizedUID);
-    return false;
+    lockUserTable();
+    UserTablePtr table = copyUserTable();
+    
+    // Drop the index entry while the user is still in place for the match check
+    table->index.remove(uid, tableUIDMatches, table.get());
+    table->index.renumber(index + 1, -1);
+    table->filter.remove(uid);
+    eraseUserOrder(*table, index);
+    notePresence(uid, false);
+    noteUserDigest(uid, userDigestHash(*table->at(index)), 0);
+    
+    if (index < (int)table->staticUsers.size()) {
+        auto it = table->staticUsers.begin() + index;
+        Serial.printf("Deleted static user: %s (%s)\n", it->name, uidToHex(it->uid).c_str());
+        table->names->release(it->name);
+        table->staticUsers.erase(it);
+    } else {
+        auto it = table->dynamicUsers.begin() + (index - table->staticUsers.size());
+        Serial.printf("Deleted dynamic user: %s (%s)\n", it->name, uidToHex(it->uid).c_str());
+        table->names->release(it->name);
+        table->dynamicUsers.erase(it);
+    }
+    
+    compactUserNames(*table);
+    publishUserTable(table);
+    unlockUserTable();
+    unlockUserStore();
+    return true;
 }
 
 void clearDynamicUsers() {
-    int count = dynamicUsers.size();
-    dynamicUsers.clear();
-    saveDynamicUsersToNVS();
-    Serial.printf("Cleared %d dynamic users\n", count);
+    lockUserStore();
+    
+    compactJournal();
+    
+    // Records first: users whose record cannot be erased stay, as they
+    // would come back from NVS on the next boot
+    UserTablePtr live = acquireUserTable();
+    std::vector<User> gone = live->dynamicUsers;
+    bool erased = eraseUserRecords(gone);
+    
+    lockUserTable();
+    UserTablePtr table = std::make_shared<UserTable>();
+    table->staticUsers = live->staticUsers;
+    for (const User& user : gone) {
+        if (user.slot != USER_SLOT_NONE) {
+            table->dynamicUsers.push_back(*live->find(user.uid));
+        }
+    }
+    rehomeUserNames(*table);
+    rebuildUserIndex(*table);
+    publishUserTable(table);
+    unlockUserTable();
+    
+    rebuildUserSummaries();
+    unlockUserStore();
+    if (erased) {
+        Serial.printf("Cleared %u dynamic users\n", (unsigned)gone.size());
+    } else {
+        Serial.printf("Cleared dynamic users - %d kept, their records could not be erased\n",
+                      (int)table->dynamicUsers.size());
+    }
 }
 
 // ================== RFID Processing Functions ==================
@@ -331,17 +755,44 @@ String uidToHex(const MFRC522::Uid& uid) {
     return result;
 }
 
+String uidToHex(const CardUID& uid) {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    char buf[UID_MAX_BYTES * 3];
+    size_t pos = 0;
+    for (uint8_t i = 0; i < uid.size; i++) {
+        buf[pos++] = HEX_DIGITS[uid.bytes[i] >> 4];
+        buf[pos++] = HEX_DIGITS[uid.bytes[i] & 0x0F];
+        if (i + 1 != uid.size) buf[pos++] = ':';
+    }
+    buf[pos] = '\0';
+    return String(buf);
+}
+
+CardUID uidFromMFRC522(const MFRC522::Uid& uid) {
+    return CardUID(uid.uidByte, uid.size);
+}
+
+// In IRQ mode a card has already answered the REQA from armRFIDReceive()
+// when the interrupt fires, so only the select is left
+static unsigned long lastFallbackPollMs = 0;
+
 bool isCardPresent() {
+    if (isRFIDInterruptActive()) {
+        if (takeRFIDInterrupt()) return rfid.PICC_ReadCardSerial();
+        if (millis() - lastFallbackPollMs < RFID_FALLBACK_POLL_MS) return false;
+        lastFallbackPollMs = millis();
+        noteRFIDReaderUsed();
+    }
     return rfid.PICC_IsNewCardPresent() && rfid.PICC_ReadCardSerial();
 }
 
-String readRFIDCard() {
+CardUID readRFIDCard() {
     if (!isCardPresent()) {
-        return String();
+        return CardUID();
     }
     
-    String uid = uidToHex(rfid.uid);
-    Serial.println("RFID Card detected: " + uid);
+    CardUID uid = uidFromMFRC522(rfid.uid);
+    Serial.println("RFID Card detected: " + uidToHex(uid));
     
     rfid.PICC_HaltA(); // Stop reading
     rfid.PCD_StopCrypto1();
@@ -349,6 +800,60 @@ String readRFIDCard() {
     return uid;
 }
 
+static bool isUIDSeparator(char c) {
+    return c == ':' || c == '-' || c == '_';
+}
+
+// Parses any UID spelling accepted by normalizeUID ("f3:6d:79:0c", "F3-6D-79-0C",
+// "F36D790C", ...) straight into a CardUID, without heap allocations
+bool parseUID(const String& uid, CardUID& out) {
+    bool separated = false;
+    for (unsigned int i = 0; i < uid.length(); i++) {
+        if (isUIDSeparator(uid[i])) {
+            separated = true;
+            break;
+        }
+    }
+    
+    CardUID parsed;
+    uint8_t len = 0;
+    uint8_t pending = 0;
+    bool highNibble = true;
+    for (unsigned int i = 0; i < uid.length(); i++) {
+        char c = uid[i];
+        if (isUIDSeparator(c)) {
+            // A separator must close exactly one complete byte
+            if (!highNibble || len == 0 || isUIDSeparator(uid[i - 1]) || i + 1 == uid.length()) {
+                return false;
+            }
+            continue;
+        }
+        
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else return false;
+        
+        if (highNibble) {
+            if (len == UID_MAX_BYTES) return false;
+            // With separators every part must be exactly two hex digits
+            if (separated && len > 0 && !isUIDSeparator(uid[i - 1])) {
+                return false;
+            }
+            pending = nibble << 4;
+        } else {
+            parsed.bytes[len++] = pending | nibble;
+        }
+        highNibble = !highNibble;
+    }
+    
+    if (!highNibble || len < UID_MIN_BYTES) return false; // Need at least 4 bytes
+    parsed.size = len;
+    out = parsed;
+    return true;
+}
+
 bool isValidUID(const String& uid) {
     if (uid.length() < 8) return false;
     
@@ -367,71 +872,120 @@ bool isValidUID(const String& uid) {
 }
 
 // ================== Card Processing Functions ==================
-bool processCardScan(const String& uid) {
-    Serial.println("Processing card scan for UID: " + uid);
-    String normalizedUID = normalizeUID(uid);
+// RTC unix time of a scan, 0 if the RTC is not set
+static uint32_t scanTimestamp() {
+    DateTime now = rtc.now();
+    return now.year() >= 2023 ? now.unixtime() : 0;
+}
+
+static void recordUserState(const User& user, uint32_t timestamp) {
+    // Save changes locally FIRST (offline-first approach) - one small
+    // journal append; the user table is rewritten at compaction. Without
+    // the journal the user stays dirty and the network task writes it.
+    if (journalAppend(user, timestamp)) {
+        Serial.println("✓ User state saved locally to journal");
+    } else {
+        Serial.println("⚠ Journal unavailable - User state saved to NVS by the network task");
+    }
     
+    // Sync changes to server from the network task, so a slow or
+    // unreachable server never holds up the gate
+    if (!queueUserUpdate(user, timestamp)) {
+        Serial.println("⚠ Network queue full - User data saved locally only");
+    }
+}
+
+bool processCardScan(const CardUID& uid) {
     // Card debounce - ignore same card within 2 seconds
     unsigned long currentTime = millis();
-    if (normalizedUID == lastCardUID && (currentTime - lastCardTime) < CARD_DEBOUNCE_MS) {
+    if (uid == lastCardUID && (currentTime - lastCardTime) < CARD_DEBOUNCE_MS) {
         Serial.println("Card scan ignored - too soon after last scan");
         return false;
     }
     
-    lastCardUID = normalizedUID;
+    lastCardUID = uid;
     lastCardTime = currentTime;
     
     if (inputModeActive) {
-        // In input mode, record the scan and notify server
-        bool isNewCard = findUserByUID(normalizedUID) < 0;
-        setLastScan(normalizedUID, isNewCard);
-        
-        // Send UID to server for admin panel processing
-        Serial.println("Input mode: Sending new UID to server - " + normalizedUID);
-        RPCResponse response = notifyNewUID(normalizedUID, isNewCard);
+        // In input mode, record the scan and let the network task notify
+        // the server; its answer replaces this screen
+        bool isNewCard = findUserByUID(uid) < 0 && !rosterContains(uid);
+        setLastScan(uid, isNewCard);
         
-        if (response.success) {
-            showInputModeScreen("Card sent to server!\nUID: " + normalizedUID);
-            Serial.println("Successfully notified server of new UID");
+        String uidHex = uidToHex(uid);
+        if (queueNewUID(uid, isNewCard)) {
+            showInputModeScreen("Sending card...\nUID: " + uidHex);
         } else {
-            showInputModeScreen("Card detected:\n" + normalizedUID + "\n(Server offline)");
-            Serial.println("Failed to notify server: " + response.error);
+            showInputModeScreen("Card detected:\n" + uidHex + "\n(Server offline)");
+            Serial.println("Failed to notify server: network queue full");
         }
         
         // Automatically disable input mode after successful card scan
         inputModeActive = false;
         Serial.println("Input mode: INACTIVE (auto-disabled after scan)");
-        delay(2000); // Show the "card sent" message for 2 seconds
-        showIdleScreen();
         
         return true;
     }
     
-    User* user = getUserByUID(normalizedUID);
+    // Decide on a snapshot that a concurrent sync cannot change or free.
+    // Roster partition users are read in place into a stack copy.
+    UserTablePtr table = acquireUserTable();
+    
+    // Foreign cards (transit, bank, ...) mostly stop here in constant time
+    if (!table->filter.mayContain(uid) && !rosterMayContain(uid)) {
+        filterRejectCount++;
+        showAccessDeniedScreen("Unknown card");
+        ledAccessDenied();
+        Serial.println("Access denied - unknown UID: " + uidToHex(uid));
+        return false;
+    }
+    
+    User rosterUser;
+    RosterHold rosterHold;
+    User* user = table->find(uid);
+    if (!user && getRosterUser(uid, rosterUser, &rosterHold)) {
+        user = &rosterUser;
+    }
     if (!user) {
+        filterFalsePositiveCount++;
         showAccessDeniedScreen("Unknown card");
         ledAccessDenied();
-        Serial.println("Access denied - unknown UID: " + normalizedUID);
+        Serial.println("Access denied - unknown UID: " + uidToHex(uid));
         return false;
     }
     
     bool isEntry = !user->in; // Opposite of current state
     
     if (checkAccess(*user, isEntry)) {
-        updateUserState(*user, isEntry, isEntry ? 0 : COST_PER_EXIT);
-        showAccessGrantedScreen(user->name, user->credit, isEntry);
+        // The RTC sits on the I2C bus, so it is read before taking the lock
+        uint32_t timestamp = scanTimestamp();
+        
+        // Apply the change to the newest table if a sync published one
+        // since the lookup (a user the sync removed keeps the old copy)
+        lockUserTable();
+        UserTablePtr latest = acquireUserTable();
+        if (latest != table && user->type != USER_ROSTER) {
+            User* current = latest->find(uid);
+            if (current) user = current;
+        }
+        updateUserState(*user, isEntry, scanCost(isEntry));
+        User changed = *user;
+        unlockUserTable();
+        
+        recordUserState(changed, timestamp);
+        showAccessGrantedScreen(changed.name, changed.credit, isEntry);
         ledAccessGranted();
         gateOpen();
         
         Serial.printf("Access granted - %s (%s) %s, Credit: %ld\n", 
-                     user->name.c_str(), normalizedUID.c_str(),
-                     isEntry ? "IN" : "OUT", user->credit);
+                     changed.name, uidToHex(uid).c_str(),
+                     isEntry ? "IN" : "OUT", changed.credit);
         return true;
     } else {
         showAccessDeniedScreen("Insufficient credit");
         ledAccessDenied();
         Serial.printf("Access denied - insufficient credit: %s (%ld VND)\n", 
-                     user->name.c_str(), user->credit);
+                     user->name, user->credit);
         return false;
     }
 }
@@ -444,33 +998,20 @@ bool checkAccess(const User& user, bool isEntry) {
     }
 }
 
+// In RAM only, under the table lock; recordUserState() persists the
+// result once the lock is released
 void updateUserState(User& user, bool isEntry, long cost) {
-    user.in = isEntry;
-    if (cost > 0) {
-        deductCredit(user, cost);
+    uint32_t oldHash = userDigestHash(user);
+    bool wasIn = user.in;
+    if (applyScan(user, isEntry, cost)) {
+        notePresence(user.uid, isEntry);
     }
+    noteUserDigest(user.uid, oldHash, userDigestHash(user));
+    noteBuiltChange(user, wasIn, oldHash);
+    syncScans.note(user.uid);
     
-    // Save changes locally FIRST (offline-first approach)
-    if (user.type == USER_STATIC) {
-        saveStaticUsersToNVS();
-    } else {
-        saveDynamicUsersToNVS();
-    }
-    Serial.println("✓ User state saved locally to NVS");
-    
-    // Try to sync changes to server (non-blocking)
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.println("Syncing user changes to server...");
-        RPCResponse syncResponse = updateUserOnServer(user.uid, user.name, user.credit, user.in);
-        if (syncResponse.success) {
-            Serial.println("✓ User data successfully synced to server");
-        } else {
-            Serial.println("⚠ Failed to sync user data to server: " + syncResponse.error);
-            Serial.println("  Device will continue working offline. Data saved locally.");
-        }
-    } else {
-        Serial.println("⚠ WiFi offline - User data saved locally only");
-        Serial.println("  Will sync automatically when connection restored");
+    if (user.type == USER_ROSTER) {
+        setRosterUserState(user);
     }
 }
 
@@ -493,74 +1034,516 @@ bool isInputModeActive() {
     return inputModeActive;
 }
 
-void setLastScan(const String& uid, bool isNew) {
+void setLastScan(const CardUID& uid, bool isNew) {
+    portENTER_CRITICAL(&lastScanMux);
     lastScan.uid = uid;
     lastScan.timestamp = millis() / 1000;
     lastScan.isNew = isNew;
+    portEXIT_CRITICAL(&lastScanMux);
 }
 
 LastScanResult getLastScan() {
-    return lastScan;
+    portENTER_CRITICAL(&lastScanMux);
+    LastScanResult copy = lastScan;
+    portEXIT_CRITICAL(&lastScanMux);
+    return copy;
 }
 
 void clearLastScan() {
-    lastScan.uid = "";
+    portENTER_CRITICAL(&lastScanMux);
+    lastScan.uid = CardUID();
     lastScan.timestamp = 0;
     lastScan.isNew = false;
+    portEXIT_CRITICAL(&lastScanMux);
 }
 
 // ================== Server Sync Functions ==================
-bool syncUsersFromJson(const DynamicJsonDocument& doc) {
-    if (!doc.containsKey("users")) {
-        Serial.println("No users array in sync data");
+// Hash hit confirmation for a table that is still being built
+static bool syncedUIDMatches(int32_t userIndex, const CardUID& uid, const void* context) {
+    const std::vector<User>& users = *static_cast<const std::vector<User>*>(context);
+    return users[userIndex].uid == uid;
+}
+
+// A sync in progress. Records arrive one at a time (see syncparser.h) and
+// go straight into the next roster image, or into a user table built next
+// to the published one; nothing is published until endUserSync(true).
+// A full sync replaces the dynamic users, a delta sync (since > 0) starts
+// from the current users and only applies the changed and deleted ones.
+struct UserSyncSession {
+    bool active;
+    bool roster;                 // Centrally provisioned: building a roster image
+    bool delta;
+    UserTablePtr current;
+    UserTablePtr next;
+    UidIndex syncedIndex;        // Full sync: users already in `next`
+    std::vector<bool> kept;      // Full sync: current dynamic users also in the server copy
+    std::vector<bool> removed;   // Delta sync: dynamic users of `next` tombstoned
+    std::vector<CardUID> deleted;  // Delta sync of a roster: tombstoned UIDs
+    uint32_t revision;           // Highest server revision seen
+    int syncedCount;
+};
+static UserSyncSession syncSession;
+bool beginUserSync(uint32_t since) {
+    if (syncSession.active) {
+        endUserSync(false);
+    }
+    
+    // A delta only makes sense on top of the revision it was made against
+    if (since > 0 && since != userSyncRevision) {
+        Serial.printf("Delta sync since revision %lu refused, holding %lu\n",
+                      (unsigned long)since, (unsigned long)userSyncRevision);
+        return false;
+    }
+    
+    // Server values replace local ones, so older journal entries must not
+    // be replayed over them after a reboot
+    compactJournal();
+    
+    syncSession.roster = isRosterAvailable();
+    if (syncSession.roster && !beginRosterImage()) {
         return false;
     }
     
-    JsonArrayConst users = doc["users"].as<JsonArrayConst>();
-    dynamicUsers.clear();
+    // Users that already exist keep their NVS slot and only get their
+    // changed fields rewritten. Scans keep deciding on the current table
+    // until endUserSync() swaps it; the users they change from the copy on
+    // are logged, so their live state is not lost at the swap.
+    syncSession.delta = since > 0;
+    lockUserTable();
+    syncScans.begin();
+    syncSession.current = acquireUserTable();
+    if (!syncSession.roster) {
+        if (syncSession.delta) {
+            syncSession.next = copyUserTable();
+            syncSession.removed.assign(syncSession.next->dynamicUsers.size(), false);
+        } else {
+            syncSession.next = std::make_shared<UserTable>();
+            syncSession.next->staticUsers = syncSession.current->staticUsers;
+            syncSession.kept.assign(syncSession.current->dynamicUsers.size(), false);
+        }
+    }
+    unlockUserTable();
+    if (!syncSession.roster && !syncSession.delta) {
+        rehomeUserNames(*syncSession.next);
+    }
+    syncSession.syncedIndex.clear();
+    syncSession.deleted.clear();
+    syncSession.revision = since;
+    syncSession.syncedCount = 0;
+    syncSession.active = true;
+    return true;
+}
+
+// Takes the server's name, credit and presence, marking what changed
+static void applySyncedFields(User& user, const SyncUserRecord& record, long credit, NameArena& names) {
+    if (!sameUserName(user.name, record.name)) {
+        user.dirty |= USER_DIRTY_NAME;
+        user.name = storeUserName(names, record.name);
+    }
+    if (user.credit != credit) {
+        user.credit = credit;
+        user.dirty |= USER_DIRTY_CREDIT;
+    }
+    if (user.in != record.in) {
+        user.in = record.in;
+        user.dirty |= USER_DIRTY_IN;
+    }
+}
+
+// Delta sync on the NVS user table: upsert or tombstone one user in place
+static void syncDeltaUser(const CardUID& cardUID, const SyncUserRecord& record, long credit) {
+    UserTable& next = *syncSession.next;
+    int dynamicIdx = next.indexOf(cardUID) - (int)next.staticUsers.size();
     
-    int syncedCount = 0;
-    for (JsonVariantConst userVariant : users) {
-        JsonObjectConst userObj = userVariant.as<JsonObjectConst>();
-        String uid = userObj["uid"] | "";
-        String name = userObj["name"] | "";
-        long credit = userObj["credit"] | DEFAULT_CREDIT;
-        bool in = userObj["in"] | false;
+    if (record.deleted) {
+        if (dynamicIdx >= 0) {
+            syncSession.removed[dynamicIdx] = true;
+        }
+    } else if (dynamicIdx >= 0) {
+        syncSession.removed[dynamicIdx] = false;
+        applySyncedFields(next.dynamicUsers[dynamicIdx], record, credit, *next.names);
+    } else {
+        next.dynamicUsers.emplace_back(cardUID, storeUserName(*next.names, record.name), credit, record.in, USER_DYNAMIC);
+        next.index.insert(cardUID, next.size() - 1);
+        syncSession.removed.push_back(false);
+    }
+}
+
+// Adds one user of the server copy. Records without a usable UID or name
+// are skipped; false means the sync cannot continue.
+bool syncUser(const SyncUserRecord& record) {
+    if (!syncSession.active) return false;
+    
+    if (record.rev > syncSession.revision) {
+        syncSession.revision = record.rev;
+    }
+    
+    CardUID cardUID;
+    if (!parseUID(record.uid, cardUID)) return true;
+    if (record.deleted ? !syncSession.delta : record.name[0] == '\0') return true;
+    long credit = record.hasCredit ? record.credit : DEFAULT_CREDIT;
+    
+    const UserTable& current = *syncSession.current;
+    int existing = current.indexOf(cardUID);
+    if (existing >= 0 && existing < (int)current.staticUsers.size()) {
+        Serial.printf("Skipping duplicate UID in sync data: %s\n", record.uid);
+        return true;
+    }
+    
+    if (syncSession.roster) {
+        if (record.deleted) {
+            syncSession.deleted.push_back(cardUID);
+        } else {
+            // Repeated UIDs are dropped when the image is sorted, so changes
+            // sent first win over the users a delta copies over at the end
+            RosterEntry entry;
+            makeRosterEntry(cardUID, record.name, credit, record.in, entry);
+            if (!addRosterEntry(entry)) return false;
+        }
+    } else if (syncSession.delta) {
+        syncDeltaUser(cardUID, record, credit);
+    } else {
+        std::vector<User>& synced = syncSession.next->dynamicUsers;
+        if (syncSession.syncedIndex.find(cardUID, syncedUIDMatches, &synced) >= 0) {
+            Serial.printf("Skipping duplicate UID in sync data: %s\n", record.uid);
+            return true;
+        }
         
-        if (uid.length() > 0 && name.length() > 0) {
-            String normalizedUID = normalizeUID(uid);
-            if (isValidUID(normalizedUID)) {
-                dynamicUsers.emplace_back(normalizedUID, name, credit, in, USER_DYNAMIC);
-                syncedCount++;
-            }
+        NameArena& names = *syncSession.next->names;
+        if (existing >= 0) {
+            int dynamicIdx = existing - current.staticUsers.size();
+            syncSession.kept[dynamicIdx] = true;
+            synced.push_back(current.dynamicUsers[dynamicIdx]);
+            applySyncedFields(synced.back(), record, credit, names);
+        } else {
+            synced.emplace_back(cardUID, storeUserName(names, record.name), credit, record.in, USER_DYNAMIC);
         }
+        syncSession.syncedIndex.insert(cardUID, synced.size() - 1);
     }
+    syncSession.syncedCount++;
+    return true;
+}
+
+static bool uidHashLess(const CardUID& a, const CardUID& b) {
+    return a.hash() < b.hash();
+}
+
+// Delta sync of a roster: true if the delta tombstoned `uid`
+static bool isSyncDeleted(const CardUID& uid) {
+    auto it = std::lower_bound(syncSession.deleted.begin(), syncSession.deleted.end(), uid, uidHashLess);
+    for (; it != syncSession.deleted.end() && it->hash() == uid.hash(); ++it) {
+        if (*it == uid) return true;
+    }
+    return false;
+}
+
+// Delta sync of a roster: the users of the live image that the delta did
+// not change or delete, with their current credit and presence
+static bool copyRosterForDelta() {
+    std::sort(syncSession.deleted.begin(), syncSession.deleted.end(), uidHashLess);
     
-    saveDynamicUsersToNVS();
-    Serial.printf("Synced %d users from server\n", syncedCount);
+    RosterHold hold;
+    User users[ROSTER_READ_BATCH];
+    for (uint32_t i = 0, n; (n = getRosterUsersAt(i, users, ROSTER_READ_BATCH, &hold)) > 0; i += n) {
+        for (uint32_t j = 0; j < n; j++) {
+            if (isSyncDeleted(users[j].uid)) continue;
+            
+            RosterEntry entry;
+            makeRosterEntry(users[j].uid, users[j].name, users[j].credit, users[j].in, entry);
+            if (!addRosterEntry(entry)) return false;
+        }
+    }
     return true;
 }
 
-void populateUsersJson(JsonArray& usersArray) {
-    // Add static users
-    for (const User& user : staticUsers) {
-        JsonObject userObj = usersArray.createNestedObject();
-        userObj["uid"] = user.uid;
-        userObj["name"] = user.name;
-        userObj["credit"] = user.credit;
-        userObj["in"] = user.in;
-        userObj["type"] = "STATIC";
+// Roster sync: the dynamic users the new image replaces (a full sync: all
+// of them) leave the table in one publish. Those scanned during the sync
+// hand their live state to the image under the same lock, so a scan that
+// still found them in the table is not lost. Users whose record cannot be
+// erased stay in the table, and the result is false.
+static bool dropReplacedDynamicUsers() {
+    lockUserStore();
+    compactJournal();
+    
+    UserTablePtr live = acquireUserTable();
+    UserTablePtr table = std::make_shared<UserTable>();
+    table->staticUsers = live->staticUsers;
+    std::vector<User> gone;
+    for (const User& user : live->dynamicUsers) {
+        if (!syncSession.delta || rosterContains(user.uid) || isSyncDeleted(user.uid)) {
+            gone.push_back(user);
+        } else {
+            table->dynamicUsers.push_back(user);
+        }
+    }
+    if (gone.empty()) {
+        unlockUserStore();
+        return true;
+    }
+    bool erased = eraseUserRecords(gone);
+    for (const User& user : gone) {
+        if (user.slot != USER_SLOT_NONE) {
+            table->dynamicUsers.push_back(user);
+        }
+    }
+    rehomeUserNames(*table);
+    rebuildUserIndex(*table);
+    
+    // Publishing needs the store lock, so `live` is still the live table
+    lockUserTable();
+    syncScans.merge(*table, *live);
+    for (const CardUID& uid : syncScans.scanned()) {
+        const User* user = live->find(uid);
+        if (user && !table->find(uid)) {
+            setRosterUserState(*user);
+        }
+    }
+    publishUserTable(table);
+    unlockUserTable();
+    unlockUserStore();
+    
+    if (erased) {
+        Serial.printf("Dropped %u dynamic users replaced by the roster partition\n", (unsigned)gone.size());
+    } else {
+        Serial.println("Some dynamic users replaced by the roster partition could not be erased - kept");
+    }
+    return erased;
+}
+
+// Publishes the synced users if `commit`, otherwise drops them and leaves
+// the current table or roster image in place. `revision` is the server
+// revision the sync brings the device to (0: the highest one in the records).
+bool endUserSync(bool commit, uint32_t revision) {
+    if (!syncSession.active) return false;
+    syncSession.active = false;
+    if (revision == 0) {
+        revision = syncSession.revision;
+    }
+    
+    bool ok = commit;
+    if (commit && syncSession.delta && syncSession.syncedCount == 0) {
+        // Nothing changed on the server: keep the table or image as it is
+        if (syncSession.roster) {
+            abortRosterImage();
+        }
+        saveUserSyncRevision(revision);
+        Serial.printf("Users up to date at revision %lu\n", (unsigned long)revision);
+    } else if (syncSession.roster) {
+        if (!commit || (syncSession.delta && !copyRosterForDelta())) {
+            abortRosterImage();
+            ok = false;
+        } else if ((ok = finishRosterImage(syncScans.scanned()))) {
+            // The server copy becomes the roster image and replaces the
+            // dynamic users; a delta only those it covers
+            if (dropReplacedDynamicUsers()) {
+                saveUserSyncRevision(revision);
+            } else {
+                revision = userSyncRevision;  // The next sync removes them again
+            }
+            Serial.printf("Synced %d users from server into roster partition (%lu users, revision %lu)\n",
+                          syncSession.syncedCount, (unsigned long)getRosterUserCount(), (unsigned long)revision);
+        }
+    } else if (commit) {
+        UserTablePtr next = syncSession.next;
+        
+        // The store may have given users a record slot since the sync
+        // copied them; slots only change under the store lock
+        lockUserStore();
+        UserTablePtr live = acquireUserTable();
+        for (int i = 0; i < next->size(); i++) {
+            User* user = next->at(i);
+            const User* liveUser = user->slot == USER_SLOT_NONE ? live->find(user->uid) : nullptr;
+            if (liveUser) user->slot = liveUser->slot;
+        }
+        
+        // Users the server no longer has give their record slot back and
+        // leave the table. One whose record cannot be erased would come
+        // back on the next boot, so it stays, and the revision is kept for
+        // the next sync to remove it again.
+        std::vector<User> gone;
+        if (syncSession.delta) {
+            for (size_t i = 0; i < next->dynamicUsers.size(); i++) {
+                if (syncSession.removed[i]) {
+                    gone.push_back(next->dynamicUsers[i]);
+                }
+            }
+        } else {
+            const UserTable& current = *syncSession.current;
+            for (size_t i = 0; i < current.dynamicUsers.size(); i++) {
+                const User* liveUser = syncSession.kept[i] ? nullptr : live->find(current.dynamicUsers[i].uid);
+                if (liveUser) gone.push_back(*liveUser);
+            }
+        }
+        bool erased = eraseUserRecords(gone);
+        
+        if (syncSession.delta) {
+            std::vector<User>& users = next->dynamicUsers;
+            size_t kept = 0;
+            for (size_t i = 0, g = 0; i < users.size(); i++) {
+                if (syncSession.removed[i] && gone[g++].slot == USER_SLOT_NONE) continue;
+                users[kept++] = users[i];
+            }
+            users.resize(kept);
+            compactUserNames(*next);
+        } else {
+            for (const User& user : gone) {
+                if (user.slot != USER_SLOT_NONE) {
+                    next->dynamicUsers.push_back(user);
+                    next->dynamicUsers.back().name = storeUserName(*next->names, user.name);
+                }
+            }
+        }
+        rebuildUserIndex(*next);
+        
+        // Users scanned since `next` was copied keep their live state: a
+        // delta copied them at the start, a full sync when their record
+        // arrived, and static users are copied at the start either way
+        lockUserTable();
+        syncScans.merge(*next, *live);
+        publishUserTable(next);
+        unlockUserTable();
+        saveDynamicUsersToNVS();
+        if (erased) {
+            saveUserSyncRevision(revision);
+        } else {
+            Serial.println("Users deleted by the sync could not be erased - kept until the next sync");
+            revision = userSyncRevision;
+        }
+        unlockUserStore();
+        Serial.printf("Synced %d users from server (%s, revision %lu)\n", syncSession.syncedCount,
+                      syncSession.delta ? "delta" : "full", (unsigned long)revision);
+    }
+    
+    if (ok) {
+        rebuildUserSummaries();
+    }
+    lockUserTable();
+    syncScans.end();
+    unlockUserTable();
+    syncSession.current.reset();
+    syncSession.next.reset();
+    syncSession.syncedIndex.clear();
+    syncSession.kept.clear();
+    syncSession.removed.clear();
+    syncSession.deleted.clear();
+    return ok;
+}
+
+static const char* userTypeName(UserType type) {
+    switch (type) {
+        case USER_STATIC: return "STATIC";
+        case USER_ROSTER: return "ROSTER";
+        default:          return "DYNAMIC";
+    }
+}
+
+// One small document per user, so any number of users can be written in
+// constant memory
+static void writeUserJson(Print& out, const User& user, const char* type, bool first) {
+    StaticJsonDocument<256> userObj;
+    userObj["uid"] = uidToHex(user.uid);
+    userObj["name"] = (char*)user.name; // char* makes ArduinoJson copy it
+    userObj["credit"] = user.credit;
+    userObj["in"] = user.in;
+    userObj["type"] = type;
+    
+    if (!first) out.write(',');
+    serializeJson(userObj, out);
+}
+
+uint32_t writeUsersJson(Print& out) {
+    UserTablePtr table = acquireUserTable();
+    uint32_t count = 0;
+    
+    out.write('[');
+    for (const User& user : table->staticUsers) {
+        writeUserJson(out, user, "STATIC", count++ == 0);
     }
+    for (const User& user : table->dynamicUsers) {
+        writeUserJson(out, user, "DYNAMIC", count++ == 0);
+    }
+    
+    // Roster partition users
+    User rosterUsers[ROSTER_READ_BATCH];
+    RosterHold rosterHold;
+    for (uint32_t i = 0, n; (n = getRosterUsersAt(i, rosterUsers, ROSTER_READ_BATCH, &rosterHold)) > 0; i += n) {
+        for (uint32_t j = 0; j < n; j++) {
+            writeUserJson(out, rosterUsers[j], "ROSTER", count++ == 0);
+        }
+    }
+    out.write(']');
+    return count;
+}
+
+// ================== User Pages ==================
+static bool matchesPageQuery(const User& user, const UserPageQuery& query) {
+    if (query.insideOnly && !user.in) return false;
+    if (query.hasCreditBelow && user.credit >= query.creditBelow) return false;
+    return strncasecmp(user.name, query.namePrefix.c_str(), query.namePrefix.length()) == 0;
+}
+
+uint32_t writeUserPageJson(Print& out, const UserPageQuery& query, CardUID& next) {
+    UserTablePtr table = acquireUserTable();
+    uint32_t limit = query.limit > 0 ? std::min((uint32_t)query.limit, (uint32_t)USER_PAGE_MAX) : USER_PAGE_DEFAULT;
+    uint32_t count = 0;
+    uint32_t scanned = 0;
+    next = CardUID();
     
-    // Add dynamic users
-    for (const User& user : dynamicUsers) {
-        JsonObject userObj = usersArray.createNestedObject();
-        userObj["uid"] = user.uid;
-        userObj["name"] = user.name;
-        userObj["credit"] = user.credit;
-        userObj["in"] = user.in;
-        userObj["type"] = "DYNAMIC";
+    out.write('[');
+    if (query.insideOnly) {
+        // Candidates from the presence index, copied so no lock is held
+        // while writing to the client
+        lockUserTable();
+        auto from = query.after.isEmpty() ? insideUsers.begin()
+                                          : std::upper_bound(insideUsers.begin(), insideUsers.end(), query.after);
+        size_t available = insideUsers.end() - from;
+        std::vector<CardUID> candidates(from, from + std::min(available, (size_t)USER_PAGE_SCAN_MAX));
+        unlockUserTable();
+        
+        RosterHold rosterHold;
+        for (const CardUID& uid : candidates) {
+            User rosterUser;
+            const User* user = table->find(uid);
+            if (!user && getRosterUser(uid, rosterUser, &rosterHold)) user = &rosterUser;
+            scanned++;
+            
+            if (user && matchesPageQuery(*user, query)) {
+                writeUserJson(out, *user, userTypeName(user->type), count++ == 0);
+            }
+            if (count == limit || scanned == candidates.size()) {
+                if (scanned < available) next = uid;
+                break;
+            }
+        }
+    } else {
+        // Merge of the table and roster, both in UID order
+        size_t tableAt = query.after.isEmpty() ? 0 : userOrderAfter(*table, query.after);
+        uint32_t rosterAt = query.after.isEmpty() ? 0 : getRosterIndexAfter(query.after);
+        RosterHold rosterHold;
+        User rosterUser;
+        bool rosterLeft = getRosterUserAt(rosterAt, rosterUser, &rosterHold);
+        
+        while (tableAt < table->order.size() || rosterLeft) {
+            User user;
+            if (tableAt < table->order.size() && (!rosterLeft || table->at(table->order[tableAt])->uid < rosterUser.uid)) {
+                user = *table->at(table->order[tableAt++]);
+            } else {
+                user = rosterUser;
+                rosterLeft = getRosterUserAt(++rosterAt, rosterUser, &rosterHold);
+            }
+            scanned++;
+            
+            if (matchesPageQuery(user, query)) {
+                writeUserJson(out, user, userTypeName(user.type), count++ == 0);
+            }
+            if (count == limit || scanned == USER_PAGE_SCAN_MAX) {
+                if (tableAt < table->order.size() || rosterLeft) next = user.uid;
+                break;
+            }
+        }
     }
+    out.write(']');
+    return count;
 }
 
 // ================== Authentication and Credit Functions ==================
@@ -571,6 +1554,7 @@ bool hasValidCredit(const User& user, long requiredAmount) {
 bool deductCredit(User& user, long amount) {
     if (user.credit >= amount) {
         user.credit -= amount;
+        user.dirty |= USER_DIRTY_CREDIT;
         return true;
     }
     return false;
@@ -578,6 +1562,7 @@ bool deductCredit(User& user, long amount) {
 
 bool addCredit(User& user, long amount) {
     user.credit += amount;
+    user.dirty |= USER_DIRTY_CREDIT;
     return true;
 }
 
@@ -587,40 +1572,40 @@ String formatCredit(long credit) {
 }
 
 String getUserStatusString(const User& user) {
-    return user.name + " (" + user.uid + ") " + 
+    return String(user.name) + " (" + uidToHex(user.uid) + ") " + 
            (user.in ? "IN" : "OUT") + " " + formatCredit(user.credit);
 }
 
 void printUserList() {
+    UserTablePtr table = acquireUserTable();
+    
     Serial.println("\n=== USER LIST ===");
-    Serial.printf("Static Users (%d):\n", staticUsers.size());
-    for (const User& user : staticUsers) {
+    Serial.printf("Static Users (%d):\n", table->staticUsers.size());
+    for (const User& user : table->staticUsers) {
         Serial.println("  " + getUserStatusString(user));
     }
     
-    Serial.printf("Dynamic Users (%d):\n", dynamicUsers.size());
-    for (const User& user : dynamicUsers) {
+    Serial.printf("Dynamic Users (%d):\n", table->dynamicUsers.size());
+    for (const User& user : table->dynamicUsers) {
         Serial.println("  " + getUserStatusString(user));
     }
     Serial.println("=================\n");
 }
 
 // ================== Legacy Compatibility Functions ==================
-int findStaticIndex(const String& uid) {
+int findStaticIndex(const CardUID& uid) {
     // In modular version, no static users - return -1
     return -1;
 }
 
-int findDynamicIndex(const String& uid) {
-    for (size_t i = 0; i < dynamicUsers.size(); i++) {
-        if (dynamicUsers[i].uid == uid) {
-            return (int)i;
-        }
-    }
-    return -1;
+int findDynamicIndex(const CardUID& uid) {
+    UserTablePtr table = acquireUserTable();
+    int index = table->indexOf(uid);
+    if (index < (int)table->staticUsers.size()) return -1;
+    return index - table->staticUsers.size();
 }
 
-int findUserIndexCombined(const String& uid) {
+int findUserIndexCombined(const CardUID& uid) {
     int staticIdx = findStaticIndex(uid);
     if (staticIdx >= 0) return staticIdx;
     
@@ -630,19 +1615,58 @@ int findUserIndexCombined(const String& uid) {
     return -1;
 }
 
-bool uidExistsExcept(const String& uid, int exceptIdx) {
-    // Check static users (none in modular version)
-    for (size_t i = 0; i < STATIC_COUNT; i++) {
-        if ((int)i == exceptIdx) continue;
-        // No static users to check
-    }
+bool uidExistsExcept(const CardUID& uid, int exceptIdx) {
+    // Static users are not checked (none in modular version)
+    int dynamicIdx = findDynamicIndex(uid);
+    return dynamicIdx >= 0 && (int)STATIC_COUNT + dynamicIdx != exceptIdx;
+}
+
+// Rebuilds both the hash index and the unknown-card filter
+void rebuildUserIndex(UserTable& table) {
+    table.index.clear();
+    table.index.reserve(table.size());
     
-    // Check dynamic users
-    for (size_t j = 0; j < dynamicUsers.size(); j++) {
-        int combinedIdx = STATIC_COUNT + (int)j;
-        if (combinedIdx == exceptIdx) continue;
-        if (dynamicUsers[j].uid == uid) return true;
+    for (int i = 0; i < table.size(); i++) {
+        table.index.insert(table.at(i)->uid, i);
     }
+    rebuildUserOrder(table);
     
-    return false;
+    // A failed cuckoo insert means the filter is too full - retry bigger
+    for (size_t reserve = table.size() + 1; ; reserve *= 2) {
+        table.filter.reserve(reserve);
+        bool complete = true;
+        for (int i = 0; i < table.size() && complete; i++) {
+            complete = table.filter.insert(table.at(i)->uid);
+        }
+        if (complete) break;
+    }
+}
+
+// ================== Unknown Card Filter ==================
+size_t getUidFilterBytes() {
+    return acquireUserTable()->filter.memoryBytes();
+}
+
+// Chance that an unknown card gets past both the table and roster filters
+float getUidFilterFalsePositiveRate() {
+    float tablePass = acquireUserTable()->filter.falsePositiveRate();
+    float rosterPass = getRosterFilterFalsePositiveRate();
+    return 1.0f - (1.0f - tablePass) * (1.0f - rosterPass);
+}
+
+uint32_t getUidFilterRejectCount() {
+    return filterRejectCount;
+}
+
+uint32_t getUidFilterFalsePositiveCount() {
+    return filterFalsePositiveCount;
+}
+
+// ================== Name Arena Statistics ==================
+size_t getNameArenaBytes() {
+    return acquireUserTable()->names->capacityBytes();
+}
+
+size_t getNameArenaWastedBytes() {
+    return acquireUserTable()->names->wastedBytes();
 }
\ No newline at end of file
@@ -3,45 +3,60 @@
 
 #include <Arduino.h>
 #include <vector>
+#include <memory>
 #include <Preferences.h>
 #include <ArduinoJson.h>
 #include <MFRC522.h>
-
-// ================== User Data Structures ==================
-enum UserType : uint8_t {
-    USER_STATIC = 0,
-    USER_DYNAMIC = 1
-};
-
-struct User {
-    String uid;
-    String name;
-    long credit;
-    bool in;        // true = IN, false = OUT
-    UserType type;
+#include "carduid.h"
+#include "uidindex.h"
+#include "uidfilter.h"
+#include "namearena.h"
+#include "syncparser.h"
+#include "user.h"
+
+// ================== User Table Snapshot ==================
+// The in-RAM user table is published as a snapshot. Readers hold a reference
+// from acquireUserTable(), so a sync publishing a new table can never change
+// the shape of, or free, the table an access decision is looking at; the old
+// table goes away with its last reference. Writers build the next table
+// beside the current one and publish it with one atomic pointer swap.
+// Publishing and in-place credit/presence updates are serialized by
+// lockUserTable(), which is only held for work in RAM. Table writes to
+// NVS, roster overlay saves, journal compaction and publishing are serialized
+// by lockUserStore(), taken before the table lock and never under it. The
+// gate task never takes the store lock, so a scan never waits on flash.
+struct UserTable {
+    std::vector<User> staticUsers;
+    std::vector<User> dynamicUsers;
+    UidIndex index;   // Combined positions: static users first, then dynamic
+    UidFilter filter; // Fast reject for UIDs not in this table
+    std::vector<int32_t> order;  // Positions sorted by UID, for user pages
+    std::shared_ptr<NameArena> names;  // Shared by copies of the table
+    
+    UserTable() : names(std::make_shared<NameArena>()) {}
     
-    User() : uid(""), name(""), credit(100000), in(false), type(USER_DYNAMIC) {}
-    User(const String& u, const String& n, long c, bool i, UserType t) 
-        : uid(u), name(n), credit(c), in(i), type(t) {}
+    int indexOf(const CardUID& uid) const;
+    User* at(int position);
+    User* find(const CardUID& uid) { return at(indexOf(uid)); }
+    int size() const { return staticUsers.size() + dynamicUsers.size(); }
 };
 
+typedef std::shared_ptr<UserTable> UserTablePtr;
+
 struct LastScanResult {
-    String uid;
+    CardUID uid;
     uint32_t timestamp;
     bool isNew;
     
-    LastScanResult() : uid(""), timestamp(0), isNew(false) {}
+    LastScanResult() : uid(), timestamp(0), isNew(false) {}
 };
 
 // ================== User Management State ==================
-extern std::vector<User> staticUsers;
-extern std::vector<User> dynamicUsers;
 extern bool inputModeActive;
 extern LastScanResult lastScan;
 extern Preferences userPrefs;
 
 // ================== Constants ==================
-extern const long COST_PER_EXIT;
 extern const long DEFAULT_CREDIT;
 extern const size_t STATIC_COUNT;
 
@@ -66,53 +81,119 @@ struct AccessResult {
 // ================== User Management Functions ==================
 bool initializeUsers();
 void loadUsersFromNVS();
-void saveUsersToBothNVS();
-void saveDynamicUsersToNVS();
-void saveStaticUsersToNVS();
+bool saveUsersToBothNVS();
+bool saveDynamicUsersToNVS();
+bool saveStaticUsersToNVS();
+bool hasDirtyUsers();
+
+// ================== User Table Access ==================
+UserTablePtr acquireUserTable();
+void lockUserTable();
+void unlockUserTable();
+void lockUserStore();
+void unlockUserStore();
 
 // ================== User Query Functions ==================
-int findUserByUID(const String& uid);
-User* getUserByUID(const String& uid);
+// These work on the current table. Returned pointers stay valid while the
+// table lock is held; code that may run beside a sync acquires the table.
+int findUserByUID(const CardUID& uid);
+User* getUserByUID(const CardUID& uid);
 User* getUserByIndex(int index);
 int getTotalUserCount();
 int getStaticUserCount();
 int getDynamicUserCount();
-int findStaticIndex(const String& uid);
-int findDynamicIndex(const String& uid);
-int findUserIndexCombined(const String& uid);
-bool uidExistsExcept(const String& uid, int exceptIdx);
+int findStaticIndex(const CardUID& uid);
+int findDynamicIndex(const CardUID& uid);
+int findUserIndexCombined(const CardUID& uid);
+bool uidExistsExcept(const CardUID& uid, int exceptIdx);
+void rebuildUserIndex(UserTable& table);
+
+// ================== User Pages ==================
+// Users in UID order from the table and the roster, starting after `after`
+// (empty: from the first). Inside-only pages come from the presence index;
+// the other filters are checked per user. At most USER_PAGE_SCAN_MAX users
+// are looked at per page, so a filter that matches few users returns short
+// pages with a cursor to continue from.
+#define USER_PAGE_DEFAULT    50
+#define USER_PAGE_MAX        200
+#define USER_PAGE_SCAN_MAX   512
+
+struct UserPageQuery {
+    CardUID after;
+    uint16_t limit;
+    bool insideOnly;
+    bool hasCreditBelow;
+    long creditBelow;       // Only users with less credit
+    String namePrefix;      // Case-insensitive for ASCII letters
+    
+    UserPageQuery() : limit(USER_PAGE_DEFAULT), insideOnly(false), hasCreditBelow(false), creditBelow(0) {}
+};
+
+// Writes the page as a JSON array. `next` is the UID to continue after, or
+// empty when the page reached the end.
+uint32_t writeUserPageJson(Print& out, const UserPageQuery& query, CardUID& next);
+size_t getInsideUserCount();
+
+// ================== User Digest ==================
+// Root, DIGEST_BUCKETS / DIGEST_FANOUT group hashes and DIGEST_FANOUT
+// bucket hashes per group of the user hash tree (userdigest.h)
+uint32_t getUserDigestRoot();
+void getUserDigestGroups(uint32_t* groups);
+void getUserDigestBuckets(uint8_t group, uint32_t* buckets);
+uint32_t writeUserDigestBucketJson(Print& out, uint16_t bucket);
+
+// ================== Unknown Card Filter ==================
+size_t getUidFilterBytes();
+float getUidFilterFalsePositiveRate();
+uint32_t getUidFilterRejectCount();
+uint32_t getUidFilterFalsePositiveCount();
+
+// ================== Name Arena Statistics ==================
+size_t getNameArenaBytes();
+size_t getNameArenaWastedBytes();
 
 // ================== User CRUD Functions ==================
-bool addUser(const String& uid, const String& name, long credit = DEFAULT_CREDIT, UserType type = USER_DYNAMIC);
-bool updateUser(const String& uid, const String& name = "", long credit = -1, bool in = false);
-bool deleteUser(const String& uid);
+bool addUser(const CardUID& uid, const String& name, long credit = DEFAULT_CREDIT, UserType type = USER_DYNAMIC);
+bool updateUser(const CardUID& uid, const String& name = "", long credit = -1, bool in = false);
+bool deleteUser(const CardUID& uid);
 void clearDynamicUsers();
 
 // ================== RFID Processing Functions ==================
 String uidToHex(const MFRC522::Uid& uid);
+String uidToHex(const CardUID& uid);
+CardUID uidFromMFRC522(const MFRC522::Uid& uid);
+bool parseUID(const String& uid, CardUID& out);
 String normalizeUID(const String& uid);
 bool isValidUID(const String& uid);
+const char* storeUserName(NameArena& names, const char* text);
 
 // ================== Card Processing Functions ==================
-String readRFIDCard();
+CardUID readRFIDCard();
 bool isCardPresent();
-AccessResult processCardAccess(const String& uid);
-bool processCardScan(const String& uid);
+AccessResult processCardAccess(const CardUID& uid);
+bool processCardScan(const CardUID& uid);
 bool checkAccess(const User& user, bool isEntry);
 void updateUserState(User& user, bool isEntry, long cost = 0);
-void logCardScan(const String& uid);
+void logCardScan(const CardUID& uid);
 void addEventLog(const String& message);
 
 // ================== Input Mode Functions ==================
 void setInputModeActive(bool active);
 bool isInputModeActive();
-void setLastScan(const String& uid, bool isNew);
+void setLastScan(const CardUID& uid, bool isNew);
 LastScanResult getLastScan();
 void clearLastScan();
 
 // ================== Server Sync Functions ==================
-bool syncUsersFromJson(const DynamicJsonDocument& doc);
-void populateUsersJson(JsonArray& usersArray);
+// A sync streams the server copy record by record: beginUserSync(), then
+// syncUser() per user, then endUserSync(true) to publish or (false) to drop.
+// since = 0 is a full copy; otherwise only users changed or deleted after
+// server revision `since`, which must be the one the device holds.
+bool beginUserSync(uint32_t since = 0);
+bool syncUser(const SyncUserRecord& record);
+bool endUserSync(bool commit, uint32_t revision = 0);
+uint32_t getUserSyncRevision();
+uint32_t writeUsersJson(Print& out);  // JSON array of every user, returns the count
 bool syncUserToServer(const User& user);
 
 // ================== Authentication and Credit Functions ==================
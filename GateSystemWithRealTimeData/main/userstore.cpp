@@ -0,0 +1,348 @@
+#include "userstore.h"
+#include <algorithm>
+#include <esp_rom_crc.h>
+
+// ================== Storage State ==================
+enum SlotState : uint8_t {
+    SLOT_FREE = 0,
+    SLOT_STATIC,
+    SLOT_DYNAMIC
+};
+
+static std::vector<uint8_t> slotStates;  // SlotState per record slot
+static uint32_t recordCount = 0;
+static uint32_t nvsWriteCount = 0;       // put/remove calls since boot
+
+// Single chunk buffer shared by all reads and read-modify-writes. Kept as
+// static storage so saving a record never allocates.
+struct UserChunk {
+    UserRecord records[USER_RECORDS_PER_CHUNK];
+    uint32_t crc32;
+};
+static UserChunk chunkBuffer;
+static int32_t bufferedChunk = -1;
+
+// ================== Key and CRC Helpers ==================
+static void chunkKey(char* key, size_t size, uint32_t chunk) {
+    snprintf(key, size, "utbl_c%lu", (unsigned long)chunk);
+}
+
+static uint32_t chunkCRC(const UserChunk& chunk) {
+    return esp_rom_crc32_le(0, (const uint8_t*)chunk.records, sizeof(chunk.records));
+}
+
+static uint32_t headerCRC(const UserTableHeader& header) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&header, offsetof(UserTableHeader, crc32));
+}
+
+static bool writeHeader() {
+    UserTableHeader header;
+    header.magic = USER_TABLE_MAGIC;
+    header.version = USER_TABLE_VERSION;
+    header.recordSize = sizeof(UserRecord);
+    header.slotCount = slotStates.size();
+    header.recordCount = recordCount;
+    header.crc32 = headerCRC(header);
+    
+    nvsWriteCount++;
+    return userPrefs.putBytes("utbl_hdr", &header, sizeof(header)) == sizeof(header);
+}
+
+// ================== Chunk Access ==================
+// Loads chunk into chunkBuffer. A missing or corrupt chunk reads as empty.
+static bool loadChunk(uint32_t chunk) {
+    if (bufferedChunk == (int32_t)chunk) return true;
+    
+    char key[16];
+    chunkKey(key, sizeof(key), chunk);
+    bufferedChunk = chunk;
+    if (userPrefs.getBytes(key, &chunkBuffer, sizeof(chunkBuffer)) != sizeof(chunkBuffer)) {
+        memset(&chunkBuffer, 0, sizeof(chunkBuffer));
+        return false;
+    }
+    if (chunkBuffer.crc32 != chunkCRC(chunkBuffer)) {
+        Serial.printf("User table chunk %lu failed CRC check\n", (unsigned long)chunk);
+        memset(&chunkBuffer, 0, sizeof(chunkBuffer));
+        return false;
+    }
+    return true;
+}
+
+static bool storeChunk() {
+    char key[16];
+    chunkKey(key, sizeof(key), bufferedChunk);
+    chunkBuffer.crc32 = chunkCRC(chunkBuffer);
+    
+    nvsWriteCount++;
+    if (userPrefs.putBytes(key, &chunkBuffer, sizeof(chunkBuffer)) != sizeof(chunkBuffer)) {
+        Serial.printf("Failed to write user table chunk %ld\n", (long)bufferedChunk);
+        bufferedChunk = -1; // Flash may not match the buffer any more
+        return false;
+    }
+    return true;
+}
+
+static void encodeRecord(const User& user, UserRecord& record) {
+    memset(&record, 0, sizeof(record));
+    record.credit = user.credit;
+    record.uidSize = user.uid.size;
+    memcpy(record.uid, user.uid.bytes, sizeof(record.uid));
+    record.flags = USER_RECORD_USED |
+                   (user.in ? USER_RECORD_IN : 0) |
+                   (user.type == USER_STATIC ? USER_RECORD_STATIC : 0);
+    
+    // Names are already cut to USER_NAME_MAX - 1 bytes by storeUserName
+    memcpy(record.name, user.name, strnlen(user.name, USER_NAME_MAX - 1));
+}
+
+// ================== Slot Allocation ==================
+// Callers write the header once they are done allocating
+static uint16_t allocateSlot(UserType type) {
+    uint8_t state = type == USER_STATIC ? SLOT_STATIC : SLOT_DYNAMIC;
+    recordCount++;
+    for (size_t i = 0; i < slotStates.size(); i++) {
+        if (slotStates[i] == SLOT_FREE) {
+            slotStates[i] = state;
+            return (uint16_t)i;
+        }
+    }
+    
+    // No free slot below the high-water mark, grow the table by one
+    slotStates.push_back(state);
+    return (uint16_t)(slotStates.size() - 1);
+}
+
+static void releaseSlot(uint16_t slot) {
+    if (slot < slotStates.size() && slotStates[slot] != SLOT_FREE) {
+        slotStates[slot] = SLOT_FREE;
+        recordCount--;
+    }
+}
+
+// ================== Legacy Migration ==================
+// Reads the pre-blob "s{i}_uid"/"d{i}_name"/... per-field keys of one table
+static void loadLegacyUsers(UserType type, std::vector<User>& users, NameArena& names) {
+    const char* countKey = type == USER_STATIC ? "static_count" : "dynamic_count";
+    char prefix = type == USER_STATIC ? 's' : 'd';
+    size_t count = userPrefs.getUInt(countKey, 0);
+    
+    char key[16];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "%c%u_uid", prefix, (unsigned)i);
+        String uid = userPrefs.getString(key, "");
+        snprintf(key, sizeof(key), "%c%u_name", prefix, (unsigned)i);
+        String name = userPrefs.getString(key, "");
+        snprintf(key, sizeof(key), "%c%u_credit", prefix, (unsigned)i);
+        long credit = userPrefs.getLong(key, DEFAULT_CREDIT);
+        snprintf(key, sizeof(key), "%c%u_in", prefix, (unsigned)i);
+        bool in = userPrefs.getBool(key, false);
+        
+        CardUID cardUID;
+        if (parseUID(uid, cardUID) && name.length() > 0) {
+            users.emplace_back(cardUID, storeUserName(names, name.c_str()), credit, in, type);
+        }
+    }
+}
+
+static void removeLegacyKeys(UserType type) {
+    const char* countKey = type == USER_STATIC ? "static_count" : "dynamic_count";
+    const char* fields[] = {"uid", "name", "credit", "in"};
+    char prefix = type == USER_STATIC ? 's' : 'd';
+    size_t count = userPrefs.getUInt(countKey, 0);
+    
+    char key[16];
+    for (size_t i = 0; i < count; i++) {
+        for (const char* field : fields) {
+            snprintf(key, sizeof(key), "%c%u_%s", prefix, (unsigned)i, field);
+            userPrefs.remove(key);
+        }
+    }
+    userPrefs.remove(countKey);
+}
+
+static void migrateLegacyUsers(std::vector<User>& staticList, std::vector<User>& dynamicList, NameArena& names) {
+    if (!userPrefs.isKey("static_count") && !userPrefs.isKey("dynamic_count")) {
+        return; // Fresh device
+    }
+    
+    Serial.println("Migrating user table to blob format...");
+    loadLegacyUsers(USER_STATIC, staticList, names);
+    loadLegacyUsers(USER_DYNAMIC, dynamicList, names);
+    
+    // New users are all dirty without a slot, so this writes the full table
+    saveDirtyUserRecords(staticList);
+    saveDirtyUserRecords(dynamicList);
+    
+    // Only drop the old keys once every record made it into the new table
+    bool complete = true;
+    for (const User& user : staticList) complete &= !user.dirty;
+    for (const User& user : dynamicList) complete &= !user.dirty;
+    if (complete) {
+        removeLegacyKeys(USER_STATIC);
+        removeLegacyKeys(USER_DYNAMIC);
+        Serial.printf("Migrated %u users\n", (unsigned)(staticList.size() + dynamicList.size()));
+    } else {
+        Serial.println("User table migration incomplete - legacy keys kept");
+    }
+}
+
+// ================== User Record Storage ==================
+void loadUserTable(std::vector<User>& staticList, std::vector<User>& dynamicList, NameArena& names) {
+    staticList.clear();
+    dynamicList.clear();
+    slotStates.clear();
+    recordCount = 0;
+    bufferedChunk = -1;
+    
+    UserTableHeader header;
+    bool valid = userPrefs.getBytes("utbl_hdr", &header, sizeof(header)) == sizeof(header) &&
+                 header.magic == USER_TABLE_MAGIC &&
+                 header.crc32 == headerCRC(header);
+    if (!valid) {
+        migrateLegacyUsers(staticList, dynamicList, names);
+        return;
+    }
+    if (header.version != USER_TABLE_VERSION || header.recordSize != sizeof(UserRecord)) {
+        Serial.printf("Unsupported user table version %u - starting empty\n", header.version);
+        return;
+    }
+    
+    slotStates.assign(header.slotCount, SLOT_FREE);
+    dynamicList.reserve(header.recordCount);
+    
+    uint32_t chunks = (header.slotCount + USER_RECORDS_PER_CHUNK - 1) / USER_RECORDS_PER_CHUNK;
+    for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+        loadChunk(chunk);
+        for (uint32_t i = 0; i < USER_RECORDS_PER_CHUNK; i++) {
+            uint32_t slot = chunk * USER_RECORDS_PER_CHUNK + i;
+            const UserRecord& record = chunkBuffer.records[i];
+            if (slot >= header.slotCount || !(record.flags & USER_RECORD_USED)) continue;
+            
+            CardUID uid(record.uid, record.uidSize);
+            if (!uid.isValid()) continue;
+            
+            size_t nameLength = strnlen(record.name, USER_NAME_MAX - 1);
+            
+            UserType type = (record.flags & USER_RECORD_STATIC) ? USER_STATIC : USER_DYNAMIC;
+            std::vector<User>& users = type == USER_STATIC ? staticList : dynamicList;
+            users.emplace_back(uid, names.store(record.name, nameLength), record.credit,
+                               (record.flags & USER_RECORD_IN) != 0, type);
+            users.back().slot = slot;
+            users.back().dirty = 0;
+            slotStates[slot] = type == USER_STATIC ? SLOT_STATIC : SLOT_DYNAMIC;
+            recordCount++;
+        }
+    }
+}
+
+bool saveUserRecord(User& user) {
+    if (!user.dirty) return true;
+    
+    // Header first: a slot past the stored high-water mark would be ignored on boot
+    if (user.slot == USER_SLOT_NONE) {
+        user.slot = allocateSlot(user.type);
+        writeHeader();
+    }
+    
+    loadChunk(user.slot / USER_RECORDS_PER_CHUNK);
+    encodeRecord(user, chunkBuffer.records[user.slot % USER_RECORDS_PER_CHUNK]);
+    if (!storeChunk()) {
+        return false;
+    }
+    user.dirty = 0;
+    return true;
+}
+
+void saveDirtyUserRecords(std::vector<User>& users) {
+    // Give new users their slots first, then write each touched chunk once
+    std::vector<User*> dirtyUsers;
+    bool allocated = false;
+    for (User& user : users) {
+        if (!user.dirty) continue;
+        if (user.slot == USER_SLOT_NONE) {
+            user.slot = allocateSlot(user.type);
+            allocated = true;
+        }
+        dirtyUsers.push_back(&user);
+    }
+    if (allocated) {
+        writeHeader();
+    }
+    std::sort(dirtyUsers.begin(), dirtyUsers.end(),
+              [](const User* a, const User* b) { return a->slot < b->slot; });
+    
+    for (size_t i = 0; i < dirtyUsers.size(); ) {
+        uint32_t chunk = dirtyUsers[i]->slot / USER_RECORDS_PER_CHUNK;
+        loadChunk(chunk);
+        
+        size_t end = i;
+        while (end < dirtyUsers.size() && dirtyUsers[end]->slot / USER_RECORDS_PER_CHUNK == chunk) {
+            User* user = dirtyUsers[end++];
+            encodeRecord(*user, chunkBuffer.records[user->slot % USER_RECORDS_PER_CHUNK]);
+        }
+        
+        if (storeChunk()) {
+            for (; i < end; i++) dirtyUsers[i]->dirty = 0;
+        }
+        i = end;
+    }
+}
+
+bool eraseUserRecord(User& user) {
+    if (user.slot == USER_SLOT_NONE) return true;
+    
+    loadChunk(user.slot / USER_RECORDS_PER_CHUNK);
+    memset(&chunkBuffer.records[user.slot % USER_RECORDS_PER_CHUNK], 0, sizeof(UserRecord));
+    if (!storeChunk()) {
+        return false;
+    }
+    
+    releaseSlot(user.slot);
+    writeHeader();
+    user.slot = USER_SLOT_NONE;
+    user.dirty = USER_DIRTY_ALL;
+    return true;
+}
+
+bool eraseUserRecords(std::vector<User>& users) {
+    // Each touched chunk is written once
+    std::vector<User*> storedUsers;
+    for (User& user : users) {
+        if (user.slot != USER_SLOT_NONE) storedUsers.push_back(&user);
+    }
+    std::sort(storedUsers.begin(), storedUsers.end(),
+              [](const User* a, const User* b) { return a->slot < b->slot; });
+    
+    bool ok = true;
+    bool released = false;
+    for (size_t i = 0; i < storedUsers.size(); ) {
+        uint32_t chunk = storedUsers[i]->slot / USER_RECORDS_PER_CHUNK;
+        loadChunk(chunk);
+        
+        size_t end = i;
+        while (end < storedUsers.size() && storedUsers[end]->slot / USER_RECORDS_PER_CHUNK == chunk) {
+            memset(&chunkBuffer.records[storedUsers[end++]->slot % USER_RECORDS_PER_CHUNK], 0, sizeof(UserRecord));
+        }
+        
+        if (storeChunk()) {
+            for (; i < end; i++) {
+                releaseSlot(storedUsers[i]->slot);
+                storedUsers[i]->slot = USER_SLOT_NONE;
+                storedUsers[i]->dirty = USER_DIRTY_ALL;
+            }
+            released = true;
+        } else {
+            ok = false;
+        }
+        i = end;
+    }
+    if (released) {
+        writeHeader();
+    }
+    return ok;
+}
+
+// ================== Storage Statistics ==================
+uint32_t getNVSWriteCount() {
+    return nvsWriteCount;
+}
@@ -0,0 +1,57 @@
+#ifndef USERSTORE_H
+#define USERSTORE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "users.h"
+
+// ================== User Table Format ==================
+// Users are stored as fixed-size binary records packed into NVS blobs:
+//   "utbl_hdr"   UserTableHeader (format version, slot/record counts, CRC32)
+//   "utbl_c{k}"  chunk k: USER_RECORDS_PER_CHUNK records + CRC32 trailer
+// Every user owns a stable record slot (chunk = slot / USER_RECORDS_PER_CHUNK)
+// for its lifetime, so a change rewrites one chunk and boot reads one blob
+// per 64 users. Tables in the old per-field "s{i}_"/"d{i}_" key scheme are
+// migrated once on first boot. At 48 bytes per user, rosters beyond a few
+// hundred users need a larger "nvs" partition than the default 20 KB.
+#define USER_TABLE_MAGIC        0x4C425455UL  // "UTBL"
+#define USER_TABLE_VERSION      1
+#define USER_RECORDS_PER_CHUNK  64
+#define USER_NAME_MAX           32            // Bytes incl. terminator, UTF-8
+
+enum UserRecordFlags : uint8_t {
+    USER_RECORD_USED   = 0x01,
+    USER_RECORD_IN     = 0x02,
+    USER_RECORD_STATIC = 0x04
+};
+
+struct UserRecord {
+    int32_t credit;
+    uint8_t uidSize;
+    uint8_t uid[UID_MAX_BYTES];
+    uint8_t flags;               // UserRecordFlags
+    char name[USER_NAME_MAX];    // NUL padded
+};
+
+struct UserTableHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t slotCount;          // Slot high-water mark
+    uint32_t recordCount;        // Slots in use
+    uint32_t crc32;              // Over the fields above
+};
+
+// ================== User Record Storage ==================
+void loadUserTable(std::vector<User>& staticList, std::vector<User>& dynamicList, NameArena& names);
+bool saveUserRecord(User& user);
+void saveDirtyUserRecords(std::vector<User>& users);
+// Erased users get USER_SLOT_NONE; those whose record could not be erased
+// keep their slot, and the result is false
+bool eraseUserRecord(User& user);
+bool eraseUserRecords(std::vector<User>& users);
+
+// ================== Storage Statistics ==================
+uint32_t getNVSWriteCount();
+
+#endif // USERSTORE_H
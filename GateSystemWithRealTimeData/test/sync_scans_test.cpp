@@ -0,0 +1,154 @@
+// ================== Scan During a Sync Test (host) ==================
+// A sync builds the next user table from copies of the live users and
+// publishes it when it ends. Cards scanned in between change the live table
+// only. This runs that sequence for a delta and a full sync against
+// main/syncscans.h, the code endUserSync() uses to merge the scans into
+// the copy before publishing it, and checks that no scanned credit,
+// presence or dirty flag is lost.
+//
+// Build and run on a PC:
+//   g++ -O2 -std=c++17 -I../main sync_scans_test.cpp ../main/carduid.cpp -o sync_scans_test
+//   ./sync_scans_test
+
+#include <cstdio>
+#include <vector>
+#include "syncscans.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                              \
+    do {                                                              \
+        if (!(condition)) {                                           \
+            printf("FAIL line %d: %s\n", __LINE__, #condition);       \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+// Stand-in for UserTable: the merge only needs find()
+struct TestTable {
+    std::vector<User> users;
+    
+    User* find(const CardUID& uid) {
+        for (User& user : users) {
+            if (user.uid == uid) return &user;
+        }
+        return nullptr;
+    }
+};
+
+static CardUID testUID(uint8_t id) {
+    uint8_t bytes[4] = {0x04, 0xA1, 0x00, id};
+    return CardUID(bytes, sizeof(bytes));
+}
+
+// Stored user as loaded from NVS: nothing dirty
+static User storedUser(uint8_t id, long credit, bool in, uint16_t slot) {
+    User user(testUID(id), "", credit, in, USER_DYNAMIC);
+    user.slot = slot;
+    user.dirty = 0;
+    return user;
+}
+
+// A granted scan as processCardScan() and updateUserState() make it
+static void scan(TestTable& live, SyncScanLog& log, uint8_t id) {
+    User& user = *live.find(testUID(id));
+    bool isEntry = !user.in;
+    applyScan(user, isEntry, scanCost(isEntry));
+    log.note(user.uid);
+}
+
+int main() {
+    TestTable live;
+    live.users.push_back(storedUser(1, 50000, false, 0));
+    live.users.push_back(storedUser(2, 20000, true, 1));
+    live.users.push_back(storedUser(3, 30000, false, 2));
+    live.users.push_back(storedUser(4, 40000, false, 3));
+    
+    // A scan before the sync is already in the copy
+    SyncScanLog log;
+    scan(live, log, 4);
+    CHECK(log.scanned().empty());
+    
+    // beginUserSync(): start logging, copy the table
+    log.begin();
+    TestTable next = live;
+    
+    // Records arrive: user 2 gets a top-up, user 3 is tombstoned, user 5 is new
+    next.find(testUID(2))->credit = 25000;
+    next.find(testUID(2))->dirty |= USER_DIRTY_CREDIT;
+    next.users.erase(next.users.begin() + 2);
+    next.users.push_back(User(testUID(5), "", 10000, false, USER_DYNAMIC));
+    
+    // Meanwhile the gate lets users 1, 2 and 3 pass
+    scan(live, log, 1);
+    scan(live, log, 2);
+    scan(live, log, 3);
+    scan(live, log, 1);
+    scan(live, log, 1);
+    CHECK(log.scanned().size() == 3);
+    
+    // A journal compaction writes user 1 and clears its dirty flags
+    live.find(testUID(1))->dirty = 0;
+    
+    // endUserSync(true): merge under the table lock, then publish
+    log.merge(next, live);
+    log.end();
+    
+    // User 1: entered, left, entered - the copy was still out with 50000
+    const User* user1 = next.find(testUID(1));
+    CHECK(user1 && user1->in && user1->credit == 50000 - COST_PER_EXIT);
+    CHECK(user1 && (user1->dirty & USER_DIRTY_IN) && (user1->dirty & USER_DIRTY_CREDIT));
+    CHECK(user1 && user1->slot == 0);
+    
+    // User 2 left after the server copy was made, so the exit stands
+    const User* user2 = next.find(testUID(2));
+    CHECK(user2 && !user2->in && user2->credit == 20000 - COST_PER_EXIT);
+    CHECK(user2 && (user2->dirty & USER_DIRTY_IN) && (user2->dirty & USER_DIRTY_CREDIT));
+    
+    // User 3 stays deleted, users 4 and 5 are as the sync left them
+    CHECK(next.find(testUID(3)) == nullptr);
+    const User* user4 = next.find(testUID(4));
+    CHECK(user4 && user4->in && user4->credit == 40000);
+    const User* user5 = next.find(testUID(5));
+    CHECK(user5 && user5->credit == 10000 && user5->slot == USER_SLOT_NONE);
+    
+    // After the publish scans go to the published table, not the log
+    scan(next, log, 4);
+    CHECK(log.scanned().empty());
+    
+    // Full sync: a user is copied from the live table when its record
+    // arrives and takes the server's values, which predate a scan made
+    // before or after that
+    TestTable full;
+    full.users.push_back(storedUser(7, 30000, true, 4));
+    full.users.push_back(storedUser(8, 30000, false, 5));
+    log.begin();
+    TestTable rebuilt;
+    scan(full, log, 7);
+    rebuilt.users.push_back(*full.find(testUID(7)));
+    rebuilt.users.back().credit = 30000;
+    rebuilt.users.back().in = true;
+    rebuilt.users.push_back(*full.find(testUID(8)));
+    scan(full, log, 8);
+    log.merge(rebuilt, full);
+    log.end();
+    CHECK(!rebuilt.users[0].in && rebuilt.users[0].credit == 30000 - COST_PER_EXIT);
+    CHECK(rebuilt.users[1].in && (rebuilt.users[1].dirty & USER_DIRTY_IN));
+    
+    // A user added by hand during the sync and also sent by the server
+    // keeps the record slot it was given
+    TestTable added;
+    added.users.push_back(storedUser(6, 10000, false, 7));
+    log.begin();
+    TestTable synced;
+    synced.users.push_back(User(testUID(6), "", 10000, false, USER_DYNAMIC));
+    scan(added, log, 6);
+    log.merge(synced, added);
+    log.end();
+    CHECK(synced.users[0].slot == 7 && synced.users[0].in);
+    
+    if (failures == 0) {
+        printf("sync_scans_test: all checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}